@@ -20,9 +20,12 @@
 #include <cassert>
 #include <string>
 #include <cstring>
+#include <type_traits>
 #include "AMBEData.h"
 #include "Utils.h"
 
+static_assert(std::is_trivially_copyable<CAMBEData>::value, "CAMBEData should be copied with memcpy");
+
 CAMBEData::CAMBEData() :
 m_rptSeq(0U),
 m_outSeq(0U),
@@ -30,34 +33,11 @@ m_id(0U),
 m_band1(0x00U),
 m_band2(0x02U),
 m_band3(0x01U),
-m_yourAddress(),
 m_yourPort(0U),
 m_myPort(0U),
-m_errors(0U),
-m_text(),
-m_header()
-{
-}
-
-CAMBEData::CAMBEData(const CAMBEData &data) :
-m_rptSeq(data.m_rptSeq),
-m_outSeq(data.m_outSeq),
-m_id(data.m_id),
-m_band1(data.m_band1),
-m_band2(data.m_band2),
-m_band3(data.m_band3),
-m_yourAddress(data.m_yourAddress),
-m_yourPort(data.m_yourPort),
-m_myPort(data.m_myPort),
-m_errors(data.m_errors),
-m_text(data.m_text),
-m_header(data.m_header)
-{
-	memcpy(m_data, data.m_data, DV_FRAME_LENGTH_BYTES);
-}
-
-CAMBEData::~CAMBEData()
+m_errors(0U)
 {
+	m_yourAddress[0] = '\0';
 }
 
 bool CAMBEData::setG2Data(const unsigned char *data, unsigned int length, const std::string &yourAddress, unsigned short yourPort)
@@ -73,8 +53,7 @@ bool CAMBEData::setG2Data(const unsigned char *data, unsigned int length, const
 
 	memcpy(m_data, data + 15U, DV_FRAME_LENGTH_BYTES);
 
-	m_yourAddress = yourAddress;
-	m_yourPort    = yourPort;
+	setDestination(yourAddress, yourPort);
 
 	return true;
 }
@@ -92,8 +71,7 @@ bool CAMBEData::setDExtraData(const unsigned char *data, unsigned int length, co
 
 	memcpy(m_data, data + 15U, DV_FRAME_LENGTH_BYTES);
 
-	m_yourAddress = yourAddress;
-	m_yourPort    = yourPort;
+	setDestination(yourAddress, yourPort);
 	m_myPort      = myPort;
 
 	return true;
@@ -104,8 +82,6 @@ bool CAMBEData::setDCSData(const unsigned char *data, unsigned int length, const
 	assert(data != NULL);
 	assert(length >= 100U);
 
-	m_header.setDCSData(data, length, yourAddress, yourPort, myPort);
-
 	m_id     = data[44] * 256U + data[43];
 
 	m_outSeq = data[45];
@@ -114,8 +90,7 @@ bool CAMBEData::setDCSData(const unsigned char *data, unsigned int length, const
 
 	m_rptSeq = data[60] * 65536U + data[59] * 256U + data[58];
 
-	m_yourAddress = yourAddress;
-	m_yourPort    = yourPort;
+	setDestination(yourAddress, yourPort);
 	m_myPort      = myPort;
 
 	return true;
@@ -215,10 +190,7 @@ unsigned int CAMBEData::getDCSData(unsigned char *data, unsigned int length) con
 
 	data[63] = 0x21U;
 
-	for (unsigned int i = 0U; i < m_text.size(); i++)
-		data[64 + i] = m_text[i];
-
-	m_header.getDCSData(data, 100U);
+	// the header, bytes 4 to 42, is filled in from the stream's CHeaderData
 
 	return 100U;
 }
@@ -303,16 +275,12 @@ bool CAMBEData::isSync() const
 
 void CAMBEData::setDestination(const std::string &address, unsigned short port)
 {
-	m_yourAddress = address;
-	m_yourPort    = port;
+	::strncpy(m_yourAddress, address.c_str(), INET6_ADDRSTRLEN - 1);
+	m_yourAddress[INET6_ADDRSTRLEN - 1] = '\0';
+	m_yourPort = port;
 }
 
-void CAMBEData::setText(const std::string& text)
-{
-	m_text = text;
-}
-
-std::string CAMBEData::getYourAddress() const
+const char *CAMBEData::getYourAddress() const
 {
 	return m_yourAddress;
 }
@@ -327,11 +295,6 @@ unsigned short CAMBEData::getMyPort() const
 	return m_myPort;
 }
 
-CHeaderData& CAMBEData::getHeader()
-{
-	return m_header;
-}
-
 unsigned int CAMBEData::getErrors() const
 {
 	return m_errors;
@@ -355,24 +318,12 @@ unsigned int CAMBEData::getData(unsigned char *data, unsigned int length) const
 	return DV_FRAME_LENGTH_BYTES;
 }
 
-CAMBEData& CAMBEData::operator=(const CAMBEData& data)
+std::chrono::steady_clock::time_point CAMBEData::getRxTime() const
 {
-	if (&data != this) {
-		m_rptSeq      = data.m_rptSeq;
-		m_outSeq      = data.m_outSeq;
-		m_id          = data.m_id;
-		m_band1       = data.m_band1;
-		m_band2       = data.m_band2;
-		m_band3       = data.m_band3;
-		m_yourAddress = data.m_yourAddress;
-		m_yourPort    = data.m_yourPort;
-		m_myPort      = data.m_myPort;
-		m_errors      = data.m_errors;
-		m_text        = data.m_text;
-		m_header      = data.m_header;
-
-		::memcpy(m_data, data.m_data, DV_FRAME_LENGTH_BYTES);
-	}
+	return m_rxTime;
+}
 
-	return *this;
+void CAMBEData::setRxTime(std::chrono::steady_clock::time_point rxTime)
+{
+	m_rxTime = rxTime;
 }
@@ -20,15 +20,17 @@
 #pragma once
 
 #include <string>
+#include <chrono>
+#include <netinet/in.h>
 
-#include "HeaderData.h"
 #include "DStarDefines.h"
 
+// A single voice frame. It is kept small and trivially copyable: the DCS
+// header that travels with every DCS frame belongs to the stream, so it is
+// held by the DCS link and not here.
 class CAMBEData {
 public:
 	CAMBEData();
-	CAMBEData(const CAMBEData &data);
-	~CAMBEData();
 
 	bool setG2Data(const unsigned char *data, unsigned int length, const std::string &yourAddress, unsigned short yourPort);
 	bool setDExtraData(const unsigned char *data, unsigned int length, const std::string &yourAddress, unsigned short yourPort, unsigned short myPort);
@@ -64,17 +66,15 @@ public:
 
 	void setDestination(const std::string &address, unsigned short port);
 
-	void setText(const std::string &text);
-
-	std::string    getYourAddress() const;
+	const char    *getYourAddress() const;
 	unsigned short getYourPort() const;
 	unsigned short getMyPort() const;
 
 	unsigned int getErrors() const;
 
-	CHeaderData &getHeader();
-
-	CAMBEData& operator=(const CAMBEData &data);
+	// when the packet was read from the network, used to measure how long it takes to relay
+	std::chrono::steady_clock::time_point getRxTime() const;
+	void setRxTime(std::chrono::steady_clock::time_point rxTime);
 
 private:
 	unsigned int   m_rptSeq;
@@ -83,11 +83,10 @@ private:
 	unsigned char  m_band1;
 	unsigned char  m_band2;
 	unsigned char  m_band3;
-	std::string    m_yourAddress;
+	char           m_yourAddress[INET6_ADDRSTRLEN];
 	unsigned short m_yourPort;
 	unsigned short m_myPort;
 	unsigned int   m_errors;
-	std::string    m_text;
-	CHeaderData    m_header;
 	unsigned char  m_data[DV_FRAME_LENGTH_BYTES];
+	std::chrono::steady_clock::time_point m_rxTime;
 };
@@ -51,6 +51,25 @@ static const unsigned short ccittTab[] = {
 	0xf78f,0xe606,0xd49d,0xc514,0xb1ab,0xa022,0x92b9,0x8330,
 	0x7bc7,0x6a4e,0x58d5,0x495c,0x3de3,0x2c6a,0x1ef1,0x0f78};
 
+// sliceTab[n][b] is the crc of byte b followed by n zero bytes
+static uint16_t sliceTab[8][256];
+
+static bool buildSliceTab()
+{
+	for (unsigned int i = 0U; i < 256U; i++)
+		sliceTab[0][i] = ccittTab[i];
+
+	for (unsigned int n = 1U; n < 8U; n++) {
+		for (unsigned int i = 0U; i < 256U; i++) {
+			uint16_t crc = sliceTab[n - 1U][i];
+			sliceTab[n][i] = (crc >> 8) ^ ccittTab[crc & 0xFF];
+		}
+	}
+
+	return true;
+}
+
+static const bool sliceTabReady = buildSliceTab();
 
 CCCITTChecksum::CCCITTChecksum() :
 m_crc(0xFFFF)
@@ -65,6 +84,19 @@ void CCCITTChecksum::update(const unsigned char* data, unsigned int length)
 {
 	assert(data != NULL);
 
+	// slicing-by-8, a D-Star header is four passes and a three byte tail
+	while (length >= 8U) {
+		uint16_t crc = m_crc ^ (data[0] | (data[1] << 8));
+
+		m_crc = sliceTab[7][crc & 0xFF] ^ sliceTab[6][crc >> 8] ^
+				sliceTab[5][data[2]] ^ sliceTab[4][data[3]] ^
+				sliceTab[3][data[4]] ^ sliceTab[2][data[5]] ^
+				sliceTab[1][data[6]] ^ sliceTab[0][data[7]];
+
+		data   += 8U;
+		length -= 8U;
+	}
+
 	for (unsigned int i = 0U; i < length; i++) {
 		unsigned short byte = data[i];
 
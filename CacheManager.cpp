@@ -16,7 +16,30 @@
  *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <cstring>
+
 #include "CacheManager.h"
+#include "Replication.h"
+
+void CCacheManager::registerMetrics(const std::string &labels)
+{
+	const std::string sep(labels.empty() ? "" : ",");
+	CMetrics::add(this, "sgs_cache_lookups_total", labels + sep + CMetrics::label("result", "hit"), &m_hits);
+	CMetrics::add(this, "sgs_cache_lookups_total", labels + sep + CMetrics::label("result", "miss"), &m_misses);
+	const struct {
+		const char *name;
+		std::unordered_map<std::string, std::string> *table;
+	} tables[] = { { "user", &UserRptr }, { "repeater", &RptrGate }, { "gateway", &GateAddr }, { "name", &NameNick } };
+	CMetrics::add(this, "sgs_cache_events_total", labels, &m_published);
+	CMetrics::add(this, "sgs_cache_event_overflows_total", labels, &m_overflows);
+	for (auto &t : tables) {
+		auto table = t.table;
+		CMetrics::add(this, "sgs_cache_entries", labels + sep + CMetrics::label("table", t.name), [this, table]() {
+			std::lock_guard<std::mutex> lock(mux);
+			return double(table->size());
+		});
+	}
+}
 
 void CCacheManager::findUserData(const std::string &user, std::string &rptr, std::string &gate, std::string &addr)
 {
@@ -25,6 +48,7 @@ void CCacheManager::findUserData(const std::string &user, std::string &rptr, std
 	gate.assign(findRptrGate(rptr));
 	addr.assign(findGateAddr(gate));
 	mux.unlock();
+	countLookup(addr);
 }
 
 void CCacheManager::findRptrData(const std::string &rptr, std::string &gate, std::string &addr)
@@ -33,6 +57,7 @@ void CCacheManager::findRptrData(const std::string &rptr, std::string &gate, std
 	gate.assign(findRptrGate(rptr));
 	addr.assign(findGateAddr(gate));
 	mux.unlock();
+	countLookup(addr);
 }
 
 std::string CCacheManager::findUserAddr(const std::string &user)
@@ -40,6 +65,7 @@ std::string CCacheManager::findUserAddr(const std::string &user)
 	mux.lock();
 	std::string addr(findGateAddr(findRptrGate(findUserRptr(user))));
 	mux.unlock();
+	countLookup(addr);
 
 	return addr;
 }
@@ -102,6 +128,9 @@ std::string CCacheManager::findServerUser()
 
 void CCacheManager::updateUser(const std::string &user, const std::string &rptr, const std::string &gate, const std::string &addr, const std::string &time)
 {
+	if (isRecorded())
+		record(CT_CACHE_USER, { user, rptr, gate, addr, time });
+
 	if (user.empty())
 		return;
 
@@ -114,7 +143,7 @@ void CCacheManager::updateUser(const std::string &user, const std::string &rptr,
 		return;
 	}
 
-	UserRptr[user] = rptr;
+	set(UserRptr, user, rptr, CE_USER);
 
 	if (gate.empty() || addr.empty()) {
 		mux.unlock();
@@ -122,29 +151,35 @@ void CCacheManager::updateUser(const std::string &user, const std::string &rptr,
 	}
 
 	if (rptr.compare(0, 7, gate, 0, 7))
-		RptrGate[rptr] = gate;	// only do this if they differ
+		set(RptrGate, rptr, gate, CE_REPEATER);	// only do this if they differ
 
-	GateAddr[gate] = addr;
+	set(GateAddr, gate, addr, CE_GATEWAY);
 	mux.unlock();
 }
 
 void CCacheManager::updateRptr(const std::string &rptr, const std::string &gate, const std::string &addr)
 {
+	if (isRecorded())
+		record(CT_CACHE_RPTR, { rptr, gate, addr });
+
 	if (rptr.empty() || gate.empty())
 		return;
 
 	mux.lock();
-	RptrGate[rptr] = gate;
+	set(RptrGate, rptr, gate, CE_REPEATER);
 	if (addr.empty()) {
 		mux.unlock();
 		return;
 	}
-	GateAddr[gate] = addr;
+	set(GateAddr, gate, addr, CE_GATEWAY);
 	mux.unlock();
 }
 
 void CCacheManager::updateGate(const std::string &G, const std::string &addr)
 {
+	if (isRecorded())
+		record(CT_CACHE_GATE, { G, addr });
+
 	if (G.empty() || addr.empty())
 		return;
 	std::string gate(G);
@@ -154,12 +189,15 @@ void CCacheManager::updateGate(const std::string &G, const std::string &addr)
 		p = gate.find('_');
 	}
 	mux.lock();
-	GateAddr[gate] = addr;
+	set(GateAddr, gate, addr, CE_GATEWAY);
 	mux.unlock();
 }
 
 void CCacheManager::updateName(const std::string &name, const std::string &nick)
 {
+	if (isRecorded())
+		record(CT_CACHE_NAME, { name, nick });
+
 	if (name.empty() || nick.empty())
 		return;
 	mux.lock();
@@ -169,13 +207,20 @@ void CCacheManager::updateName(const std::string &name, const std::string &nick)
 
 void CCacheManager::eraseGate(const std::string &gate)
 {
+	if (isRecorded())
+		record(CT_CACHE_ERASE_GATE, { gate });
+
 	mux.lock();
-	GateAddr.erase(gate);
+	if (GateAddr.erase(gate))
+		publish(CE_GATEWAY, gate);
 	mux.unlock();
 }
 
 void CCacheManager::eraseName(const std::string &name)
 {
+	if (isRecorded())
+		record(CT_CACHE_ERASE_NAME, { name });
+
 	mux.lock();
 	NameNick.erase(name);
 	mux.unlock();
@@ -183,18 +228,173 @@ void CCacheManager::eraseName(const std::string &name)
 
 void CCacheManager::clearGate()
 {
+	if (isRecorded())
+		record(CT_CACHE_CLEAR_GATE, { });
+
 	mux.lock();
 	for (auto it=GateAddr.begin(); it!=GateAddr.end(); ) {
-		if (it->first.compare(0, 3, "DCS") && it->first.compare(0, 3, "XRF"))	// don't erase the reflectors
+		if (it->first.compare(0, 3, "DCS") && it->first.compare(0, 3, "XRF")) {	// don't erase the reflectors
+			publish(CE_GATEWAY, it->first);
 			it = GateAddr.erase(it);
-		else
+		} else
 			it++;
 	}
 	NameNick.clear();
 	mux.unlock();
 }
 
-// these last three functions are private and not mux locked.
+void CCacheManager::replay(CAPTURE_TYPE type, std::vector<std::string> f)
+{
+	f.resize(5);
+	switch (type) {
+		case CT_CACHE_USER:
+			updateUser(f[0], f[1], f[2], f[3], f[4]);
+			break;
+		case CT_CACHE_RPTR:
+			updateRptr(f[0], f[1], f[2]);
+			break;
+		case CT_CACHE_GATE:
+			updateGate(f[0], f[1]);
+			break;
+		case CT_CACHE_NAME:
+			updateName(f[0], f[1]);
+			break;
+		case CT_CACHE_ERASE_GATE:
+			eraseGate(f[0]);
+			break;
+		case CT_CACHE_ERASE_NAME:
+			eraseName(f[0]);
+			break;
+		case CT_CACHE_CLEAR_GATE:
+			clearGate();
+			break;
+		default:
+			break;
+	}
+}
+
+void CCacheManager::save(std::ostream &out, const std::string &tag)
+{
+	std::lock_guard<std::mutex> lock(mux);
+	const struct {
+		const char *name;
+		std::unordered_map<std::string, std::string> *table;
+	} tables[] = { { "user", &UserRptr }, { "time", &UserTime }, { "repeater", &RptrGate }, { "gateway", &GateAddr }, { "name", &NameNick } };
+	for (auto &t : tables) {
+		for (auto it=t.table->begin(); it!=t.table->end(); it++)
+			out << tag << '\t' << t.name << '\t' << it->first << '\t' << it->second << '\n';
+	}
+}
+
+bool CCacheManager::restore(const std::string &table, const std::string &key, const std::string &value)
+{
+	std::unordered_map<std::string, std::string> *map;
+	if (0 == table.compare("user"))
+		map = &UserRptr;
+	else if (0 == table.compare("time"))
+		map = &UserTime;
+	else if (0 == table.compare("repeater"))
+		map = &RptrGate;
+	else if (0 == table.compare("gateway"))
+		map = &GateAddr;
+	else if (0 == table.compare("name"))
+		map = &NameNick;
+	else
+		return true;
+
+	std::lock_guard<std::mutex> lock(mux);
+	(*map)[key] = value;
+	return false;
+}
+
+void CCacheManager::subscribe(CACHE_EVENT type, const std::string &key, ICacheListener *listener)
+{
+	const std::string k(char('0' + type) + key);
+	std::lock_guard<std::mutex> lock(m_listenMux);
+	if (m_subscribers[k].insert(listener).second)
+		m_subscriptions[listener].push_back(k);
+}
+
+void CCacheManager::unsubscribe(ICacheListener *listener)
+{
+	std::lock_guard<std::mutex> lock(m_listenMux);
+	auto it = m_subscriptions.find(listener);
+	if (m_subscriptions.end() == it)
+		return;
+	for (auto &k : it->second) {
+		auto its = m_subscribers.find(k);
+		its->second.erase(listener);
+		if (its->second.empty())
+			m_subscribers.erase(its);
+	}
+	m_subscriptions.erase(it);
+}
+
+void CCacheManager::dispatch()
+{
+	std::lock_guard<std::mutex> lock(m_listenMux);
+	uint64_t tail = m_eventTail.load(std::memory_order_relaxed);
+	const uint64_t head = m_eventHead.load(std::memory_order_acquire);
+	while (tail != head) {
+		const CEvent &event = m_events[tail & (EVENT_RING_SIZE - 1U)];
+		const std::string k(char('0' + event.type) + std::string(event.key));
+		m_eventTail.store(++tail, std::memory_order_release);
+		auto it = m_subscribers.find(k);
+		if (m_subscribers.end() != it) {
+			for (auto listener : it->second)
+				listener->cacheChanged(CACHE_EVENT(k[0] - '0'), k.substr(1));
+		}
+	}
+
+	// checked after the ring is empty, so an event lost after this is caught next time
+	if (m_overflow.exchange(false)) {
+		for (auto &s : m_subscriptions)
+			s.first->cacheChanged(CE_ALL, std::string());
+	}
+}
+
+bool CCacheManager::isRecorded()
+{
+	return CCapture::isOpen() || CReplication::isSending();
+}
+
+void CCacheManager::record(CAPTURE_TYPE type, const std::vector<std::string> &fields)
+{
+	if (CCapture::isOpen())
+		CCapture::cache(type, this, fields);
+	if (CReplication::isSending())
+		CReplication::cache(type, this, fields);
+}
+
+// these last five functions are private and not mux locked.
+void CCacheManager::set(std::unordered_map<std::string, std::string> &map, const std::string &key, const std::string &value, CACHE_EVENT type)
+{
+	auto it = map.find(key);
+	if (map.end() == it) {
+		map[key] = value;
+		publish(type, key);
+	} else if (it->second.compare(value)) {
+		it->second.assign(value);
+		publish(type, key);
+	}
+}
+
+void CCacheManager::publish(CACHE_EVENT type, const std::string &key)
+{
+	const uint64_t head = m_eventHead.load(std::memory_order_relaxed);
+	if (head - m_eventTail.load(std::memory_order_acquire) >= EVENT_RING_SIZE || key.size() >= sizeof(CEvent::key)) {
+		m_overflow = true;
+		m_overflows.add();
+		return;
+	}
+	CEvent &event = m_events[head & (EVENT_RING_SIZE - 1U)];
+	event.type = type;
+	strncpy(event.key, key.c_str(), sizeof(event.key) - 1U);
+	event.key[sizeof(event.key) - 1U] = '\0';
+	m_eventHead.store(head + 1U, std::memory_order_release);
+	m_published.add();
+}
+
 std::string CCacheManager::findUserRptr(const std::string &user)
 {
 	std::string rptr;
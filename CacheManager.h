@@ -18,14 +18,41 @@
 
 #pragma once
 
+#include <cstdint>
+#include <ostream>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <set>
+#include <vector>
 #include <unordered_map>
 
+#include "Metrics.h"
+#include "Capture.h"
+
+enum CACHE_EVENT {
+	CE_USER,		// a user's repeater changed
+	CE_REPEATER,	// a repeater's gateway changed
+	CE_GATEWAY,		// a gateway's address changed
+	CE_ALL			// changes were lost, assume anything could have changed
+};
+
+class ICacheListener {
+public:
+	virtual ~ICacheListener() {}
+
+	// called by CCacheManager::dispatch() on the routing thread, which mustn't be subscribed to or
+	// unsubscribed from here, so a listener that is owned by a worker has to be thread safe
+	virtual void cacheChanged(CACHE_EVENT type, const std::string &key) = 0;
+};
+
 class CCacheManager {
 public:
-	CCacheManager() {}
-	~CCacheManager() {}
+	CCacheManager() : m_eventHead(0U), m_eventTail(0U), m_overflow(false) {}
+	~CCacheManager() { CMetrics::remove(this); }
+
+	// adds the hit/miss counters and the table sizes to the metrics registry
+	void registerMetrics(const std::string &labels);
 
 	// the bodies of these public functions are mux locked to access the maps and the private functions.
 	// for these find functions, if a map value can't be found the returned string will be empty.
@@ -46,11 +73,33 @@ public:
 	void updateGate(const std::string &gate, const std::string &addr);
 	void updateName(const std::string &name, const std::string &nick);
 
+	// for an upgrade, writes every entry as a line of tag, table, key and value, separated by tabs
+	void save(std::ostream &out, const std::string &tag);
+	// puts back an entry that save() wrote, without telling the listeners, returns true if the table is unknown
+	bool restore(const std::string &table, const std::string &key, const std::string &value);
+	// makes the update that a capture or replication record describes
+	void replay(CAPTURE_TYPE type, std::vector<std::string> fields);
+
+	// The updates come from the ircDDB thread. Each one that changes where a
+	// user is routed to is put on a lock-free ring, and dispatch(), on the
+	// routing thread, tells the listeners that subscribed to its key. The
+	// groups subscribe on their workers, so these three are locked with
+	// m_listenMux, which is never held while mux is waited for.
+	void subscribe(CACHE_EVENT type, const std::string &key, ICacheListener *listener);
+	void unsubscribe(ICacheListener *listener);
+	void dispatch();
+
 private:
 	// these three functions aren't mux locked, that's why they're private
 	std::string findUserRptr(const std::string &user);
 	std::string findRptrGate(const std::string &rptr);
 	std::string findGateAddr(const std::string &gate);
+	// each update is captured, and sent to a standby, as it is made
+	static bool isRecorded();
+	void record(CAPTURE_TYPE type, const std::vector<std::string> &fields);
+	void countLookup(const std::string &addr) { (addr.empty() ? m_misses : m_hits).add(); }
+	void set(std::unordered_map<std::string, std::string> &map, const std::string &key, const std::string &value, CACHE_EVENT type);
+	void publish(CACHE_EVENT type, const std::string &key);
 
 	std::unordered_map<std::string, std::string> UserTime;
 	std::unordered_map<std::string, std::string> UserRptr;
@@ -58,4 +107,21 @@ private:
 	std::unordered_map<std::string, std::string> GateAddr;
 	std::unordered_map<std::string, std::string> NameNick;
 	std::mutex mux;
+	CMetric m_hits, m_misses;
+
+	// the ring has one producer at a time, because publish() is only called with mux locked
+	static const unsigned int EVENT_RING_SIZE = 4096U;	// a power of two
+	class CEvent {
+	public:
+		uint8_t type;
+		char key[16];
+	};
+	CEvent m_events[EVENT_RING_SIZE];
+	std::atomic<uint64_t> m_eventHead;
+	std::atomic<uint64_t> m_eventTail;
+	std::atomic<bool> m_overflow;
+	std::unordered_map<std::string, std::set<ICacheListener *>> m_subscribers;	// by the type and then the key
+	std::unordered_map<ICacheListener *, std::vector<std::string>> m_subscriptions;
+	std::mutex m_listenMux;		// for the subscriptions
+	CMetric m_published, m_overflows;
 };
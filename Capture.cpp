@@ -0,0 +1,296 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstring>
+#include <chrono>
+
+#include "Capture.h"
+#include "CacheManager.h"
+
+#define CAPTURE_MAGIC "SGSCAP1"
+#define HEADER_SIZE 16
+#define REPLAY_DRAIN_MS 2000	// virtual time allowed after the last record for the sockets to catch up
+
+static std::chrono::steady_clock::time_point captureStart;
+
+std::atomic<bool> CCapture::m_open(false);
+std::mutex        CCapture::m_mutex;
+FILE             *CCapture::m_file = NULL;
+CCacheManager    *CCapture::m_caches[2] = { NULL, NULL };
+
+FILE    *CReplay::m_file = NULL;
+int      CReplay::m_family[2] = { AF_UNSPEC, AF_UNSPEC };
+uint64_t CReplay::m_time = 0U;
+time_t CReplay::m_start = 0;
+bool     CReplay::m_pending = false;
+CReplay::CPacket CReplay::m_next;
+std::map<int, std::deque<unsigned short>> CReplay::m_ports;
+std::map<std::pair<int, unsigned short>, std::deque<CReplay::CPacket>> CReplay::m_queues;
+unsigned long CReplay::m_records = 0UL, CReplay::m_packets = 0UL, CReplay::m_updates = 0UL;
+
+bool CCapture::open(const std::string &path, int family0, int family1)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_file = fopen(path.c_str(), "wb");
+	if (NULL == m_file) {
+		fprintf(stderr, "Unable to open capture file %s: %s\n", path.c_str(), strerror(errno));
+		return true;
+	}
+	setvbuf(m_file, NULL, _IOFBF, 1 << 16);
+
+	unsigned char header[HEADER_SIZE];
+	memset(header, 0, HEADER_SIZE);
+	memcpy(header, CAPTURE_MAGIC, 8);
+	header[8] = (unsigned char)family0;
+	header[9] = (unsigned char)family1;
+	fwrite(header, HEADER_SIZE, 1, m_file);
+
+	captureStart = std::chrono::steady_clock::now();
+	m_open = true;
+	printf("Capturing traffic to %s\n", path.c_str());
+	return false;
+}
+
+void CCapture::close()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_file) {
+		m_open = false;
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+void CCapture::setCache(unsigned int i, CCacheManager *cache)
+{
+	if (i < 2)
+		m_caches[i] = cache;
+}
+
+CCacheManager *CCapture::getCache(unsigned int i)
+{
+	return (i < 2) ? m_caches[i] : NULL;
+}
+
+void CCapture::socket(int family, unsigned short asked, unsigned short port)
+{
+	CCaptureRecord record;
+	memset(&record, 0, sizeof(CCaptureRecord));
+	record.type = CT_OPEN;
+	record.family = (uint8_t)family;
+	record.local = asked;
+	record.port = port;
+	write(record, NULL);
+}
+
+void CCapture::packet(CAPTURE_TYPE type, unsigned short local, const CSockAddress &addr, const unsigned char *data, unsigned int length)
+{
+	CCaptureRecord record;
+	memset(&record, 0, sizeof(CCaptureRecord));
+	record.type = type;
+	record.family = (uint8_t)addr.GetFamily();
+	record.local = local;
+	record.port = addr.GetPort();
+	record.length = (uint16_t)length;
+	if (AF_INET == addr.GetFamily())
+		memcpy(record.addr, &((const struct sockaddr_in *)addr.GetCPointer())->sin_addr, 4);
+	else
+		memcpy(record.addr, &((const struct sockaddr_in6 *)addr.GetCPointer())->sin6_addr, 16);
+	write(record, data);
+}
+
+void CCapture::cache(CAPTURE_TYPE type, const CCacheManager *cache, const std::vector<std::string> &fields)
+{
+	std::string data;
+	for (auto it=fields.begin(); it!=fields.end(); it++) {
+		data.append(*it);
+		data.push_back('\0');
+	}
+
+	CCaptureRecord record;
+	memset(&record, 0, sizeof(CCaptureRecord));
+	record.type = type;
+	record.family = (cache == m_caches[1]) ? 1 : 0;
+	record.length = (uint16_t)data.size();
+	write(record, data.data());
+}
+
+void CCapture::write(CCaptureRecord &record, const void *data)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (NULL == m_file)
+		return;
+
+	if (CReplay::isActive())
+		record.ns = CReplay::getTime();
+	else
+		record.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - captureStart).count();
+	fwrite(&record, sizeof(CCaptureRecord), 1, m_file);
+	if (record.length)
+		fwrite(data, record.length, 1, m_file);
+}
+
+bool CReplay::open(const std::string &path)
+{
+	m_file = fopen(path.c_str(), "rb");
+	if (NULL == m_file) {
+		fprintf(stderr, "Unable to open replay file %s: %s\n", path.c_str(), strerror(errno));
+		return true;
+	}
+
+	unsigned char header[HEADER_SIZE];
+	if (1 != fread(header, HEADER_SIZE, 1, m_file) || memcmp(header, CAPTURE_MAGIC, 8)) {
+		fprintf(stderr, "%s is not a capture file\n", path.c_str());
+		close();
+		return true;
+	}
+	m_family[0] = header[8];
+	m_family[1] = header[9];
+
+	// the ports the sockets were given have to be known before they're opened
+	CCaptureRecord record;
+	while (1 == fread(&record, sizeof(CCaptureRecord), 1, m_file)) {
+		if (CT_OPEN == record.type && 0U == record.local)
+			m_ports[record.family].push_back(record.port);
+		if (record.length)
+			fseek(m_file, record.length, SEEK_CUR);
+	}
+	fseek(m_file, HEADER_SIZE, SEEK_SET);
+
+	m_time = 0U;
+	m_start = time(NULL);
+	m_pending = next();
+	printf("Replaying %s\n", path.c_str());
+	return false;
+}
+
+void CReplay::close()
+{
+	if (m_file) {
+		fclose(m_file);
+		m_file = NULL;
+	}
+	m_queues.clear();
+	m_ports.clear();
+}
+
+int CReplay::getFamily(unsigned int i)
+{
+	return (i < 2) ? m_family[i] : AF_UNSPEC;
+}
+
+unsigned short CReplay::assignPort(int family)
+{
+	static unsigned short spare = 50000U;
+	auto &ports = m_ports[family];
+	if (ports.empty())
+		return spare++;
+	unsigned short port = ports.front();
+	ports.pop_front();
+	return port;
+}
+
+bool CReplay::next()
+{
+	if (1 != fread(&m_next.record, sizeof(CCaptureRecord), 1, m_file))
+		return false;
+	m_next.data.resize(m_next.record.length);
+	if (m_next.record.length && 1 != fread(m_next.data.data(), m_next.record.length, 1, m_file)) {
+		fprintf(stderr, "The capture file is truncated\n");
+		return false;
+	}
+	m_records++;
+	return true;
+}
+
+bool CReplay::advance(unsigned int ms)
+{
+	static uint64_t end = 0U;
+	m_time += 1000000ULL * ms;
+
+	while (m_pending && m_next.record.ns <= m_time) {
+		if (CT_UDP_RX == m_next.record.type)
+			m_queues[std::make_pair(int(m_next.record.family), m_next.record.local)].push_back(m_next);
+		else if (m_next.record.type >= CT_CACHE_USER)
+			apply(m_next);
+		m_pending = next();
+		if (! m_pending)
+			end = m_time + 1000000ULL * REPLAY_DRAIN_MS;
+	}
+
+	if (m_pending)
+		return true;
+	// sockets that were captured but aren't open in the replay would never be drained
+	for (auto it=m_queues.begin(); it!=m_queues.end(); it++) {
+		if (! it->second.empty())
+			return m_time < end;
+	}
+	return false;
+}
+
+int CReplay::read(int family, unsigned short port, unsigned char *buffer, unsigned int length, CSockAddress &addr)
+{
+	auto it = m_queues.find(std::make_pair(family, port));
+	if (m_queues.end() == it || it->second.empty())
+		return 0;
+
+	const CPacket &packet = it->second.front();
+	unsigned int len = (packet.record.length < length) ? packet.record.length : length;
+	memcpy(buffer, packet.data.data(), len);
+
+	struct sockaddr *sa = addr.GetPointer();
+	memset(sa, 0, sizeof(struct sockaddr_storage));
+	if (AF_INET == packet.record.family) {
+		auto addr4 = (struct sockaddr_in *)sa;
+		addr4->sin_family = AF_INET;
+		addr4->sin_port = htons(packet.record.port);
+		memcpy(&addr4->sin_addr, packet.record.addr, 4);
+	} else {
+		auto addr6 = (struct sockaddr_in6 *)sa;
+		addr6->sin6_family = AF_INET6;
+		addr6->sin6_port = htons(packet.record.port);
+		memcpy(&addr6->sin6_addr, packet.record.addr, 16);
+	}
+
+	it->second.pop_front();
+	m_packets++;
+	return len;
+}
+
+void CReplay::apply(const CPacket &packet)
+{
+	CCacheManager *cache = CCapture::getCache(packet.record.family);
+	if (NULL == cache)
+		return;
+
+	std::vector<std::string> f;
+	const char *p = (const char *)packet.data.data();
+	const char *end = p + packet.data.size();
+	while (p < end) {
+		f.push_back(std::string(p));
+		p += f.back().size() + 1;
+	}
+
+	cache->replay(CAPTURE_TYPE(packet.record.type), f);
+	m_updates++;
+}
+
+void CReplay::report()
+{
+	printf("Replayed %lu records over %.3f seconds of virtual time: %lu datagrams read, %lu cache updates\n", m_records, m_time / 1.0e9, m_packets, m_updates);
+}
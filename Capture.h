@@ -0,0 +1,137 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include "SockAddress.h"
+
+class CCacheManager;
+
+// A capture file starts with "SGSCAP1" and a NUL, the address family of each
+// G2 socket as a byte, and six bytes of padding. Then come the records, each
+// one a CCaptureRecord followed by length bytes of data, in host byte order.
+enum CAPTURE_TYPE {
+	CT_OPEN = 1,		// a socket was opened: port is the local port, local is the port that was asked for
+	CT_UDP_RX,			// a datagram was read
+	CT_UDP_TX,			// a datagram was sent
+	CT_CACHE_USER,		// the data is the NUL separated arguments of the cache update
+	CT_CACHE_RPTR,
+	CT_CACHE_GATE,
+	CT_CACHE_NAME,
+	CT_CACHE_ERASE_GATE,
+	CT_CACHE_ERASE_NAME,
+	CT_CACHE_CLEAR_GATE
+};
+
+class CCaptureRecord {
+public:
+	uint64_t ns;		// since the capture started
+	uint8_t  type;		// a CAPTURE_TYPE
+	uint8_t  family;	// of the peer, or for a cache record, which ircDDB cache
+	uint16_t local;		// the local port
+	uint16_t port;		// the peer port
+	uint16_t length;	// of the data that follows
+	uint8_t  addr[16];	// the peer address
+};
+
+// Records the traffic in and out of every UDP socket, and the updates to the
+// ircDDB caches, to a file. Writing takes a lock, so it's only for when
+// traffic is being recorded for the replay.
+class CCapture {
+public:
+	// returns true on error
+	static bool open(const std::string &path, int family0, int family1);
+	static void close();
+	static bool isOpen() { return m_open; }
+
+	static void setCache(unsigned int i, CCacheManager *cache);
+	static CCacheManager *getCache(unsigned int i);
+
+	static void socket(int family, unsigned short asked, unsigned short port);
+	static void packet(CAPTURE_TYPE type, unsigned short local, const CSockAddress &addr, const unsigned char *data, unsigned int length);
+	static void cache(CAPTURE_TYPE type, const CCacheManager *cache, const std::vector<std::string> &fields);
+
+private:
+	static void write(CCaptureRecord &record, const void *data);
+
+	static std::atomic<bool> m_open;
+	static std::mutex m_mutex;
+	static FILE *m_file;
+	static CCacheManager *m_caches[2];
+};
+
+// Plays a capture file back into the routing thread. Nothing is sent or
+// bound: each socket reads the datagrams that were captured on its port and
+// the cache updates are made as they happened, all on a virtual clock that
+// is moved on one tick at a time, so a replay runs as fast as it can and
+// gives the same result every time. Anything on the routing path that needs
+// the time of day asks now(), which follows the virtual clock in a replay.
+class CReplay {
+public:
+	// returns true on error
+	static bool open(const std::string &path);
+	static void close();
+	static bool isActive() { return NULL != m_file; }
+
+	static int getFamily(unsigned int i);
+	static uint64_t getTime() { return m_time; }
+	// time(NULL), or in a replay the time it started plus the virtual time
+	static time_t now() { return m_file ? m_start + time_t(m_time / 1000000000ULL) : time(NULL); }
+
+	// the local port that a socket asking for port 0 was given when it was captured
+	static unsigned short assignPort(int family);
+
+	// moves the virtual clock on and makes everything up to then available,
+	// returns false when the capture is finished and everything has been read
+	static bool advance(unsigned int ms);
+
+	// like recvfrom, 0 when nothing is waiting for this socket
+	static int read(int family, unsigned short port, unsigned char *buffer, unsigned int length, CSockAddress &addr);
+
+	static void report();
+
+private:
+	class CPacket {
+	public:
+		CCaptureRecord record;
+		std::vector<unsigned char> data;
+	};
+
+	static bool next();
+	static void apply(const CPacket &packet);
+
+	static FILE *m_file;
+	static int m_family[2];
+	static uint64_t m_time;
+	static time_t m_start;
+	static bool m_pending;
+	static CPacket m_next;
+	static std::map<int, std::deque<unsigned short>> m_ports;
+	static std::map<std::pair<int, unsigned short>, std::deque<CPacket>> m_queues;
+	static unsigned long m_records, m_packets, m_updates;
+};
@@ -21,15 +21,17 @@
 
 #include "DCSHandler.h"
 #include "Utils.h"
+#include "Capture.h"
+#include "ObjectPool.h"
 
-CDCSProtocolHandlerPool *CDCSHandler::m_pool = NULL;
+thread_local CDCSProtocolHandlerPool *CDCSHandler::m_pool = NULL;
 CDCSProtocolHandler     *CDCSHandler::m_incoming = NULL;
 
 GATEWAY_TYPE             CDCSHandler::m_gatewayType  = GT_REPEATER;
 
 CCallsignList           *CDCSHandler::m_whiteList = NULL;
 CCallsignList           *CDCSHandler::m_blackList = NULL;
-std::list<CDCSHandler *> CDCSHandler::m_DCSHandlers;
+thread_local std::list<CDCSHandler *> CDCSHandler::m_DCSHandlers;
 
 
 CDCSHandler::CDCSHandler(CGroupHandler *handler, const std::string &dcsHandler, const std::string &repeater, CDCSProtocolHandler *protoHandler, const std::string &address, unsigned short port, DIRECTION direction) :
@@ -51,11 +53,8 @@ m_dcsId(0x00U),
 m_dcsSeq(0x00U),
 m_seqNo(0x00U),
 m_inactivityTimer(1000U, NETWORK_TIMEOUT),
-m_yourCall(),
-m_myCall1(),
-m_myCall2(),
-m_rptCall1(),
-m_rptCall2()
+m_rxHeader(),
+m_txHeader()
 {
 	assert(protoHandler != NULL);
 	assert(handler != NULL);
@@ -65,7 +64,7 @@ m_rptCall2()
 
 	m_pollInactivityTimer.start();
 
-	m_time = ::time(NULL);
+	m_time = CReplay::now();
 
 	if (direction == DIR_INCOMING) {
 		m_pollTimer.start();
@@ -74,11 +73,17 @@ m_rptCall2()
 		m_linkState = DCS_LINKING;
 		m_tryTimer.start();
 	}
+
+	const std::string labels(CMetrics::label("protocol", "dcs") + "," + CMetrics::label("reflector", m_reflector) + "," + CMetrics::label("direction", direction == DIR_OUTGOING ? "outgoing" : "incoming"));
+	CMetrics::add(this, "sgs_link_frames_in_total", labels, &m_framesIn);
+	CMetrics::add(this, "sgs_link_frames_out_total", labels, &m_framesOut);
 	// printf("New CDCSHandler ref=%s, rep=%s, yourAddr=%s, yourPort=%u, myPort=%u\n", m_reflector.c_str(), m_repeater.c_str(), m_yourAddress.c_str(), m_yourPort, m_myPort);
 }
 
 CDCSHandler::~CDCSHandler()
 {
+	CMetrics::remove(this);
+
 	if (m_direction == DIR_OUTGOING)
 		m_pool->release(m_handler);
 }
@@ -133,7 +138,7 @@ std::string CDCSHandler::getIncoming(const std::string &callsign)
 
 void CDCSHandler::process(CAMBEData &data)
 {
-	std::string yourAddress(data.getYourAddress());
+	const char *yourAddress = data.getYourAddress();
 	unsigned short yourPort = data.getYourPort();
 	unsigned short myPort   = data.getMyPort();
 
@@ -323,6 +328,18 @@ void CDCSHandler::unlink()
 	}
 }
 
+void CDCSHandler::detach(CGroupHandler *handler)
+{
+	for (auto it=m_DCSHandlers.begin(); it!=m_DCSHandlers.end(); ) {
+		CDCSHandler *dcsHandler = *it;
+		if (dcsHandler->m_destination == handler) {
+			delete dcsHandler;
+			it = m_DCSHandlers.erase(it);
+		} else
+			it++;
+	}
+}
+
 void CDCSHandler::writeHeader(CGroupHandler *handler, CHeaderData &header, DIRECTION direction)
 {
 	for (auto it=m_DCSHandlers.begin(); it!=m_DCSHandlers.end(); it++) {
@@ -354,6 +371,48 @@ void CDCSHandler::gatewayUpdate(const std::string &dcsHandler, const std::string
 	}
 }
 
+void CDCSHandler::receive()
+{
+	if (NULL == m_pool)
+		return;
+
+	while (true) {
+		DCS_TYPE type = m_pool->read();
+
+		switch (type) {
+			case DC_NONE:
+				return;
+
+			case DC_POLL: {
+					CPollData* poll = m_pool->readPoll();
+					if (poll != NULL) {
+						process(*poll);
+						CObjectPool<CPollData>::release(poll);
+					}
+				}
+				break;
+
+			case DC_CONNECT: {
+					CConnectData* connect = m_pool->readConnect();
+					if (connect != NULL) {
+						process(*connect);
+						CObjectPool<CConnectData>::release(connect);
+					}
+				}
+				break;
+
+			case DC_DATA: {
+					CAMBEData* data = m_pool->readData();
+					if (data != NULL) {
+						process(*data);
+						CObjectPool<CAMBEData>::release(data);
+					}
+				}
+				break;
+		}
+	}
+}
+
 void CDCSHandler::clock(unsigned int ms)
 {
 	for (auto it=m_DCSHandlers.begin(); it!=m_DCSHandlers.end(); ) {
@@ -378,121 +437,77 @@ void CDCSHandler::finalise()
 
 void CDCSHandler::processInt(CAMBEData &data)
 {
-	// Make a copy of the AMBE data so that any changes made here don't modify the original
-	CAMBEData temp(data);
-
-	unsigned int id = temp.getId();
-	CHeaderData& header = temp.getHeader();
-	unsigned int seqNo = temp.getSeq();
-
-	std::string   my = header.getMyCall1();
-	std::string rpt2 = header.getRptCall2();
-
-	if (m_whiteList != NULL) {
-		bool res = m_whiteList->isInList(my);
-		if (!res) {
-			printf("%s rejected from DCS as not found in the white list\n", my.c_str());
-			m_dcsId = 0x00U;
-			return;
-		}
-	}
-
-	if (m_blackList != NULL) {
-		bool res = m_blackList->isInList(my);
-		if (res) {
-			printf("%s rejected from DCS as found in the black list\n", my.c_str());
-			m_dcsId = 0x00U;
-			return;
-		}
-	}
-
 	if (m_linkState != DCS_LINKED)
 		return;
 
-	switch (m_direction) {
-		case DIR_OUTGOING:
-			if (m_reflector.compare(rpt2))
-				return;
-
-			if (m_dcsId == 0x00U && seqNo != 0U)
-				return;
-
-			if (m_dcsId == 0x00U) {		// && seqNo == 0U) {
-				m_dcsId  = id;
-				m_dcsSeq = 0x00U;
-				m_inactivityTimer.start();
+	unsigned int id = data.getId();
+	unsigned int seqNo = data.getSeq();
 
-				header.setCQCQCQ();
-				header.setFlags(0x00U, 0x00U, 0x00U);
-
-				m_destination->process(header, m_direction, AS_DCS);
-			}
-
-			if (id == m_dcsId) {
-				m_pollInactivityTimer.start();
-				m_inactivityTimer.start();
-
-				m_dcsSeq = seqNo;
-
-				if (m_dcsSeq == 0U) {
-					// Send the header every 21 frames
-					header.setCQCQCQ();
-					header.setFlags(0x00U, 0x00U, 0x00U);
+	if (m_dcsId == 0x00U && seqNo != 0U)
+		return;
 
-					m_destination->process(header, m_direction, AS_DUP);
-				}
+	if (m_dcsId != 0x00U && id != m_dcsId)
+		return;
 
-				m_destination->process(temp, m_direction, AS_DCS);
+	// The header is repeated in every frame, but it only has to be decoded
+	// when a stream could start and when it is passed on every 21 frames
+	if (seqNo == 0U) {
+		if (! m_handler->readHeader(m_rxHeader))
+			return;
 
-				if (temp.isEnd()) {
-					m_dcsId  = 0x00U;
-					m_dcsSeq = 0x00U;
-					m_inactivityTimer.stop();
-				}
-			}
-			break;
+		std::string   my = m_rxHeader.getMyCall1();
+		std::string rpt2 = m_rxHeader.getRptCall2();
 
-		case DIR_INCOMING:
-			if (m_repeater.compare(rpt2))
+		if (m_whiteList != NULL) {
+			bool res = m_whiteList->isInList(my);
+			if (!res) {
+				printf("%s rejected from DCS as not found in the white list\n", my.c_str());
+				m_dcsId = 0x00U;
 				return;
+			}
+		}
 
-			if (m_dcsId == 0x00U && seqNo != 0U)
+		if (m_blackList != NULL) {
+			bool res = m_blackList->isInList(my);
+			if (res) {
+				printf("%s rejected from DCS as found in the black list\n", my.c_str());
+				m_dcsId = 0x00U;
 				return;
+			}
+		}
 
-			if (m_dcsId == 0x00U) {		// && seqNo == 0U) {
-				m_dcsId  = id;
-				m_dcsSeq = 0x00U;
-				m_inactivityTimer.start();
+		if ((m_direction == DIR_OUTGOING ? m_reflector : m_repeater).compare(rpt2))
+			return;
 
-				header.setCQCQCQ();
-				header.setFlags(0x00U, 0x00U, 0x00U);
+		m_rxHeader.setCQCQCQ();
+		m_rxHeader.setFlags(0x00U, 0x00U, 0x00U);
+	}
 
-				m_destination->process(header, m_direction, AS_DCS);
-			}
+	if (m_dcsId == 0x00U) {		// && seqNo == 0U) {
+		m_dcsId  = id;
+		m_dcsSeq = 0x00U;
+		m_inactivityTimer.start();
 
-			if (id == m_dcsId) {
-				m_pollInactivityTimer.start();
-				m_inactivityTimer.start();
+		m_destination->process(m_rxHeader, m_direction, AS_DCS);
+	}
 
-				m_dcsSeq = seqNo;
+	m_pollInactivityTimer.start();
+	m_inactivityTimer.start();
 
-				if (m_dcsSeq == 0U) {
-					// Send the header every 21 frames
-					header.setCQCQCQ();
-					header.setFlags(0x00U, 0x00U, 0x00U);
+	m_dcsSeq = seqNo;
+	m_framesIn.add();
 
-					m_destination->process(header, m_direction, AS_DUP);
-				}
+	if (m_dcsSeq == 0U) {
+		// Send the header every 21 frames
+		m_destination->process(m_rxHeader, m_direction, AS_DUP);
+	}
 
-				m_destination->process(temp, m_direction, AS_DCS);
+	m_destination->process(data, m_direction, AS_DCS);
 
-				if (temp.isEnd()) {
-					m_dcsId  = 0x00U;
-					m_dcsSeq = 0x00U;
-					m_inactivityTimer.stop();
-				}
-			}
-			break;
+	if (data.isEnd()) {
+		m_dcsId  = 0x00U;
+		m_dcsSeq = 0x00U;
+		m_inactivityTimer.stop();
 	}
 }
 
@@ -659,13 +674,13 @@ void CDCSHandler::writeHeaderInt(CGroupHandler *handler, CHeaderData& header, DI
 	if (m_dcsId != 0x00)
 		return;
 
-	m_seqNo    = 0U;
+	m_seqNo = 0U;
 
-	m_myCall1  = header.getMyCall1();
-	m_myCall2  = header.getMyCall2();
-	m_yourCall = header.getYourCall();
-	m_rptCall1 = header.getRptCall1();
-	m_rptCall2 = header.getRptCall2();
+	m_txHeader.setMyCall1(header.getMyCall1());
+	m_txHeader.setMyCall2(header.getMyCall2());
+	m_txHeader.setRptCall1(header.getRptCall1());
+	m_txHeader.setRptCall2(header.getRptCall2());
+	m_txHeader.setCQCQCQ();
 }
 
 void CDCSHandler::writeAMBEInt(CGroupHandler *handler, CAMBEData &data, DIRECTION direction)
@@ -684,16 +699,10 @@ void CDCSHandler::writeAMBEInt(CGroupHandler *handler, CAMBEData &data, DIRECTIO
 	if (m_dcsId != 0x00)
 		return;
 
-	CHeaderData& header = data.getHeader();
-	header.setMyCall1(m_myCall1);
-	header.setMyCall2(m_myCall2);
-	header.setRptCall1(m_rptCall1);
-	header.setRptCall2(m_rptCall2);
-	header.setCQCQCQ();
-
 	data.setRptSeq(m_seqNo++);
 	data.setDestination(m_yourAddress, m_yourPort);
-	m_handler->writeData(data);
+	m_handler->writeData(m_txHeader, data);
+	m_framesOut.add();
 }
 
 unsigned int CDCSHandler::calcBackoff()
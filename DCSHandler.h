@@ -29,9 +29,11 @@
 #include "DStarDefines.h"
 #include "CallsignList.h"
 #include "ConnectData.h"
+#include "HeaderData.h"
 #include "AMBEData.h"
 #include "PollData.h"
 #include "Timer.h"
+#include "Metrics.h"
 #include "Defs.h"
 
 enum DCS_STATE {
@@ -50,6 +52,8 @@ public:
 	static void unlink(CGroupHandler *handler, const std::string &reflector = std::string(""), bool exclude = true);
 	static void unlink(CDCSHandler *reflector);
 	static void unlink();
+	// deletes every link to handler, linked or unlinking, before the group is deleted
+	static void detach(CGroupHandler *handler);
 
 	static void writeHeader(CGroupHandler *handler, CHeaderData &header, DIRECTION direction);
 	static void writeAMBE(CGroupHandler *handler, CAMBEData &data, DIRECTION direction);
@@ -59,6 +63,8 @@ public:
 	static void process(CConnectData &connect);
 
 	static void gatewayUpdate(const std::string &reflector, const std::string &address);
+	// reads what came in on the pool's ports, on the thread that owns them
+	static void receive();
 	static void clock(unsigned int ms);
 
 	static void setWhiteList(CCallsignList *list);
@@ -81,9 +87,10 @@ protected:
 	bool clockInt(unsigned int ms);
 
 private:
-	static std::list<CDCSHandler *> m_DCSHandlers;
+	// each worker has its own links, and its own pool of ports for them
+	static thread_local std::list<CDCSHandler *> m_DCSHandlers;
+	static thread_local CDCSProtocolHandlerPool *m_pool;
 
-	static CDCSProtocolHandlerPool *m_pool;
 	static CDCSProtocolHandler     *m_incoming;
 
 	static GATEWAY_TYPE             m_gatewayType;
@@ -110,12 +117,11 @@ private:
 	unsigned int         m_seqNo;
 	CTimer               m_inactivityTimer;
 
-	// Header data
-	std::string m_yourCall;
-	std::string m_myCall1;
-	std::string m_myCall2;
-	std::string m_rptCall1;
-	std::string m_rptCall2;
+	// Stream headers, DCS repeats these in every frame
+	CHeaderData          m_rxHeader;
+	CHeaderData          m_txHeader;
+	CMetric              m_framesIn;
+	CMetric              m_framesOut;
 
 	unsigned int calcBackoff();
 };
@@ -19,6 +19,7 @@
 
 #include "DCSProtocolHandler.h"
 #include "Utils.h"
+#include "ObjectPool.h"
 
 // #define	DUMP_TX
 
@@ -51,16 +52,17 @@ unsigned short CDCSProtocolHandler::getPort() const
 	return m_socket.getPort();
 }
 
-bool CDCSProtocolHandler::writeData(const CAMBEData& data)
+bool CDCSProtocolHandler::writeData(const CHeaderData &header, const CAMBEData& data)
 {
 	unsigned char buffer[100U];
 	unsigned int length = data.getDCSData(buffer, 100U);
+	header.getDCSData(buffer, 100U);
 
 #if defined(DUMP_TX)
 	dump("Sending Data", buffer, length);
 #endif
 	CSockAddress addr;
-	addr.Initialize(m_family, data.getYourPort(), data.getYourAddress().c_str());
+	addr.Initialize(m_family, data.getYourPort(), data.getYourAddress());
 	return m_socket.Write(buffer, length, addr);
 }
 
@@ -154,27 +156,41 @@ CAMBEData* CDCSProtocolHandler::readData()
 	if (m_type != DC_DATA)
 		return NULL;
 
-	CAMBEData* data = new CAMBEData;
+	CAMBEData* data = CObjectPool<CAMBEData>::acquire();
 
 	bool res = data->setDCSData(m_buffer, m_length, m_yourAddress, m_yourPort, m_socket.getPort());
 	if (!res) {
-		delete data;
+		CObjectPool<CAMBEData>::release(data);
 		return NULL;
 	}
 
+	data->setRxTime(m_socket.getRxTime());
+
 	return data;
 }
 
+// The header embedded in the last data frame read. It is only decoded when
+// the link needs it, at the start of a stream and when it is repeated.
+bool CDCSProtocolHandler::readHeader(CHeaderData &header) const
+{
+	if (m_type != DC_DATA)
+		return false;
+
+	header.setDCSData(m_buffer, m_length, m_yourAddress, m_yourPort, m_socket.getPort());
+
+	return true;
+}
+
 CPollData* CDCSProtocolHandler::readPoll()
 {
 	if (m_type != DC_POLL)
 		return NULL;
 
-	CPollData* poll = new CPollData;
+	CPollData* poll = CObjectPool<CPollData>::acquire();
 
 	bool res = poll->setDCSData(m_buffer, m_length, m_yourAddress, m_yourPort, m_socket.getPort());
 	if (!res) {
-		delete poll;
+		CObjectPool<CPollData>::release(poll);
 		return NULL;
 	}
 
@@ -186,11 +202,11 @@ CConnectData* CDCSProtocolHandler::readConnect()
 	if (m_type != DC_CONNECT)
 		return NULL;
 
-	CConnectData* connect = new CConnectData;
+	CConnectData* connect = CObjectPool<CConnectData>::acquire();
 
 	bool res = connect->setDCSData(m_buffer, m_length, m_yourAddress, m_yourPort, m_socket.getPort());
 	if (!res) {
-		delete connect;
+		CObjectPool<CConnectData>::release(connect);
 		return NULL;
 	}
 
@@ -25,6 +25,7 @@
 #include "UDPReaderWriter.h"
 #include "DStarDefines.h"
 #include "ConnectData.h"
+#include "HeaderData.h"
 #include "AMBEData.h"
 #include "PollData.h"
 
@@ -44,12 +45,13 @@ public:
 
 	unsigned short getPort() const;
 
-	bool writeData(const CAMBEData &data);
+	bool writeData(const CHeaderData &header, const CAMBEData &data);
 	bool writeConnect(const CConnectData &connect);
 	bool writePoll(const CPollData &poll);
 
 	DCS_TYPE      read();
 	CAMBEData    *readData();
+	bool          readHeader(CHeaderData &header) const;
 	CPollData    *readPoll();
 	CConnectData *readConnect();
 
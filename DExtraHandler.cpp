@@ -21,11 +21,13 @@
 
 #include "DExtraHandler.h"
 #include "Utils.h"
+#include "Capture.h"
+#include "ObjectPool.h"
 
-std::list<CDExtraHandler *> CDExtraHandler::m_DExtraHandlers;
+thread_local std::list<CDExtraHandler *> CDExtraHandler::m_DExtraHandlers;
+thread_local CDExtraProtocolHandlerPool *CDExtraHandler::m_pool = NULL;
 
 std::string                 CDExtraHandler::m_callsign;
-CDExtraProtocolHandlerPool *CDExtraHandler::m_pool = NULL;
 
 CCallsignList              *CDExtraHandler::m_whiteList = NULL;
 CCallsignList              *CDExtraHandler::m_blackList = NULL;
@@ -56,7 +58,7 @@ m_header(NULL)
 
 	m_pollInactivityTimer.start();
 
-	m_time = ::time(NULL);
+	m_time = CReplay::now();
 
 	if (direction == DIR_INCOMING) {
 		m_pollTimer.start();
@@ -65,10 +67,16 @@ m_header(NULL)
 		m_linkState = DEXTRA_LINKING;
 		m_tryTimer.start();
 	}
+
+	const std::string labels(CMetrics::label("protocol", "dextra") + "," + CMetrics::label("reflector", m_reflector) + "," + CMetrics::label("direction", direction == DIR_OUTGOING ? "outgoing" : "incoming"));
+	CMetrics::add(this, "sgs_link_frames_in_total", labels, &m_framesIn);
+	CMetrics::add(this, "sgs_link_frames_out_total", labels, &m_framesOut);
 }
 
 CDExtraHandler::~CDExtraHandler()
 {
+	CMetrics::remove(this);
+
 	if (m_direction == DIR_OUTGOING)
 		m_pool->release(m_handler);
 
@@ -148,12 +156,12 @@ void CDExtraHandler::process(CHeaderData &header)
 
 void CDExtraHandler::process(CAMBEData &data)
 {
-	std::string yourAddress = data.getYourAddress();
+	const char *yourAddress = data.getYourAddress();
 	unsigned short yourPort = data.getYourPort();
 
 	for (auto it=m_DExtraHandlers.begin(); it!=m_DExtraHandlers.end(); it++) {
 		CDExtraHandler *dextraHandler = *it;
-		if (yourAddress==dextraHandler->m_yourAddress && yourPort==dextraHandler->m_yourPort)
+		if (dextraHandler->m_yourAddress==yourAddress && yourPort==dextraHandler->m_yourPort)
 			dextraHandler->processInt(data);
 	}
 }
@@ -296,6 +304,18 @@ void CDExtraHandler::unlink()
 	}
 }
 
+void CDExtraHandler::detach(CGroupHandler *handler)
+{
+	for (auto it=m_DExtraHandlers.begin(); it!=m_DExtraHandlers.end(); ) {
+		CDExtraHandler *dextraHandler = *it;
+		if (dextraHandler->m_destination == handler) {
+			delete dextraHandler;
+			it = m_DExtraHandlers.erase(it);
+		} else
+			it++;
+	}
+}
+
 void CDExtraHandler::writeHeader(CGroupHandler *handler, CHeaderData &header, DIRECTION direction)
 {
 	for (auto it=m_DExtraHandlers.begin(); it!=m_DExtraHandlers.end(); it++) {
@@ -327,6 +347,58 @@ void CDExtraHandler::gatewayUpdate(const std::string &dextraHandler, const std::
 	}
 }
 
+void CDExtraHandler::receive()
+{
+	if (NULL == m_pool)
+		return;
+
+	while (true) {
+		DEXTRA_TYPE type = m_pool->read();
+
+		switch (type) {
+			case DE_NONE:
+				return;
+
+			case DE_POLL: {
+					CPollData* poll = m_pool->newPoll();
+					if (poll != NULL) {
+						process(*poll);
+						CObjectPool<CPollData>::release(poll);
+					}
+				}
+				break;
+
+			case DE_CONNECT: {
+					CConnectData* connect = m_pool->newConnect();
+					if (connect != NULL) {
+						process(*connect);
+						CObjectPool<CConnectData>::release(connect);
+					}
+				}
+				break;
+
+			case DE_HEADER: {
+					CHeaderData* header = m_pool->newHeader();
+					if (header != NULL) {
+						// printf("DExtra header - My: %s/%s  Your: %s  Rpt1: %s  Rpt2: %s\n", header->getMyCall1().c_str(), header->getMyCall2().c_str(), header->getYourCall().c_str(), header->getRptCall1().c_str(), header->getRptCall2().c_str());
+						process(*header);
+						CObjectPool<CHeaderData>::release(header);
+					}
+				}
+				break;
+
+			case DE_AMBE: {
+					CAMBEData* data = m_pool->newAMBE();
+					if (data != NULL) {
+						process(*data);
+						CObjectPool<CAMBEData>::release(data);
+					}
+				}
+				break;
+		}
+	}
+}
+
 void CDExtraHandler::clock(unsigned int ms)
 {
 	for (auto it=m_DExtraHandlers.begin(); it!=m_DExtraHandlers.end(); ) {
@@ -439,6 +511,7 @@ void CDExtraHandler::processInt(CAMBEData &data)
 	m_inactivityTimer.start();
 
 	m_dExtraSeq = data.getSeq();
+	m_framesIn.add();
 
 	// Send the header every 21 frames, if we have it
 	if (m_dExtraSeq == 0U && m_header != NULL)
@@ -652,6 +725,7 @@ void CDExtraHandler::writeAMBEInt(CGroupHandler *handler, CAMBEData &data, DIREC
 			if (m_destination == handler) {
 				data.setDestination(m_yourAddress, m_yourPort);
 				m_handler->writeAMBE(data);
+				m_framesOut.add();
 			}
 			break;
 
@@ -659,6 +733,7 @@ void CDExtraHandler::writeAMBEInt(CGroupHandler *handler, CAMBEData &data, DIREC
 			if (0==m_repeater.size() || m_destination == handler) {
 				data.setDestination(m_yourAddress, m_yourPort);
 				m_handler->writeAMBE(data);
+				m_framesOut.add();
 			}
 			break;
 	}
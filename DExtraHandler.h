@@ -32,6 +32,7 @@
 #include "AMBEData.h"
 #include "PollData.h"
 #include "Timer.h"
+#include "Metrics.h"
 #include "Defs.h"
 
 enum DEXTRA_STATE {
@@ -49,6 +50,8 @@ public:
 	static void unlink(CGroupHandler *handler, const std::string &reflector = std::string(""), bool exclude = true);
 	static void unlink(CDExtraHandler *reflector);
 	static void unlink();
+	// deletes every link to handler, linked or unlinking, before the group is deleted
+	static void detach(CGroupHandler *handler);
 
 	static void writeHeader(CGroupHandler *handler, CHeaderData &header, DIRECTION direction);
 	static void writeAMBE(CGroupHandler *handler, CAMBEData &data, DIRECTION direction);
@@ -59,6 +62,8 @@ public:
 	static void process(CConnectData &connect);
 
 	static void gatewayUpdate(const std::string &reflector, const std::string &address);
+	// reads what came in on the pool's ports, on the thread that owns them
+	static void receive();
 	static void clock(unsigned int ms);
 
 	static void setWhiteList(CCallsignList *list);
@@ -83,10 +88,11 @@ protected:
 	bool clockInt(unsigned int ms);
 
 private:
-	static std::list<CDExtraHandler *> m_DExtraHandlers;
+	// each worker has its own links, and its own pool of ports for them
+	static thread_local std::list<CDExtraHandler *> m_DExtraHandlers;
+	static thread_local CDExtraProtocolHandlerPool *m_pool;
 
 	static std::string                 m_callsign;
-	static CDExtraProtocolHandlerPool *m_pool;
 
 	static CCallsignList *m_whiteList;
 	static CCallsignList *m_blackList;
@@ -108,6 +114,8 @@ private:
 	unsigned int            m_dExtraSeq;
 	CTimer                  m_inactivityTimer;
 	CHeaderData            *m_header;
+	CMetric                 m_framesIn;
+	CMetric                 m_framesOut;
 
 	unsigned int calcBackoff();
 };
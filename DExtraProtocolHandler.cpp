@@ -21,6 +21,7 @@
 
 #include "DExtraProtocolHandler.h"
 #include "Utils.h"
+#include "ObjectPool.h"
 
 // #define	DUMP_TX
 
@@ -81,7 +82,7 @@ bool CDExtraProtocolHandler::writeAMBE(const CAMBEData& data)
 	dump("Sending Data", buffer, length);
 #endif
 	CSockAddress addr;
-	addr.Initialize(m_family, data.getYourPort(), data.getYourAddress().c_str());
+	addr.Initialize(m_family, data.getYourPort(), data.getYourAddress());
 	return m_socket.Write(buffer, length, addr);
 }
 
@@ -172,12 +173,12 @@ CHeaderData* CDExtraProtocolHandler::newHeader()
 	if (m_type != DE_HEADER)
 		return NULL;
 
-	CHeaderData* header = new CHeaderData;
+	CHeaderData* header = CObjectPool<CHeaderData>::acquire();
 
 	// DExtra checksums are unreliable
 	bool res = header->setDExtraData(m_buffer, m_length, false, m_yourAddress, m_yourPort, m_socket.getPort());
 	if (!res) {
-		delete header;
+		CObjectPool<CHeaderData>::release(header);
 		return NULL;
 	}
 
@@ -189,14 +190,16 @@ CAMBEData* CDExtraProtocolHandler::newAMBE()
 	if (m_type != DE_AMBE)
 		return NULL;
 
-	CAMBEData* data = new CAMBEData;
+	CAMBEData* data = CObjectPool<CAMBEData>::acquire();
 
 	bool res = data->setDExtraData(m_buffer, m_length, m_yourAddress, m_yourPort, m_socket.getPort());
 	if (!res) {
-		delete data;
+		CObjectPool<CAMBEData>::release(data);
 		return NULL;
 	}
 
+	data->setRxTime(m_socket.getRxTime());
+
 	return data;
 }
 
@@ -205,11 +208,11 @@ CPollData* CDExtraProtocolHandler::newPoll()
 	if (m_type != DE_POLL)
 		return NULL;
 
-	CPollData* poll = new CPollData;
+	CPollData* poll = CObjectPool<CPollData>::acquire();
 
 	bool res = poll->setDExtraData(m_buffer, m_length, m_yourAddress, m_yourPort, m_socket.getPort());
 	if (!res) {
-		delete poll;
+		CObjectPool<CPollData>::release(poll);
 		return NULL;
 	}
 
@@ -221,11 +224,11 @@ CConnectData* CDExtraProtocolHandler::newConnect()
 	if (m_type != DE_CONNECT)
 		return NULL;
 
-	CConnectData* connect = new CConnectData;
+	CConnectData* connect = CObjectPool<CConnectData>::acquire();
 
 	bool res = connect->setDExtraData(m_buffer, m_length, m_yourAddress, m_yourPort, m_socket.getPort());
 	if (!res) {
-		delete connect;
+		CObjectPool<CConnectData>::release(connect);
 		return NULL;
 	}
 
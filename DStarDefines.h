@@ -142,6 +142,7 @@ enum AUDIO_SOURCE {
 	AS_DCS,
 	AS_DUP,
 	AS_VERSION,
+	AS_PEER,		// another server sharing the Smart Group
 };
 
 enum DSTAR_RX_STATE {
@@ -0,0 +1,170 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <arpa/inet.h>
+
+#include "Federation.h"
+#include "GroupHandler.h"
+#include "Workers.h"
+#include "ObjectPool.h"
+#include "DStarDefines.h"
+
+#define FEDERATION_MAGIC "SGSF"
+#define FEDERATION_PREFIX (4U + LONG_CALLSIGN_LENGTH)
+
+CUDPReaderWriter *CFederation::m_socket = NULL;
+std::vector<CSockAddress> CFederation::m_peers;
+CMetric CFederation::m_forwarded;
+CMetric CFederation::m_received;
+CMetric CFederation::m_unknown;
+
+bool CFederation::open(unsigned short port, const std::string &peers)
+{
+	m_peers.clear();
+	std::string::size_type start = 0U;
+	while (start < peers.size()) {
+		auto comma = peers.find(',', start);
+		if (peers.npos == comma)
+			comma = peers.size();
+		std::string peer(peers.substr(start, comma - start));
+		start = comma + 1U;
+		peer.erase(0, peer.find_first_not_of(' '));
+		peer.erase(peer.find_last_not_of(' ') + 1U);
+		if (peer.empty())
+			continue;
+
+		const auto colon = peer.rfind(':');
+		const std::string address(peer.substr(0, colon));
+		struct in_addr a;
+		const unsigned long p = (peer.npos == colon) ? 0UL : strtoul(peer.c_str() + colon + 1, NULL, 10);
+		if (0UL == p || p > 65535UL || 1 != inet_pton(AF_INET, address.c_str(), &a)) {
+			fprintf(stderr, "Improper federation peer [%s], it should be address:port\n", peer.c_str());
+			return true;
+		}
+		CSockAddress addr;
+		addr.Initialize(AF_INET, (uint16_t)p, address.c_str());
+		m_peers.push_back(addr);
+	}
+	if (m_peers.empty())
+		return false;
+
+	m_socket = new CUDPReaderWriter(AF_INET, port);
+	if (! m_socket->Open()) {
+		fprintf(stderr, "Cannot open the federation port %u\n", port);
+		delete m_socket;
+		m_socket = NULL;
+		return true;
+	}
+	printf("Federated with %u peers on port %u\n", (unsigned int)m_peers.size(), port);
+
+	CMetrics::add(&m_forwarded, "sgs_federation_packets_total", CMetrics::label("direction", "out"), &m_forwarded);
+	CMetrics::add(&m_forwarded, "sgs_federation_packets_total", CMetrics::label("direction", "in"), &m_received);
+	CMetrics::add(&m_forwarded, "sgs_federation_rejected_total", "", &m_unknown);
+	return false;
+}
+
+void CFederation::close()
+{
+	if (NULL == m_socket)
+		return;
+
+	CMetrics::remove(&m_forwarded);
+	m_socket->Close();
+	delete m_socket;
+	m_socket = NULL;
+}
+
+void CFederation::forward(const std::string &group, const CHeaderData &header)
+{
+	if (NULL == m_socket)
+		return;
+
+	unsigned char buffer[60U];
+	const unsigned int length = header.getG2Data(buffer, 60U, true);
+	send(group, buffer, length);
+}
+
+void CFederation::forward(const std::string &group, const CAMBEData &data)
+{
+	if (NULL == m_socket)
+		return;
+
+	unsigned char buffer[40U];
+	const unsigned int length = data.getG2Data(buffer, 40U);
+	send(group, buffer, length);
+}
+
+void CFederation::send(const std::string &group, const unsigned char *data, unsigned int length)
+{
+	unsigned char buffer[FEDERATION_PREFIX + 60U];
+	if (length > 60U || group.size() != LONG_CALLSIGN_LENGTH)
+		return;
+	memcpy(buffer, FEDERATION_MAGIC, 4U);
+	memcpy(buffer + 4U, group.c_str(), LONG_CALLSIGN_LENGTH);
+	memcpy(buffer + FEDERATION_PREFIX, data, length);
+	for (auto it=m_peers.begin(); it!=m_peers.end(); it++) {
+		m_socket->Write(buffer, FEDERATION_PREFIX + length, *it);
+		m_forwarded.add();
+	}
+}
+
+void CFederation::process()
+{
+	if (NULL == m_socket)
+		return;
+
+	unsigned char buffer[FEDERATION_PREFIX + 60U];
+	CSockAddress addr;
+	while (true) {
+		const int length = m_socket->Read(buffer, sizeof(buffer), addr);
+		if (length <= 0)
+			return;
+
+		bool known = false;
+		for (auto it=m_peers.begin(); !known && it!=m_peers.end(); it++)
+			known = (*it == addr && it->GetPort() == addr.GetPort());
+		const unsigned int dsvt = length - FEDERATION_PREFIX;
+		if (! known || length < int(FEDERATION_PREFIX) || memcmp(buffer, FEDERATION_MAGIC, 4U) || (56U != dsvt && 27U != dsvt)) {
+			m_unknown.add();
+			continue;
+		}
+		m_received.add();
+
+		// a group that isn't in this server's configuration is ignored
+		const std::string callsign((const char *)buffer + 4U, LONG_CALLSIGN_LENGTH);
+		unsigned int worker;
+		if (CGroupHandler::findWorker(callsign, worker))
+			continue;
+
+		if (56U == dsvt) {
+			CHeaderData *header = CObjectPool<CHeaderData>::acquire();
+			if (header->setG2Data(buffer + FEDERATION_PREFIX, dsvt, false, addr.GetAddress(), addr.GetPort()))
+				CWorkers::dispatch(worker, *header, AS_PEER, callsign);
+			CObjectPool<CHeaderData>::release(header);
+		} else {
+			CAMBEData *data = CObjectPool<CAMBEData>::acquire();
+			if (data->setG2Data(buffer + FEDERATION_PREFIX, dsvt, addr.GetAddress(), addr.GetPort())) {
+				data->setRxTime(m_socket->getRxTime());
+				CWorkers::dispatch(worker, *data, AS_PEER, callsign);
+			}
+			CObjectPool<CAMBEData>::release(data);
+		}
+	}
+}
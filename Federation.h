@@ -0,0 +1,56 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "UDPReaderWriter.h"
+#include "SockAddress.h"
+#include "HeaderData.h"
+#include "AMBEData.h"
+#include "Metrics.h"
+
+// Lets several servers share Smart Groups, each with its own users. A group
+// that is in the configuration of more than one server relays each stream
+// from its own users, or from its reflector, to the same group on the other
+// servers, its peers. A peer sends the stream to its own users, and to its
+// reflector, but never on to another peer, so every server needs all the
+// others in its list. Each datagram is "SGSF", the group callsign and the
+// DSVT packet, and only the configured peers are listened to.
+class CFederation {
+public:
+	// peers is a comma separated list of address:port, returns true on error
+	static bool open(unsigned short port, const std::string &peers);
+	static void close();
+	static bool isOpen() { return NULL != m_socket; }
+
+	static void forward(const std::string &group, const CHeaderData &header);
+	static void forward(const std::string &group, const CAMBEData &data);
+
+	// gives the streams from the peers to their groups, on the routing thread
+	static void process();
+
+private:
+	static void send(const std::string &group, const unsigned char *data, unsigned int length);
+
+	static CUDPReaderWriter *m_socket;
+	static std::vector<CSockAddress> m_peers;
+	static CMetric m_forwarded, m_received, m_unknown;
+};
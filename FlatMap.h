@@ -0,0 +1,87 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+// A map kept as a vector of key and value pairs sorted by key, with the
+// values stored in place. For the few hundred entries of a Smart Group it
+// is searched and walked in contiguous memory, where a std::map would chase
+// a pointer to a separately allocated node for each one. Iterating works
+// like a std::map, but inserting or erasing moves the entries after it, so
+// an iterator or pointer into the map isn't valid after either.
+template <class K, class V> class CFlatMap {
+public:
+	typedef std::pair<K, V> value_type;
+	typedef typename std::vector<value_type>::iterator iterator;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+	iterator begin() { return m_items.begin(); }
+	iterator end() { return m_items.end(); }
+	const_iterator begin() const { return m_items.begin(); }
+	const_iterator end() const { return m_items.end(); }
+
+	size_t size() const { return m_items.size(); }
+	bool empty() const { return m_items.empty(); }
+	void clear() { m_items.clear(); }
+
+	iterator find(const K &key)
+	{
+		iterator it = lowerBound(key);
+		return (m_items.end() != it && it->first == key) ? it : m_items.end();
+	}
+
+	const_iterator find(const K &key) const
+	{
+		const_iterator it = std::lower_bound(m_items.begin(), m_items.end(), key, [](const value_type &item, const K &k) { return item.first < k; });
+		return (m_items.end() != it && it->first == key) ? it : m_items.end();
+	}
+
+	// adds value for key, or replaces the one already there
+	iterator insert(const K &key, const V &value)
+	{
+		iterator it = lowerBound(key);
+		if (m_items.end() != it && it->first == key) {
+			it->second = value;
+			return it;
+		}
+		return m_items.insert(it, value_type(key, value));
+	}
+
+	iterator erase(iterator it) { return m_items.erase(it); }
+
+	size_t erase(const K &key)
+	{
+		iterator it = find(key);
+		if (m_items.end() == it)
+			return 0U;
+		m_items.erase(it);
+		return 1U;
+	}
+
+private:
+	iterator lowerBound(const K &key)
+	{
+		return std::lower_bound(m_items.begin(), m_items.end(), key, [](const value_type &item, const K &k) { return item.first < k; });
+	}
+
+	std::vector<value_type> m_items;
+};
@@ -21,9 +21,19 @@
 
 #include "GroupHandler.h"
 #include "G2Handler.h"
+#include "Workers.h"
 #include "Utils.h"
 #include "Defs.h"
 
+CFlatMap<unsigned int, CG2Stream> CG2Handler::m_streams;
+
+CG2Stream::CG2Stream(unsigned int w) :
+worker(w),
+timer(1000U, NETWORK_TIMEOUT)
+{
+	timer.start();
+}
+
 CG2Handler::CG2Handler()
 {
 }
@@ -42,6 +52,49 @@ void CG2Handler::process(CHeaderData& header)
 		return;
 	}
 
+	if (0U == CWorkers::count()) {
+		route(header);
+		return;
+	}
+
+	unsigned int worker;
+	if (CGroupHandler::findWorker(header.getYourCall(), worker))
+		return;		// it isn't for a Smart Group
+
+	m_streams.insert(header.getId(), CG2Stream(worker));
+	CWorkers::dispatch(worker, header);
+}
+
+void CG2Handler::process(CAMBEData& data)
+{
+	if (0U == CWorkers::count()) {
+		route(data);
+		return;
+	}
+
+	auto it = m_streams.find(data.getId());
+	if (m_streams.end() == it)
+		return;		// its header wasn't for a Smart Group, or it was missed
+
+	it->second.timer.start();
+	CWorkers::dispatch(it->second.worker, data);
+	if (data.isEnd())
+		m_streams.erase(it);
+}
+
+void CG2Handler::clock(unsigned int ms)
+{
+	for (auto it=m_streams.begin(); it!=m_streams.end(); ) {
+		it->second.timer.clock(ms);
+		if (it->second.timer.hasExpired())
+			it = m_streams.erase(it);
+		else
+			it++;
+	}
+}
+
+void CG2Handler::route(CHeaderData& header)
+{
 	// Check to see if this is for Smart Group
 	CGroupHandler* handler = CGroupHandler::findGroup(header);
 	if (handler != NULL) {
@@ -50,7 +103,7 @@ void CG2Handler::process(CHeaderData& header)
 	}
 }
 
-void CG2Handler::process(CAMBEData& data)
+void CG2Handler::route(CAMBEData& data)
 {
 	// Check to see if this is for Smart Group
 	CGroupHandler* handler = CGroupHandler::findGroup(data);
@@ -25,15 +25,35 @@
 #include "HeaderData.h"
 #include "AMBEData.h"
 #include "Timer.h"
+#include "FlatMap.h"
+
+// the worker a stream has been given to, until it ends or goes quiet
+class CG2Stream {
+public:
+	CG2Stream(unsigned int w);
+
+	unsigned int worker;
+	CTimer       timer;		// restarted by each of its frames
+};
 
 class CG2Handler {
 public:
+	// on the routing thread, gives each stream to the worker of the group it's for
 	static void process(CHeaderData& header);
 	static void process(CAMBEData& header);
+	// forgets the streams that haven't ended, but haven't been heard from either
+	static void clock(unsigned int ms);
+
+	// on the group's worker, gives the stream to the group
+	static void route(CHeaderData& header);
+	static void route(CAMBEData& data);
 
 protected:
 	CG2Handler();
 	~CG2Handler();
 
 	bool clockInt(unsigned int ms);
+
+private:
+	static CFlatMap<unsigned int, CG2Stream> m_streams;
 };
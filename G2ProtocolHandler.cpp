@@ -21,13 +21,24 @@
 #include <cstring>
 #include "G2ProtocolHandler.h"
 #include "Utils.h"
+#include "ObjectPool.h"
+#include "Log.h"
+#include "Capture.h"
+#include "Workers.h"
+
+#define READER_POLL_MS 100		// how long a reader waits before checking if it should stop
 
 // #define	DUMP_TX
 
 const unsigned int BUFFER_LENGTH = 255U;
 
-CG2ProtocolHandler::CG2ProtocolHandler(int family, unsigned short port) :
+CG2ProtocolHandler::CG2ProtocolHandler(int family, unsigned short port, unsigned int readers, bool steer) :
 m_socket(family, port),
+m_readerCount(CReplay::isActive() ? 0U : readers),	// a replay reads its one capture in order
+m_steer(steer),
+m_nextReader(0U),
+m_running(false),
+m_portmaps(1U + CWorkers::count()),
 m_type(GT_NONE),
 m_buffer(NULL),
 m_length(0U)
@@ -39,12 +50,152 @@ m_length(0U)
 CG2ProtocolHandler::~CG2ProtocolHandler()
 {
 	delete[] m_buffer;
-	portmap.clear();
+	m_portmaps.clear();
 }
 
 bool CG2ProtocolHandler::open()
 {
-	return m_socket.Open();
+	if (0U == m_readerCount)
+		return m_socket.Open();
+
+	for (unsigned int i=0U; i<m_readerCount; i++) {
+		CReader *reader = new CReader;
+		if (0U == i)
+			reader->socket = &m_socket;
+		else
+			reader->socket = new CUDPReaderWriter(m_family, m_socket.getPort());
+		m_readers.push_back(reader);
+		reader->socket->SetReusePort(i);
+		if (! reader->socket->Open()) {
+			close();
+			return false;
+		}
+		CMetrics::add(reader, "sgs_g2_reader_dropped_total", CMetrics::label("port", std::to_string(m_socket.getPort())) + "," + CMetrics::label("socket", std::to_string(i)), &reader->dropped);
+	}
+	if (m_steer && ! m_socket.Steer(m_readerCount)) {
+		close();
+		return false;
+	}
+
+	return startReaders();
+}
+
+// a SO_REUSEPORT group keeps its steering program, so it's only the number of sockets that can't change
+bool CG2ProtocolHandler::open(const std::vector<int> &sockets)
+{
+	if (sockets.empty())
+		return open();
+
+	const unsigned int count = (sockets.size() > 1U) ? sockets.size() : 0U;
+	if (count != m_readerCount)
+		printf("Reading port %u with the %u sockets of the server being replaced\n", m_socket.getPort(), (unsigned int)sockets.size());
+	m_readerCount = count;
+	if (0U == m_readerCount)
+		return m_socket.Adopt(sockets[0]);
+
+	for (unsigned int i=0U; i<m_readerCount; i++) {
+		CReader *reader = new CReader;
+		if (0U == i)
+			reader->socket = &m_socket;
+		else
+			reader->socket = new CUDPReaderWriter(m_family, m_socket.getPort());
+		m_readers.push_back(reader);
+		reader->socket->SetReusePort(i);
+		if (! reader->socket->Adopt(sockets[i])) {
+			for (unsigned int j=i+1U; j<m_readerCount; j++)
+				::close(sockets[j]);
+			close();
+			return false;
+		}
+		CMetrics::add(reader, "sgs_g2_reader_dropped_total", CMetrics::label("port", std::to_string(m_socket.getPort())) + "," + CMetrics::label("socket", std::to_string(i)), &reader->dropped);
+	}
+
+	return startReaders();
+}
+
+bool CG2ProtocolHandler::startReaders()
+{
+	m_running = true;
+	for (auto it=m_readers.begin(); it!=m_readers.end(); it++)
+		(*it)->future = std::async(std::launch::async, &CG2ProtocolHandler::runReader, this, *it);
+	printf("Reading port %u with %u sockets%s\n", m_socket.getPort(), m_readerCount, m_steer ? ", steered by address" : "");
+	return true;
+}
+
+// a reader drains its socket onto its ring, and drops what the ring can't hold, as a full socket would
+void CG2ProtocolHandler::runReader(CReader *reader)
+{
+	unsigned char buffer[BUFFER_LENGTH];
+	while (m_running) {
+		if (! reader->socket->Poll(READER_POLL_MS))
+			continue;
+		CSockAddress addr;
+		int length = reader->socket->Read(buffer, BUFFER_LENGTH, addr);
+		if (length <= 0)
+			continue;
+		if (length > int(DATAGRAM_SIZE))
+			length = DATAGRAM_SIZE;	// nothing that long is a G2 packet, but it still saves the port
+
+		const uint64_t head = reader->head.load(std::memory_order_relaxed);
+		if (head - reader->tail.load(std::memory_order_acquire) >= RING_SIZE) {
+			reader->dropped.add();
+			continue;
+		}
+		CDatagram &d = reader->ring[head & (RING_SIZE - 1U)];
+		memcpy(d.data, buffer, length);
+		d.length = length;
+		d.addr = addr;
+		d.rxTime = reader->socket->getRxTime();
+		reader->head.store(head + 1U, std::memory_order_release);
+	}
+}
+
+// the next datagram from any reader, taking them in turn, 0 if there are none
+int CG2ProtocolHandler::readQueued()
+{
+	for (unsigned int n=0U; n<m_readers.size(); n++) {
+		CReader *reader = m_readers[m_nextReader];
+		m_nextReader = (m_nextReader + 1U) % m_readers.size();
+		const uint64_t tail = reader->tail.load(std::memory_order_relaxed);
+		if (tail == reader->head.load(std::memory_order_acquire))
+			continue;
+		const CDatagram &d = reader->ring[tail & (RING_SIZE - 1U)];
+		memcpy(m_buffer, d.data, d.length);
+		const int length = d.length;
+		m_addr = d.addr;
+		m_rxTime = d.rxTime;
+		reader->tail.store(tail + 1U, std::memory_order_release);
+		return length;
+	}
+	return 0;
+}
+
+// the G2 port of a gateway, or the last port a mobile hotspot was heard on
+void CG2ProtocolHandler::getDestination(const std::string &addr, CSockAddress &saddr) const
+{
+	const auto &portmap = m_portmaps[CWorkers::current()];
+	auto it = portmap.find(addr);
+	if (AF_INET == m_family)
+		saddr.Initialize(AF_INET, (portmap.end() == it) ? G2_DV_PORT : it->second, addr.c_str());
+	else
+		saddr.Initialize(AF_INET6, (portmap.end() == it) ? G2_IPV6_PORT : it->second, addr.c_str());
+}
+
+// on the routing thread, the workers have the change before any packet read after it
+void CG2ProtocolHandler::setPort(const std::string &addr, unsigned short port)
+{
+	m_portmaps[0][addr] = port;
+	for (unsigned int i=1U; i<m_portmaps.size(); i++)
+		CWorkers::post(i - 1U, [this, i, addr, port]() { m_portmaps[i][addr] = port; });
+}
+
+bool CG2ProtocolHandler::write(const unsigned char *buffer, unsigned int length, CSockAddress &saddr, unsigned int copies)
+{
+	for (unsigned int i = 0U; i < copies; i++) {
+		if (! m_socket.Write(buffer, length, saddr))
+			return false;
+	}
+	return true;
 }
 
 bool CG2ProtocolHandler::writeHeader(const CHeaderData& header)
@@ -57,27 +208,9 @@ bool CG2ProtocolHandler::writeHeader(const CHeaderData& header)
 #endif
 
 	CSockAddress saddr;
-	std::string addr = header.getYourAddress();
-	auto it = portmap.find(addr);
-	if (AF_INET == m_family) {
-		if (portmap.end() == it)
-			saddr.Initialize(AF_INET, G2_DV_PORT, addr.c_str());
-		else
-			saddr.Initialize(AF_INET, it->second, addr.c_str());
-	} else {
-		if (portmap.end() == it)
-			saddr.Initialize(AF_INET6, G2_IPV6_PORT, addr.c_str());
-		else
-			saddr.Initialize(AF_INET6, it->second, addr.c_str());
-	}
+	getDestination(header.getYourAddress(), saddr);
 
-	for (unsigned int i = 0U; i < 5U; i++) {
-		bool res = m_socket.Write(buffer, length, saddr);
-		if (!res)
-			return false;
-	}
-
-	return true;
+	return write(buffer, length, saddr, 5U);
 }
 
 bool CG2ProtocolHandler::writeAMBE(const CAMBEData& data)
@@ -90,19 +223,7 @@ bool CG2ProtocolHandler::writeAMBE(const CAMBEData& data)
 #endif
 
 	CSockAddress saddr;
-	std::string addr = data.getYourAddress();
-	auto it = portmap.find(addr);
-	if (AF_INET == m_family) {
-		if (portmap.end() == it)
-			saddr.Initialize(AF_INET, G2_DV_PORT, addr.c_str());
-		else
-			saddr.Initialize(AF_INET, it->second, addr.c_str());
-	} else {
-		if (portmap.end() == it)
-			saddr.Initialize(AF_INET6, G2_IPV6_PORT, addr.c_str());
-		else
-			saddr.Initialize(AF_INET6, it->second, addr.c_str());
-	}
+	getDestination(data.getYourAddress(), saddr);
 
 	return m_socket.Write(buffer, length, saddr);
 }
@@ -111,19 +232,8 @@ bool CG2ProtocolHandler::writePing(const std::string &addr)
 {
 	unsigned char test[4];
 	memcpy(test, "PING", 4);
-	auto it = portmap.find(addr);
 	CSockAddress saddr;
-	if (AF_INET == m_family) {
-		if (portmap.end() == it)
-			saddr.Initialize(AF_INET, G2_DV_PORT, addr.c_str());
-		else
-			saddr.Initialize(AF_INET, it->second, addr.c_str());
-	} else {
-		if (portmap.end() == it)
-			saddr.Initialize(AF_INET6, G2_IPV6_PORT, addr.c_str());
-		else
-			saddr.Initialize(AF_INET6, it->second, addr.c_str());
-	}
+	getDestination(addr, saddr);
 
 	return m_socket.Write(test, 4, saddr);
 }
@@ -144,7 +254,12 @@ bool CG2ProtocolHandler::readPackets()
 	m_type = GT_NONE;
 
 	// No more data?
-	int length = m_socket.Read(m_buffer, BUFFER_LENGTH, m_addr);
+	int length;
+	if (m_readers.empty()) {
+		length = m_socket.Read(m_buffer, BUFFER_LENGTH, m_addr);
+		m_rxTime = m_socket.getRxTime();
+	} else
+		length = readQueued();
 	if (length <= 0)
 		return false;
 
@@ -158,16 +273,18 @@ bool CG2ProtocolHandler::readPackets()
 	// We will only save it if it's been saved before or if it's different from the "standard" port
 	const unsigned short port = m_addr.GetPort();
 	const char *addr = m_addr.GetAddress();
-	const bool found = (portmap.end() != portmap.find(addr));
+	const auto &portmap = m_portmaps[0];
+	auto it = portmap.find(addr);
+	const bool found = (portmap.end() != it);
 	if (found || (AF_INET==m_family && G2_DV_PORT!=port) || (AF_INET6==m_family && G2_IPV6_PORT!=port)) {
 		if (found) {
-			if (portmap[addr] != port) {
-				printf("%.6s at [%s]:%u, was port %u%s\n", m_buffer+42, addr, port, portmap[addr], (GT_HEADER==m_type) ? "." : " on a voice packet!");
-				portmap[addr] = port;
+			if (it->second != port) {
+				LOG(LL_INFO, "G2 port changed", "user=%.6s address=%s port=%u was=%u packet=%s", m_buffer+42, addr, port, it->second, (GT_HEADER==m_type) ? "header" : "voice");
+				setPort(addr, port);
 			}
 		} else {
-			printf("%.6s at [%s]:%u%s\n", m_buffer+42, addr, port, (GT_HEADER==m_type) ? "." : " on a voice packet!");
-			portmap[addr] = port;
+			LOG(LL_INFO, "G2 port saved", "user=%.6s address=%s port=%u packet=%s", m_buffer+42, addr, port, (GT_HEADER==m_type) ? "header" : "voice");
+			setPort(addr, port);
 		}
 	}
 	return isdsvt ? false : true;
@@ -178,12 +295,12 @@ CHeaderData* CG2ProtocolHandler::readHeader()
 	if (m_type != GT_HEADER)
 		return NULL;
 
-	CHeaderData* header = new CHeaderData;
+	CHeaderData* header = CObjectPool<CHeaderData>::acquire();
 
 	CSockAddress addr;
 	bool res = header->setG2Data(m_buffer, m_length, false, m_addr.GetAddress(), m_addr.GetPort());
 	if (!res) {
-		delete header;
+		CObjectPool<CHeaderData>::release(header);
 		return NULL;
 	}
 
@@ -195,18 +312,55 @@ CAMBEData* CG2ProtocolHandler::readAMBE()
 	if (m_type != GT_AMBE)
 		return NULL;
 
-	CAMBEData* data = new CAMBEData;
+	CAMBEData* data = CObjectPool<CAMBEData>::acquire();
 
 	bool res = data->setG2Data(m_buffer, m_length, m_addr.GetAddress(), m_addr.GetPort());
 	if (!res) {
-		delete data;
+		CObjectPool<CAMBEData>::release(data);
 		return NULL;
 	}
 
+	data->setRxTime(m_rxTime);
+
 	return data;
 }
 
+void CG2ProtocolHandler::handOff(std::vector<int> &sockets)
+{
+	m_running = false;
+	for (auto it=m_readers.begin(); it!=m_readers.end(); it++) {
+		if ((*it)->future.valid())
+			(*it)->future.get();
+		sockets.push_back((*it)->socket->getFd());
+	}
+	if (m_readers.empty())
+		sockets.push_back(m_socket.getFd());
+}
+
+void CG2ProtocolHandler::savePorts(std::ostream &out, const std::string &tag) const
+{
+	for (auto it=m_portmaps[0].begin(); it!=m_portmaps[0].end(); it++)
+		out << tag << '\t' << it->first << '\t' << it->second << '\n';
+}
+
+void CG2ProtocolHandler::restorePort(const std::string &address, unsigned short port)
+{
+	setPort(address, port);
+}
+
 void CG2ProtocolHandler::close()
 {
+	m_running = false;
+	for (auto it=m_readers.begin(); it!=m_readers.end(); it++) {
+		if ((*it)->future.valid())
+			(*it)->future.get();
+		CMetrics::remove(*it);
+		if ((*it)->socket != &m_socket) {
+			(*it)->socket->Close();
+			delete (*it)->socket;
+		}
+		delete *it;
+	}
+	m_readers.clear();
 	m_socket.Close();
 }
@@ -19,7 +19,12 @@
 
 #pragma once
 
+#include <ostream>
 #include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <chrono>
 
 #include "UDPReaderWriter.h"
 #include "DStarDefines.h"
@@ -34,15 +39,33 @@ enum G2_TYPE {
 
 class CG2ProtocolHandler {
 public:
-	CG2ProtocolHandler(int family, unsigned short port);
+	// with readers, that many SO_REUSEPORT sockets are bound to the port and
+	// each is drained by a thread of its own, steer keeps each peer address on
+	// one of them; read() still hands the packets out on the routing thread
+	CG2ProtocolHandler(int family, unsigned short port, unsigned int readers = 0U, bool steer = false);
 	~CG2ProtocolHandler();
 
 	bool open();
+	// for an upgrade, opens with the sockets of the server being replaced, and the number of readers follows them
+	bool open(const std::vector<int> &sockets);
+	// stops reading, and adds the sockets for the new server to take over
+	void handOff(std::vector<int> &sockets);
+	// reads them again, when the new server couldn't take them
+	bool resume() { return m_readers.empty() || startReaders(); }
+	// the ports of the hotspots that don't use the standard one, as lines of tag, address and port
+	void savePorts(std::ostream &out, const std::string &tag) const;
+	void restorePort(const std::string &address, unsigned short port);
 
 	bool writeHeader(const CHeaderData& header);
 	bool writeAMBE(const CAMBEData& data);
 	bool writePing(const std::string &address);
 
+	// the routing thread and each worker look the port up in a copy of the
+	// port map of their own, the routing thread changes its copy as it reads
+	// and posts each change to the workers, and the write is thread safe
+	void getDestination(const std::string &address, CSockAddress &saddr) const;
+	bool write(const unsigned char *buffer, unsigned int length, CSockAddress &saddr, unsigned int copies = 1U);
+
 	G2_TYPE read();
 	CHeaderData *readHeader();
 	CAMBEData   *readAMBE();
@@ -50,14 +73,46 @@ public:
 	void close();
 
 private:
-	std::unordered_map<std::string, unsigned short> portmap;
+	static const unsigned int RING_SIZE = 1024U;		// a power of two
+	static const unsigned int DATAGRAM_SIZE = 64U;	// G2 packets are 56 bytes at the most
+
+	class CDatagram {
+	public:
+		unsigned char data[DATAGRAM_SIZE];
+		int length;
+		CSockAddress addr;
+		std::chrono::steady_clock::time_point rxTime;
+	};
+
+	class CReader {
+	public:
+		CReader() : socket(NULL), head(0U), tail(0U) {}
+
+		CUDPReaderWriter *socket;
+		CDatagram ring[RING_SIZE];
+		std::atomic<uint64_t> head;		// written by the reader
+		std::atomic<uint64_t> tail;		// written by the routing thread
+		std::future<void> future;
+		CMetric dropped;
+	};
 
-	CUDPReaderWriter m_socket;
+	CUDPReaderWriter m_socket;	// the first socket of a group, and the one that sends
+	std::vector<CReader *> m_readers;
+	unsigned int     m_readerCount;
+	bool             m_steer;
+	unsigned int     m_nextReader;
+	std::atomic<bool> m_running;
+	std::vector<std::unordered_map<std::string, unsigned short>> m_portmaps;	// the routing thread's, then each worker's
+	std::chrono::steady_clock::time_point m_rxTime;
 	G2_TYPE          m_type;
 	unsigned char   *m_buffer;
 	unsigned int     m_length;
 	CSockAddress     m_addr;
 	int              m_family;
 
+	bool startReaders();
+	void setPort(const std::string &address, unsigned short port);
 	bool readPackets();
+	int  readQueued();
+	void runReader(CReader *reader);
 };
@@ -17,11 +17,12 @@
  *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <cstdio>
 #include <cstring>
 #include <vector>
-#include <set>
 #include <queue>
 
 #include "SlowDataEncoder.h"
@@ -29,14 +30,26 @@
 #include "DExtraHandler.h"		// DEXTRA_LINK
 #include "DCSHandler.h"			// DCS_LINK
 #include "Utils.h"
+#include "RemoteEvents.h"
+#include "Log.h"
+#include "Workers.h"
+#include "Keepalive.h"
+#include "Capture.h"
+#include "Replication.h"
+#include "Federation.h"
 
 const unsigned int MESSAGE_DELAY = 4U;
+const unsigned int PING_STAGGER_MS = 613U;	// between the first user checks of successive groups, prime to 10000
+const unsigned int MAX_CONTENDERS = 4U;		// the streams tracked per group besides the one relayed
 
 // define static members
 CG2ProtocolHandler *CGroupHandler::m_g2Handler[2] = { NULL, NULL };
 CIRCDDB            *CGroupHandler::m_irc[2] = { NULL, NULL };
 std::string         CGroupHandler::m_gateway;
-std::list<CGroupHandler *> CGroupHandler::m_Groups;
+ARBITRATION         CGroupHandler::m_arbitration = AR_FIRST;
+std::vector<std::string> CGroupHandler::m_priority;
+thread_local std::list<CGroupHandler *> CGroupHandler::m_Groups;
+std::vector<CGroupPlace> CGroupHandler::m_places;
 
 
 CSGSUser::CSGSUser(const std::string &callsign, unsigned int timeout) :
@@ -44,7 +57,7 @@ m_callsign(callsign),
 m_timer(1000U, timeout)
 {
 	m_timer.start();
-	time(&m_found);
+	m_found = CReplay::now();
 }
 
 CSGSUser::~CSGSUser()
@@ -65,7 +78,7 @@ bool CSGSUser::hasExpired()
 
 void CSGSUser::reset()
 {
-	time(&m_found);
+	m_found = CReplay::now();
 	m_timer.start();
 }
 
@@ -89,16 +102,15 @@ void CSGSUser::setLastFound(time_t t)
 	m_found = t;
 }
 
-CSGSId::CSGSId(unsigned int id, unsigned int timeout, CSGSUser *user) :
+CSGSId::CSGSId(unsigned int id, unsigned int timeout, const std::string &user) :
 m_id(id),
 m_timer(1000U, timeout),
 m_login(false),
 m_logoff(false),
 m_end(false),
+m_busy(false),
 m_user(user)
 {
-	assert(user != NULL);
-
 	m_timer.start();
 }
 
@@ -132,6 +144,11 @@ void CSGSId::setEnd()
 	m_end = true;
 }
 
+void CSGSId::setBusy()
+{
+	m_busy = true;
+}
+
 bool CSGSId::clock(unsigned int ms)
 {
 	m_timer.clock(ms);
@@ -159,11 +176,47 @@ bool CSGSId::isEnd() const
 	return m_end;
 }
 
-CSGSUser* CSGSId::getUser() const
+bool CSGSId::isBusy() const
+{
+	return m_busy;
+}
+
+const std::string &CSGSId::getUser() const
 {
 	return m_user;
 }
 
+void CSGSRepeaters::clear()
+{
+	dest.clear();
+	rptr.clear();
+	gate.clear();
+	addr.clear();
+	ipv4.clear();
+}
+
+void CSGSRepeaters::add(const std::string &r, const std::string &g, const std::string &a)
+{
+	auto it = std::lower_bound(rptr.begin(), rptr.end(), r);
+	if (rptr.end() != it && *it == r)
+		return;
+	const size_t n = it - rptr.begin();
+	dest.insert(dest.begin() + n, "/" + r.substr(0, 6) + r.back());
+	rptr.insert(it, r);
+	gate.insert(gate.begin() + n, g);
+	addr.insert(addr.begin() + n, a);
+	ipv4.insert(ipv4.begin() + n, (std::string::npos == a.find(':')) ? 1U : 0U);
+}
+
+CContender::CContender(unsigned int i, const std::string &c, bool r) :
+id(i),
+callsign(c),
+reflector(r),
+timer(1000U, NETWORK_TIMEOUT)
+{
+	timer.start();
+}
+
 //CTextCollector& CSGSId::getTextCollector()
 //{
 	//return m_textCollector;
@@ -171,12 +224,155 @@ CSGSUser* CSGSId::getUser() const
 
 void CGroupHandler::add(const std::string &callsign, const std::string &logoff, const std::string &repeater, const std::string &infoText, unsigned int userTimeout, bool listenOnly, bool showlink, const std::string &reflector)
 {
-	CGroupHandler *group = new CGroupHandler(callsign, logoff, repeater, infoText, userTimeout, listenOnly, showlink, reflector);
+	const unsigned int worker = CWorkers::assign();
+	bool added = false;
+	CWorkers::call(worker, [&]() {
+		CGroupHandler *group = new CGroupHandler(callsign, logoff, repeater, infoText, userTimeout, listenOnly, showlink, reflector);
+
+		if (group) {
+			m_Groups.push_back(group);
+			added = true;
+		} else
+			printf("Cannot allocate Smart Group with callsign %s\n", callsign.c_str());
+	});
+
+	if (added)
+		m_places.push_back(CGroupPlace(callsign, logoff, worker));
+}
 
-	if (group)
-		m_Groups.push_back(group);
-	else
-		printf("Cannot allocate Smart Group with callsign %s\n", callsign.c_str());
+void CGroupHandler::update(const std::string &callsign, const std::string &logoff, const std::string &repeater, const std::string &infoText, unsigned int userTimeout, bool listenOnly, bool showlink, const std::string &reflector)
+{
+	CGroupPlace *place = findPlace(callsign);
+	if (NULL == place) {
+		printf("Adding Smart Group %s\n", callsign.c_str());
+		add(callsign, logoff, repeater, infoText, userTimeout, listenOnly, showlink, reflector);
+		call(callsign, [](CGroupHandler *group) { group->linkInt(); });
+		return;
+	}
+
+	place->logoff.assign(logoff);
+	call(callsign, [&](CGroupHandler *group) {
+		const bool relink = repeater.compare(group->m_repeater) || reflector.compare(group->m_configReflector);
+		if (relink || logoff.compare(group->m_offCallsign) || infoText.compare(group->m_infoText) || userTimeout != group->m_userTimeout || listenOnly != group->m_listenOnly || showlink != group->m_showlink)
+			printf("Updating Smart Group %s\n", callsign.c_str());
+
+		if (relink)
+			group->unlinkInt();
+
+		group->m_offCallsign.assign(logoff);
+		group->m_repeater.assign(repeater);
+		group->m_infoText.assign(infoText);
+		group->m_userTimeout = userTimeout;	// for the users that log on from now on
+		group->m_listenOnly = listenOnly;
+		group->m_showlink = showlink;
+
+		if (relink) {
+			group->m_configReflector.assign(reflector);
+			group->m_linkReflector.assign(reflector);
+			if (reflector.size())
+				group->m_linkType = (0 == reflector.compare(0, 3, "XRF")) ? LT_DEXTRA : LT_DCS;
+			group->linkInt();
+		}
+	});
+}
+
+void CGroupHandler::remove(const std::string &callsign)
+{
+	for (auto place=m_places.begin(); place!=m_places.end(); place++) {
+		if (place->callsign.compare(callsign))
+			continue;
+
+		CWorkers::call(place->worker, [&]() {
+			for (auto it=m_Groups.begin(); it!=m_Groups.end(); it++) {
+				CGroupHandler *group = *it;
+				if (group->m_groupCallsign.compare(callsign))
+					continue;
+
+				printf("Removing Smart Group %s\n", callsign.c_str());
+				group->LogoffUser("ALL     ");
+				group->unlinkInt();
+				// the unlink has been sent, an unlinking link that outlived the group would call it back
+				CDExtraHandler::detach(group);
+				CDCSHandler::detach(group);
+				m_Groups.erase(it);
+				delete group;
+				return;
+			}
+		});
+		m_places.erase(place);
+		return;
+	}
+}
+
+void CGroupHandler::save(std::ostream &out, bool users)
+{
+	const time_t now = time(NULL);
+	forEach([&](CGroupHandler *group) {
+		out << "group\t" << group->m_groupCallsign << '\t' << group->m_linkReflector << '\n';
+		for (auto it=group->m_users.begin(); users && it!=group->m_users.end(); ++it) {
+			const CSGSUser &user = it->second;
+			out << "on\t" << group->m_groupCallsign << '\t' << user.getCallsign() << '\t' << long(now - user.getTimer().getTimer()) << '\n';
+		}
+	});
+}
+
+bool CGroupHandler::restore(const std::vector<std::string> &fields)
+{
+	if (3U != fields.size() || fields[0].compare("group"))
+		return true;
+
+	// if there's no group, it has been taken out of the configuration
+	call(fields[1], [&](CGroupHandler *group) {
+		// a remote command may have linked it somewhere else, or unlinked it
+		const std::string &reflector = fields[2];
+		group->m_linkReflector.assign(reflector);
+		if (reflector.size())
+			group->m_linkType = (0 == reflector.compare(0, 3, "XRF")) ? LT_DEXTRA : LT_DCS;
+		else
+			group->m_linkType = LT_NONE;
+	});
+	return false;
+}
+
+unsigned int CGroupHandler::restore(const std::vector<CJournalEntry> &entries)
+{
+	const time_t now = time(NULL);
+	unsigned int count = 0U;
+	for (auto it=entries.begin(); it!=entries.end(); it++) {
+		// a header from the future means the clock has been set back, not that the user has timed out
+		const unsigned int elapsed = (now > it->active) ? (unsigned int)(now - it->active) : 0U;
+		bool restored = false;
+		call(it->group, [&](CGroupHandler *group) { restored = group->restoreUser(it->user, elapsed); });
+		if (restored)
+			count++;
+		else
+			CJournal::record(false, it->group, it->user);	// its group has gone, or it has timed out
+	}
+	return count;
+}
+
+// the users taken over from another server, which only its journal has
+void CGroupHandler::journal()
+{
+	const time_t now = time(NULL);
+	forEach([now](CGroupHandler *group) {
+		for (auto it=group->m_users.begin(); it!=group->m_users.end(); ++it)
+			CJournal::record(true, group->m_groupCallsign, it->second.getCallsign(), now - it->second.getTimer().getTimer());
+	});
+}
+
+// returns false if the user has already timed out
+bool CGroupHandler::restoreUser(const std::string &callsign, unsigned int elapsed)
+{
+	if (m_userTimeout && elapsed >= m_userTimeout * 60U)
+		return false;
+
+	CSGSUser user(callsign, m_userTimeout * 60U);
+	if (m_userTimeout)	// without a timeout, the elapsed time doesn't matter
+		user.clock(elapsed * 1000U);
+	m_users.insert(callsign, user);
+	m_repeatersValid = false;
+	return true;
 }
 
 void CGroupHandler::setG2Handler(CG2ProtocolHandler *handler0, CG2ProtocolHandler *handler1)
@@ -200,6 +396,34 @@ void CGroupHandler::setGateway(const std::string &gateway)
 	m_gateway = gateway;
 }
 
+bool CGroupHandler::setArbitration(const std::string &policy, const std::string &priority)
+{
+	m_priority.clear();
+	std::string call;
+	for (auto c : priority + " ") {
+		if (',' == c || isspace(c)) {
+			if (call.size())
+				m_priority.push_back(call);
+			call.clear();
+		} else
+			call.push_back(toupper(c));
+	}
+
+	if (0 == policy.compare("first"))
+		m_arbitration = AR_FIRST;
+	else if (0 == policy.compare("priority"))
+		m_arbitration = AR_PRIORITY;
+	else if (0 == policy.compare("local"))
+		m_arbitration = AR_LOCAL;
+	else if (0 == policy.compare("reflector"))
+		m_arbitration = AR_REFLECTOR;
+	else {
+		m_arbitration = AR_FIRST;
+		return true;
+	}
+	return false;
+}
+
 CGroupHandler *CGroupHandler::findGroup(const std::string &callsign)
 {
 	for (auto it=m_Groups.begin(); it!=m_Groups.end(); it++) {
@@ -227,7 +451,7 @@ CGroupHandler *CGroupHandler::findGroup(const CAMBEData &data)
 	unsigned int id = data.getId();
 
 	for (auto it=m_Groups.begin(); it!=m_Groups.end(); it++) {
-		if ((*it)->m_id == id)
+		if ((*it)->m_id == id || (*it)->findContender(id))
 			return *it;
 	}
 	return NULL;
@@ -237,19 +461,65 @@ std::list<std::string> CGroupHandler::listGroups()
 {
 	std::list<std::string> groups;
 
-	for (auto it=m_Groups.begin(); it!=m_Groups.end(); it++)
-		groups.push_back((*it)->m_groupCallsign);
+	for (auto it=m_places.begin(); it!=m_places.end(); it++)
+		groups.push_back(it->callsign);
 
 	return groups;
 }
 
+CGroupPlace *CGroupHandler::findPlace(const std::string &callsign)
+{
+	for (auto it=m_places.begin(); it!=m_places.end(); it++) {
+		if (0 == it->callsign.compare(callsign))
+			return &(*it);
+	}
+	return NULL;
+}
+
+bool CGroupHandler::findWorker(const std::string &callsign, unsigned int &worker)
+{
+	for (auto it=m_places.begin(); it!=m_places.end(); it++) {
+		if (0 == it->callsign.compare(callsign) || 0 == it->logoff.compare(callsign)) {
+			worker = it->worker;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CGroupHandler::call(const std::string &callsign, const std::function<void(CGroupHandler *)> &fn)
+{
+	CGroupPlace *place = findPlace(callsign);
+	if (NULL == place)
+		return true;
+
+	bool found = false;
+	CWorkers::call(place->worker, [&]() {
+		CGroupHandler *group = findGroup(callsign);
+		if (group) {
+			fn(group);
+			found = true;
+		}
+	});
+	return ! found;
+}
+
+// the groups of each worker in turn
+void CGroupHandler::forEach(const std::function<void(CGroupHandler *)> &fn)
+{
+	CWorkers::callAll([&]() {
+		for (auto it=m_Groups.begin(); it!=m_Groups.end(); it++)
+			fn(*it);
+	});
+}
+
 CRemoteGroup *CGroupHandler::getInfo() const
 {
 	CRemoteGroup *data = new CRemoteGroup(m_groupCallsign, m_offCallsign, m_repeater, m_infoText, m_linkReflector, m_linkStatus, m_userTimeout);
 
 	for (auto it=m_users.begin(); it!=m_users.end(); ++it) {
-		CSGSUser* user = it->second;
-		data->addUser(user->getCallsign(), user->getTimer().getTimer(), user->getTimer().getTimeout());
+		const CSGSUser &user = it->second;
+		data->addUser(user.getCallsign(), user.getTimer().getTimer(), user.getTimer().getTimeout());
 	}
 
 	return data;
@@ -261,6 +531,8 @@ void CGroupHandler::finalise()
 		delete m_Groups.front();
 		m_Groups.pop_front();
 	}
+	if (0U == CWorkers::current())
+		m_places.clear();	// after the workers have deleted theirs
 }
 
 void CGroupHandler::clock(unsigned int ms)
@@ -271,8 +543,7 @@ void CGroupHandler::clock(unsigned int ms)
 
 void CGroupHandler::link()
 {
-	for (auto it=m_Groups.begin(); it!=m_Groups.end(); it++)
-		(*it)->linkInt();
+	forEach([](CGroupHandler *group) { group->linkInt(); });
 }
 
 CGroupHandler::CGroupHandler(const std::string &callsign, const std::string &logoff, const std::string &repeater, const std::string &infoText, unsigned int userTimeout, bool listenOnly, bool showlink, const std::string &reflector) :
@@ -281,19 +552,23 @@ m_offCallsign(logoff),
 m_repeater(repeater),
 m_infoText(infoText),
 m_linkReflector(reflector),
+m_configReflector(reflector),
 m_linkGateway(),
 m_linkStatus(LS_NONE),
 m_oldlinkStatus(LS_INIT),
 m_linkTimer(1000U, NETWORK_TIMEOUT),
+m_linkPending(false),
 m_id(0x00U),
+m_talkerReflector(false),
 m_announceTimer(1000U, 2U * 60U),		// 2 minutes
-m_pingTimer(1000U, 10U),
+m_pingTimer(1000U, 0U, 1U + (PING_STAGGER_MS * m_Groups.size()) % 10000U),	// so the groups don't all check their users at once
 m_userTimeout(userTimeout),
 m_listenOnly(listenOnly),
 m_showlink(showlink),
 m_ids(),
 m_users(),
-m_repeaters()
+m_repeaters(),
+m_repeatersValid(false)
 {
 	m_announceTimer.start();
 	m_pingTimer.start();
@@ -303,25 +578,34 @@ m_repeaters()
 		m_linkType = (0 == m_linkReflector.compare(0, 3, "XRF")) ? LT_DEXTRA : LT_DCS;
 	else
 		m_linkType = LT_NONE;
+
+	const std::string label(CMetrics::label("group", callsign));
+	CMetrics::add(this, "sgs_group_headers_total", label, &m_headersIn);
+	CMetrics::add(this, "sgs_group_frames_in_total", label, &m_framesIn);
+	CMetrics::add(this, "sgs_group_frames_out_total", label, &m_framesOut);
+	CMetrics::add(this, "sgs_group_fanout", label, &m_fanout);
+	CMetrics::add(this, "sgs_group_users", label, &m_userCount);
+	CMetrics::add(this, "sgs_group_repeater_updates_total", label, &m_repeaterUpdates);
+	CMetrics::add(this, "sgs_group_collisions_total", label, &m_collisions);
+	CMetrics::add(this, "sgs_group_preemptions_total", label, &m_preemptions);
+	CMetrics::add(this, "sgs_group_contender_frames_total", label, &m_contenderFrames);
+	m_relayLatency.addTo(this, "sgs_group_relay_seconds", label);
 }
 
 CGroupHandler::~CGroupHandler()
 {
-	for (auto it = m_ids.begin(); it != m_ids.end(); it++)
-		delete it->second;
-	m_ids.clear();
+	CMetrics::remove(this);
 
-	for (auto it = m_users.begin(); it != m_users.end(); ++it)
-		delete it->second;
-	m_users.clear();
-
-	for (auto it = m_repeaters.begin(); it != m_repeaters.end(); ++it)
-		delete it->second;
-	m_repeaters.clear();
+	for (int i=0; i<2; i++) {
+		if (m_irc[i])
+			m_irc[i]->cache.unsubscribe(this);
+	}
 }
 
 void CGroupHandler::process(CHeaderData &header)
 {
+	m_headersIn.add();
+
 	std::string my   = header.getMyCall1();
 	std::string your = header.getYourCall();
 	unsigned int id  = header.getId();
@@ -343,30 +627,29 @@ void CGroupHandler::process(CHeaderData &header)
 	if (0 == your.compare(m_groupCallsign)) {
 		// This is a normal message for logging in/relaying
 		if (m_users.end() == it) {
-			printf("Adding %s to Smart Group %s\n", my.c_str(), your.c_str());
+			LOG(LL_INFO, "Adding user to Smart Group", "user=\"%s\" group=\"%s\"", my.c_str(), your.c_str());
 			// This is a new user, add him to the list
-			auto group_user = new CSGSUser(my, m_userTimeout * 60U);
-			m_users[my] = group_user;
+			m_users.insert(my, CSGSUser(my, m_userTimeout * 60U));
+			m_repeatersValid = false;
 
 			logUser(LU_ON, your, my);	// inform Quadnet
 
 			// add a new Id for this message
-			CSGSId* tx = new CSGSId(id, MESSAGE_DELAY, group_user);
-			tx->setLogin();
-			m_ids[id] = tx;
+			CSGSId tx(id, MESSAGE_DELAY, my);
+			tx.setLogin();
+			m_ids.insert(id, tx);
 			islogin = true;
 		} else {
-			it->second->reset();
+			it->second.reset();
 
 			// Check that it isn't a duplicate header
-			CSGSId* tx = m_ids[id];
-			if (tx) {
+			if (m_ids.end() != m_ids.find(id)) {
 				//printf("Duplicate header from %s, deleting userData...\n", my.c_str());
 				return;
 			}
 			//printf("Updating %s on Smart Group %s\n", my.c_str(), your.c_str());
-			logUser(LU_ON, your, my);	// this will be an update
-			m_ids[id] = new CSGSId(id, MESSAGE_DELAY, it->second);
+			logUser(LU_UPDATE, your, my);	// this will be an update
+			m_ids.insert(id, CSGSId(id, MESSAGE_DELAY, my));
 		}
 	} else {
 		// unsubscribe was sent by someone
@@ -374,23 +657,27 @@ void CGroupHandler::process(CHeaderData &header)
 			return;
 		}
 
-		printf("Removing %s from Smart Group %s\n", my.c_str(), m_groupCallsign.c_str());
+		LOG(LL_INFO, "Removing user from Smart Group", "user=\"%s\" group=\"%s\"", my.c_str(), m_groupCallsign.c_str());
 		logUser(LU_OFF, m_groupCallsign, my);	// inform Quadnet
 		// Remove the user from the user list
-		m_users.erase(my);
+		m_users.erase(it);
+		m_repeatersValid = false;
 
-		CSGSId* tx = new CSGSId(id, MESSAGE_DELAY, it->second);
-		tx->setLogoff();
-		m_ids[id] = tx;
+		CSGSId tx(id, MESSAGE_DELAY, my);
+		tx.setLogoff();
+		m_ids.insert(id, tx);
 
 		return;
 	}
 
 	if (m_id != 0x00U) {
-		return;
+		if (islogin || !arbitrate(id, my, false))
+			return;
 	}
 
 	m_id = id;
+	m_talker.assign(my);
+	m_talkerReflector = false;
 
 	// Change the Your callsign to CQCQCQ
 	header.setCQCQCQ();
@@ -399,6 +686,9 @@ void CGroupHandler::process(CHeaderData &header)
 	header.setFlag2(0x00);
 	header.setFlag3(0x00);
 
+	if (!islogin && !m_listenOnly)
+		CFederation::forward(m_groupCallsign, header);
+
 	if (LT_DEXTRA == m_linkType) {
 		if (!islogin && !m_listenOnly) {
 			header.setRepeaters(m_linkGateway, m_linkReflector);
@@ -412,40 +702,11 @@ void CGroupHandler::process(CHeaderData &header)
 	}
 
 	// Get the home repeater of the user, because we don't want to route this incoming back to him
-	std::string exclude(m_irc[0]->cache.findUserRepeater(my));
-	if (exclude.empty() && m_irc[1])
-		exclude.assign(m_irc[1]->cache.findUserRepeater(my));
+	m_exclude.assign(m_irc[0]->cache.findUserRepeater(my));
+	if (m_exclude.empty() && m_irc[1])
+		m_exclude.assign(m_irc[1]->cache.findUserRepeater(my));
 
-	// Update the repeater list, based on users that are currently logged in
-	for (auto it = m_users.begin(); it != m_users.end(); ++it) {
-		CSGSUser *user = it->second;
-		if (user != NULL) {
-			// Find the user in the cache
-			std::string rptr, gate, addr;
-			m_irc[0]->cache.findUserData(user->getCallsign(), rptr, gate, addr);
-			if (addr.empty()) {
-				if (m_irc[1])
-					m_irc[1]->cache.findUserData(user->getCallsign(), rptr, gate, addr);
-			}
-			if (! addr.empty()) {
-				if (rptr.compare(exclude)) {
-					// Find the users repeater in the repeater list, add it otherwise
-					CSGSRepeater *repeater = m_repeaters[rptr];
-					if (repeater == NULL) {
-						// Add a new repeater entry
-						repeater = new CSGSRepeater;
-						// we zone route to all the repeaters, except for the sender who transmitted it
-						repeater->dest.assign("/");
-						repeater->dest.append(rptr.substr(0, 6) + rptr.back());
-						repeater->rptr.assign(rptr);
-						repeater->gate.assign(gate);
-						repeater->addr.assign(addr);
-						m_repeaters[rptr] = repeater;
-					}
-				}
-			}
-		}
-	}
+	updateRepeaters();
 
 	if (!islogin && !m_listenOnly)
 		sendToRepeaters(header);
@@ -458,44 +719,55 @@ void CGroupHandler::process(CAMBEData &data)
 {
 	unsigned int id = data.getId();
 
-	if (m_ids.end() == m_ids.find(id))
+	auto itx = m_ids.find(id);
+	if (m_ids.end() == itx)
 		return;
 
-	CSGSId* tx = m_ids[id];
+	m_framesIn.add();
+
+	CSGSId *tx = &itx->second;	// nothing is added to or erased from m_ids until the end
 
 	tx->reset();
 
-	CSGSUser* user = tx->getUser();
-	user->reset();
+	auto user = m_users.find(tx->getUser());
+	if (m_users.end() != user)	// it's gone if this is the user logging off
+		user->second.reset();
 
 	if (id == m_id && !tx->isLogin() && !m_listenOnly) {
+		CFederation::forward(m_groupCallsign, data);
 		if (LT_DEXTRA == m_linkType)
 			CDExtraHandler::writeAMBE(this, data, DIR_OUTGOING);
 		else if (LT_DCS == m_linkType)
 			CDCSHandler::writeAMBE(this, data, DIR_OUTGOING);
 		sendToRepeaters(data);
+		recordLatency(data);
+	} else if (id != m_id) {
+		CContender *contender = findContender(id);
+		if (contender) {
+			contender->timer.start();
+			m_contenderFrames.add();
+		}
 	}
 
 	if (data.isEnd()) {
-		if (id == m_id) {
-			// Clear the repeater list if we're the relayed id
-			for (auto it = m_repeaters.begin(); it != m_repeaters.end(); ++it)
-				delete it->second;
-			m_repeaters.clear();
+		if (id == m_id)
 			m_id = 0x00U;
-		}
+		else
+			removeContender(id);
 
 		if (tx->isLogin()) {
 			tx->reset();
 			tx->setEnd();
 		} else if (tx->isLogoff()) {
-			m_users.erase(user->getCallsign());
+			m_users.erase(tx->getUser());
+			m_repeatersValid = false;
 			tx->reset();
 			tx->setEnd();
-		} else {
-			m_ids.erase(tx->getId());
-			delete tx;
-		}
+		} else if (tx->isBusy()) {
+			tx->reset();
+			tx->setEnd();
+		} else
+			m_ids.erase(itx);
 	}
 }
 
@@ -503,23 +775,15 @@ bool CGroupHandler::LogoffUser(const std::string &callsign)
 {
 	if (0 == callsign.compare("ALL     ")) {
 		for (auto it = m_users.begin(); it != m_users.end(); ++it) {
-			CSGSUser* user = it->second;
-			if (user) {
-				printf("Removing %s from Smart Group %s, logged off by remote control\n", user->getCallsign().c_str(), m_groupCallsign.c_str());
-				logUser(LU_OFF, m_groupCallsign, user->getCallsign());	// inform Quadnet
-				delete user;
-			}
+			printf("Removing %s from Smart Group %s, logged off by remote control\n", it->first.c_str(), m_groupCallsign.c_str());
+			logUser(LU_OFF, m_groupCallsign, it->first);	// inform Quadnet
 		}
 
-		for (auto it = m_ids.begin(); it != m_ids.end(); ++it)
-			delete it->second;
-
-		for (auto it = m_repeaters.begin(); it != m_repeaters.end(); ++it)
-			delete it->second;
-
 		m_users.clear();
 		m_ids.clear();
 		m_repeaters.clear();
+		m_repeatersValid = false;
+		m_contenders.clear();
 
 		m_id = 0x00U;
 
@@ -530,37 +794,29 @@ bool CGroupHandler::LogoffUser(const std::string &callsign)
 			printf("Invalid callsign asked to logoff\n");
 			return false;
 		}
-		CSGSUser *user = it->second;
-		printf("Removing %s from Smart Group %s, logged off by remote control\n", user->getCallsign().c_str(), m_groupCallsign.c_str());
-		logUser(LU_OFF, m_groupCallsign, user->getCallsign());	// inform Quadnet
+		printf("Removing %s from Smart Group %s, logged off by remote control\n", callsign.c_str(), m_groupCallsign.c_str());
+		logUser(LU_OFF, m_groupCallsign, callsign);	// inform Quadnet
 
 		// Find any associated id structure associated with this use, and the logged off user is the
 		// currently relayed one, remove his id.
-		for (auto it = m_ids.begin(); it != m_ids.end(); ++it) {
-			CSGSId* id = it->second;
-			if (id != NULL && id->getUser() == user) {
-				if (id->getId() == m_id)
+		for (auto itx = m_ids.begin(); itx != m_ids.end(); ++itx) {
+			if (itx->second.getUser() == callsign) {
+				if (itx->first == m_id)
 					m_id = 0x00U;
 
-				m_ids.erase(it);
-				delete id;
+				m_ids.erase(itx);
 				break;
 			}
 		}
 
-		m_users.erase(callsign);
-		delete user;
+		m_users.erase(it);
+		m_repeatersValid = false;
 
 		// Check to see if we have any users left
 		unsigned int count = m_users.size();
 
 		// If none then clear all the data structures
 		if (count == 0U) {
-			for (auto it = m_ids.begin(); it != m_ids.end(); ++it)
-				delete it->second;
-			for (auto it = m_repeaters.begin(); it != m_repeaters.end(); ++it)
-				delete it->second;
-
 			m_ids.clear();
 			m_repeaters.clear();
 
@@ -571,12 +827,21 @@ bool CGroupHandler::LogoffUser(const std::string &callsign)
 	}
 }
 
-bool CGroupHandler::process(CHeaderData &header, DIRECTION, AUDIO_SOURCE)
+// from the linked reflector, or from a peer sharing the group
+bool CGroupHandler::process(CHeaderData &header, DIRECTION, AUDIO_SOURCE source)
 {
-	if (m_id != 0x00U)
-		return false;
+	const unsigned int id = header.getId();
+	if (m_id != 0x00U) {
+		// the reflector repeats the header every 21 frames, those of a stream that's already known don't contend again
+		if (id == m_id || findContender(id) || !arbitrate(id, header.getMyCall1(), true))
+			return false;
+	} else
+		removeContender(id);	// one that lost the group takes it at its next header
 
-	m_id = header.getId();
+	m_id = id;
+	m_talker.assign(header.getMyCall1());
+	m_talkerReflector = true;
+	m_headersIn.add();
 
 	m_linkTimer.start();
 
@@ -587,37 +852,24 @@ bool CGroupHandler::process(CHeaderData &header, DIRECTION, AUDIO_SOURCE)
 	header.setFlag2(0x00);
 	header.setFlag3(0x00);
 
-	// Update the repeater list
-	for (auto it = m_users.begin(); it != m_users.end(); ++it) {
-		CSGSUser* user = it->second;
-		if (user) {
-			// Find the user in the cache
-			std::string rptr, gate, addr;
-			m_irc[0]->cache.findUserData(user->getCallsign(), rptr, gate, addr);
-			if (addr.empty() && m_irc[1])
-				m_irc[1]->cache.findUserData(user->getCallsign(), rptr, gate, addr);
-			// Find the users repeater in the repeater list, add it otherwise
-			if (! addr.empty()) {
-				CSGSRepeater* repeater = m_repeaters[rptr];
-				if (repeater == NULL) {
-					// Add a new repeater entry
-					repeater = new CSGSRepeater;
-					repeater->dest.assign("/");
-					repeater->dest.append(rptr.substr(0, 6) + rptr.back());
-					repeater->rptr.assign(rptr);
-					repeater->gate.assign(gate);
-					repeater->addr.assign(addr);
-					m_repeaters[rptr] = repeater;
-				}
-			}
+	// a peer's stream goes to this server's reflector, and a reflector's to the peers, but never from one peer to another
+	if (AS_PEER != source) {
+		CFederation::forward(m_groupCallsign, header);
+	} else if (!m_listenOnly) {
+		if (LT_DEXTRA == m_linkType) {
+			header.setRepeaters(m_linkGateway, m_linkReflector);
+			CDExtraHandler::writeHeader(this, header, DIR_OUTGOING);
+		} else if (LT_DCS == m_linkType) {
+			header.setRepeaters(m_linkGateway, m_linkReflector);
+			CDCSHandler::writeHeader(this, header, DIR_OUTGOING);
 		}
 	}
 
-	CSGSId *tx = m_ids[m_id];
-	if (tx) {
-		if (!tx->isLogin())
-			sendToRepeaters(header);
-	} else
+	m_exclude.clear();	// a reflector's stream goes to everyone
+	updateRepeaters();
+
+	auto tx = m_ids.find(m_id);
+	if (m_ids.end() == tx || !tx->second.isLogin())
 		sendToRepeaters(header);
 
 	sendFromText();
@@ -625,29 +877,40 @@ bool CGroupHandler::process(CHeaderData &header, DIRECTION, AUDIO_SOURCE)
 	return true;
 }
 
-bool CGroupHandler::process(CAMBEData &data, DIRECTION, AUDIO_SOURCE)
+bool CGroupHandler::process(CAMBEData &data, DIRECTION, AUDIO_SOURCE source)
 {
 	unsigned int id = data.getId();
-	if (id != m_id)
+	if (id != m_id) {
+		CContender *contender = findContender(id);
+		if (contender) {
+			contender->timer.start();
+			m_contenderFrames.add();
+			if (data.isEnd())
+				removeContender(id);
+		}
 		return false;
+	}
 
+	m_framesIn.add();
 	m_linkTimer.start();
 
-	CSGSId *tx = m_ids[id];
-	if (tx) {
-		if (!tx->isLogin())
-			sendToRepeaters(data);
-	} else
+	if (AS_PEER != source) {
+		CFederation::forward(m_groupCallsign, data);
+	} else if (!m_listenOnly) {
+		if (LT_DEXTRA == m_linkType)
+			CDExtraHandler::writeAMBE(this, data, DIR_OUTGOING);
+		else if (LT_DCS == m_linkType)
+			CDCSHandler::writeAMBE(this, data, DIR_OUTGOING);
+	}
+
+	auto tx = m_ids.find(id);
+	if (m_ids.end() == tx || !tx->second.isLogin())
 		sendToRepeaters(data);
+	recordLatency(data);
 
 	if (data.isEnd()) {
 		m_linkTimer.stop();
 		m_id = 0x00U;
-
-		// Clear the repeater list
-		for (auto it = m_repeaters.begin(); it != m_repeaters.end(); ++it)
-			delete it->second;
-		m_repeaters.clear();
 	}
 
 	return true;
@@ -686,9 +949,12 @@ bool CGroupHandler::linkInt()
 		i = 1;
 	std::string addr(m_irc[i]->cache.findGateAddress(gate));
 	if (addr.empty()) {
-		printf("Cannot find the reflector in the cache, not linking\n");
+		if (! m_linkPending)
+			printf("Cannot find the reflector in the cache, linking when its address is found\n");
+		m_linkPending = true;	// the reflector hosts are looked up in the background
 		return false;
 	}
+	m_linkPending = false;
 
 	m_linkGateway.assign(gate);
 	switch (m_linkType) {
@@ -706,63 +972,73 @@ bool CGroupHandler::linkInt()
 	return true;
 }
 
+// like the remote unlink command
+void CGroupHandler::unlinkInt()
+{
+	switch (m_linkType) {
+		case LT_DEXTRA:
+			CDExtraHandler::unlink(this, m_linkReflector, false);
+			break;
+		case LT_DCS:
+			CDCSHandler::unlink(this, m_linkReflector, false);
+			break;
+		default:
+			break;
+	}
+	m_linkType = LT_NONE;
+	m_linkReflector.clear();
+	m_linkPending = false;
+}
+
 void CGroupHandler::clockInt(unsigned int ms)
 {
-	time_t tnow = time(NULL);
+	m_userCount.set(long(m_users.size()));
+	time_t tnow = CReplay::now();
 	m_pingTimer.clock(ms);
 	if (m_pingTimer.isRunning() && m_pingTimer.hasExpired()) {
-		std::set<std::string> addresses;	// First, build an address set
 		for (auto it = m_users.begin(); it != m_users.end(); ) {
-			auto sgsuser = it->second;
-			if (sgsuser) {
-				const std::string user(sgsuser->getCallsign());
-				auto addr = m_irc[0]->cache.findUserAddr(user);
-				if (addr.empty() && m_irc[1])
-					addr = m_irc[1]->cache.findUserAddr(user);
-				if (addr.empty()) {
-					if (600 <= (tnow - sgsuser->getLastFound())) {
-						printf("User '%s' on '%s' not found for 10 minutes, logging off!\n", user.c_str(), m_groupCallsign.c_str());
-						logUser(LU_OFF, m_groupCallsign, user);
-						it = m_users.erase(it);	// make sure this iterator is incremented on every other path!
-					} else {
-						m_irc[0]->findUser(user);
-						if (m_irc[1]) {
-							m_irc[1]->findUser(user);
-						}
-						it++;
-					}
+			CSGSUser &sgsuser = it->second;
+			const std::string user(sgsuser.getCallsign());
+			auto addr = m_irc[0]->cache.findUserAddr(user);
+			if (addr.empty() && m_irc[1])
+				addr = m_irc[1]->cache.findUserAddr(user);
+			if (addr.empty()) {
+				if (600 <= (tnow - sgsuser.getLastFound())) {
+					LOG(LL_INFO, "Removing user from Smart Group", "user=\"%s\" group=\"%s\" reason=not_found", user.c_str(), m_groupCallsign.c_str());
+					logUser(LU_OFF, m_groupCallsign, user);
+					it = m_users.erase(it);	// make sure this iterator is incremented on every other path!
+					m_repeatersValid = false;
 				} else {
-					sgsuser->setLastFound(tnow);
-					addresses.insert(addr);
+					m_irc[0]->findUser(user);
+					if (m_irc[1]) {
+						m_irc[1]->findUser(user);
+					}
 					it++;
 				}
 			} else {
+				sgsuser.setLastFound(tnow);
+				CKeepalive::want(addr);	// it pings each address once, however many groups have it
 				it++;
 			}
 		}
+		m_pingTimer.start(10U);
 
-		for (auto ita=addresses.begin(); ita!=addresses.end(); ita++) {	// Then, ping the unique address
-			if ((*ita).npos != (*ita).find('.')) {
-				// it's an IPv4 address
-				if (m_irc[1]) {							// is this is a dual stack server?
-					m_g2Handler[1]->writePing(*ita);	// then write the ping on second server
-					continue;							// and get the next address
-				}
-			}
-			m_g2Handler[0]->writePing(*ita);	// it's either an IPv6 address, or we are single stack
-		}
-		m_pingTimer.start();
+		if (m_linkPending && LT_NONE != m_linkType)
+			linkInt();
 	}
 
 	m_linkTimer.clock(ms);
 	if (m_linkTimer.isRunning() && m_linkTimer.hasExpired()) {
 		m_linkTimer.stop();
 		m_id = 0x00U;
+	}
 
-		// Clear the repeater list
-		for (auto it=m_repeaters.begin(); it!=m_repeaters.end(); it++)
-			delete it->second;
-		m_repeaters.clear();
+	for (auto it = m_contenders.begin(); it != m_contenders.end(); ) {
+		it->timer.clock(ms);
+		if (it->timer.hasExpired())
+			it = m_contenders.erase(it);	// its end was lost
+		else
+			it++;
 	}
 
 	m_announceTimer.clock(ms);
@@ -777,17 +1053,17 @@ void CGroupHandler::clockInt(unsigned int ms)
 		m_announceTimer.start(60U * 60U);		// 1 hour
 	}
 
-	if (m_oldlinkStatus!=m_linkStatus && 7==m_irc[0]->getConnectionState()) {
+	if (m_oldlinkStatus != m_linkStatus) {
 		updateReflectorInfo();
 		m_oldlinkStatus = m_linkStatus;
 	}
 
 	// For each incoming id
 	for (auto it = m_ids.begin(); it != m_ids.end(); ) {	// iterate must be incremented on all paths!
-		CSGSId* tx = it->second;
+		CSGSId *tx = &it->second;
 
-		if (tx != NULL && tx->clock(ms)) {
-			std::string callsign = tx->getUser()->getCallsign();
+		if (tx->clock(ms)) {
+			const std::string callsign(tx->getUser());
 
 			if (tx->isEnd()) {
 
@@ -798,6 +1074,8 @@ void CGroupHandler::clockInt(unsigned int ms)
 							sendAck(i, callsign, "Logged in");
 						else if (tx->isLogoff())
 							sendAck(i, callsign, "Logged off");
+						else if (tx->isBusy())
+							sendAck(i, callsign, "Group busy");
 						not_found = false;
 						break;
 					}
@@ -806,16 +1084,10 @@ void CGroupHandler::clockInt(unsigned int ms)
 					printf("Cannot find %s in the cache\n", callsign.c_str());
 				}
 
-				delete tx;
 				it = m_ids.erase(it);
 			} else {
-				if (tx->getId() == m_id) {
-					// Clear the repeater list if we're the relayed id
-					for (auto itr = m_repeaters.begin(); itr != m_repeaters.end(); ++itr)
-						delete itr->second;
-					m_repeaters.clear();
-					m_id = 0x00U;
-				}
+				if (tx->getId() == m_id)
+					m_id = 0x00U;	// the relayed stream has timed out
 
 				if (tx->isLogin()) {
 					tx->reset();
@@ -823,13 +1095,16 @@ void CGroupHandler::clockInt(unsigned int ms)
 					it++;
 				} else if (tx->isLogoff()) {
 					m_users.erase(callsign);
+					m_repeatersValid = false;
 					tx->reset();
 					tx->setEnd();
 					it++;
-				} else {
-					delete tx;
+				} else if (tx->isBusy()) {
+					tx->reset();
+					tx->setEnd();
+					it++;
+				} else
 					it = m_ids.erase(it);
-				}
 			}
 		} else {
 			it++;
@@ -837,10 +1112,8 @@ void CGroupHandler::clockInt(unsigned int ms)
 	}
 
 	// Individual user expiry
-	for (auto it = m_users.begin(); it != m_users.end(); ++it) {
-		CSGSUser* user = it->second;
-		user->clock(ms);
-	}
+	for (auto it = m_users.begin(); it != m_users.end(); ++it)
+		it->second.clock(ms);
 
 	// Don't do timeouts when relaying audio
 	if (m_id != 0x00U)
@@ -848,12 +1121,11 @@ void CGroupHandler::clockInt(unsigned int ms)
 
 	// Individual user expiry
 	for (auto it = m_users.begin(); it != m_users.end();) {	// iterator must be incremented on on paths!
-		CSGSUser* user = it->second;
-		if (user && user->hasExpired()) {
-			printf("Removing %s from Smart Group %s, user timeout\n", user->getCallsign().c_str(), m_groupCallsign.c_str());
-			logUser(LU_OFF, m_groupCallsign, user->getCallsign());	// inform QuadNet
-			delete user;
+		if (it->second.hasExpired()) {
+			LOG(LL_INFO, "Removing user from Smart Group", "user=\"%s\" group=\"%s\" reason=timeout", it->first.c_str(), m_groupCallsign.c_str());
+			logUser(LU_OFF, m_groupCallsign, it->first);	// inform QuadNet
 			it = m_users.erase(it);
+			m_repeatersValid = false;
 		} else {
 			it++;
 		}
@@ -863,6 +1135,8 @@ void CGroupHandler::clockInt(unsigned int ms)
 // QuadNet no longer supports any irc SGS messages
 void CGroupHandler::updateReflectorInfo()
 {
+	CRemoteEvents::linkChange(m_groupCallsign, m_linkReflector, m_linkStatus);
+
 	// std::string subcommand("REFLECTOR");
 	// std::vector<std::string> parms;
 	// std::string callsign(m_groupCallsign);
@@ -909,9 +1183,16 @@ void CGroupHandler::updateReflectorInfo()
 	// }
 }
 
-// QuadNet no longer supports any irc SGS messages
-void CGroupHandler::logUser(LOGUSER /*lu*/, const std::string /*channel*/, const std::string /*user*/)
+// QuadNet no longer supports any irc SGS messages, these go to remote subscribers instead
+void CGroupHandler::logUser(LOGUSER lu, const std::string channel, const std::string user)
 {
+	// the subscribers only hear about logons and logoffs, the journal and the standby need the time of each header
+	if (LU_UPDATE != lu)
+		CRemoteEvents::userLog(LU_ON == lu, channel, user);
+	CJournal::record(LU_OFF != lu, channel, user);
+	if (CReplication::isSending())
+		CReplication::send(std::string((LU_OFF != lu) ? "on\t" : "off\t") + channel + "\t" + user + "\t" + std::to_string(long(time(NULL))));
+
 	// std::string cmd(LU_OFF==lu ? "LOGOFF" : "LOGON");
 	// std::string chn(channel);
 	// std::string usr(user);
@@ -926,38 +1207,164 @@ void CGroupHandler::logUser(LOGUSER /*lu*/, const std::string /*channel*/, const
 	// }
 }
 
-void CGroupHandler::sendToRepeaters(CHeaderData& header) const
+void CGroupHandler::cacheChanged(CACHE_EVENT, const std::string &)
 {
-	for (auto it = m_repeaters.begin(); it != m_repeaters.end(); ++it) {
-		CSGSRepeater *repeater = it->second;
-		if (repeater) {
-			const bool is_ipv4 = (std::string::npos == repeater->addr.find(':'));
-			int i = 0;
-			if (is_ipv4 && m_irc[1])
-				i = 1;
-			header.setYourCall(repeater->dest);
-			header.setDestination(repeater->addr, is_ipv4 ? G2_DV_PORT : G2_IPV6_PORT);
-			header.setRepeaters(repeater->gate, it->first);
-			m_g2Handler[i]->writeHeader(header);
+	m_repeatersValid = false;
+}
+
+// the repeaters are only looked up again after a user has come or gone, or the cache entries of one have changed
+void CGroupHandler::updateRepeaters()
+{
+	// a change from here on makes them stale again
+	if (m_repeatersValid.exchange(true))
+		return;
+
+	m_repeaters.clear();
+	// the repeaters and gateways of the users, even those without an address, so a gateway that comes back is heard about
+	std::vector<std::string> rptrs, gates;
+	for (auto it = m_users.begin(); it != m_users.end(); ++it) {
+		// Find the user in the cache
+		std::string rptr, gate, addr;
+		m_irc[0]->cache.findUserData(it->first, rptr, gate, addr);
+		if (addr.empty() && m_irc[1]) {
+			rptrs.push_back(rptr);
+			gates.push_back(gate);
+			m_irc[1]->cache.findUserData(it->first, rptr, gate, addr);
 		}
+		rptrs.push_back(rptr);
+		gates.push_back(gate);
+		// we zone route to all the repeaters
+		if (! addr.empty())
+			m_repeaters.add(rptr, gate, addr);
 	}
+
+	// hear about anything that changes where these users are
+	for (int i=0; i<2 && m_irc[i]; i++) {
+		CCacheManager &cache = m_irc[i]->cache;
+		cache.unsubscribe(this);
+		for (auto it = m_users.begin(); it != m_users.end(); ++it)
+			cache.subscribe(CE_USER, it->first, this);
+		for (size_t n = 0; n < rptrs.size(); n++) {
+			if (rptrs[n].size())
+				cache.subscribe(CE_REPEATER, rptrs[n], this);
+			if (gates[n].size())
+				cache.subscribe(CE_GATEWAY, gates[n], this);
+		}
+	}
+
+	m_repeaterUpdates.add();
 }
 
-void CGroupHandler::sendToRepeaters(CAMBEData &data) const
+// a stream wants the group while m_id has it, returns true if it takes the group
+bool CGroupHandler::arbitrate(unsigned int id, const std::string &callsign, bool reflector)
+{
+	unsigned int loser = id;
+	if (wins(callsign, reflector)) {
+		LOG(LL_INFO, "Stream preempted", "group=\"%s\" talker=\"%s\" by=\"%s\"", m_groupCallsign.c_str(), m_talker.c_str(), callsign.c_str());
+		m_preemptions.add();
+		addContender(m_id, m_talker, m_talkerReflector);
+		if (m_talkerReflector)
+			m_linkTimer.stop();	// a reflector stream restarts it
+		loser = m_id;
+	} else {
+		LOG(LL_DEBUG, "Group busy", "group=\"%s\" talker=\"%s\" contender=\"%s\"", m_groupCallsign.c_str(), m_talker.c_str(), callsign.c_str());
+		m_collisions.add();
+		addContender(id, callsign, reflector);
+	}
+
+	// a user whose stream isn't relayed is told so when it ends
+	auto tx = m_ids.find(loser);
+	if (m_ids.end() != tx && !tx->second.isLogin() && !tx->second.isLogoff())
+		tx->second.setBusy();
+
+	return loser != id;
+}
+
+bool CGroupHandler::wins(const std::string &callsign, bool reflector) const
+{
+	switch (m_arbitration) {
+		case AR_PRIORITY: {
+				auto isPriority = [](const std::string &call) {
+					const std::string base(call.substr(0, call.find(' ')));
+					return m_priority.end() != std::find(m_priority.begin(), m_priority.end(), base);
+				};
+				return isPriority(callsign) && !isPriority(m_talker);
+			}
+		case AR_LOCAL:
+			return !reflector && m_talkerReflector;
+		case AR_REFLECTOR:
+			return reflector && !m_talkerReflector;
+		default:
+			return false;
+	}
+}
+
+CContender *CGroupHandler::findContender(unsigned int id)
+{
+	for (auto it = m_contenders.begin(); it != m_contenders.end(); it++) {
+		if (it->id == id)
+			return &(*it);
+	}
+	return NULL;
+}
+
+// when there are already MAX_CONTENDERS, the oldest is forgotten
+void CGroupHandler::addContender(unsigned int id, const std::string &callsign, bool reflector)
 {
-	for (auto it = m_repeaters.begin(); it != m_repeaters.end(); ++it) {
-		CSGSRepeater *repeater = it->second;
-		if (repeater != NULL) {
-			const bool is_ipv4 = (std::string::npos == repeater->addr.find(':'));
-			int i = 0;
-			if (is_ipv4 && m_irc[1])
-				i = 1;
-			data.setDestination(repeater->addr, is_ipv4 ? G2_DV_PORT : G2_IPV6_PORT);
-			m_g2Handler[i]->writeAMBE(data);
+	if (MAX_CONTENDERS <= m_contenders.size())
+		m_contenders.erase(m_contenders.begin());
+	m_contenders.push_back(CContender(id, callsign, reflector));
+}
+
+void CGroupHandler::removeContender(unsigned int id)
+{
+	for (auto it = m_contenders.begin(); it != m_contenders.end(); it++) {
+		if (it->id == id) {
+			m_contenders.erase(it);
+			return;
 		}
 	}
 }
 
+void CGroupHandler::sendToRepeaters(CHeaderData& header) const
+{
+	const CSGSRepeaters &r = m_repeaters;
+	long count = 0L;
+	for (size_t n = 0; n < r.size(); n++) {
+		if (0 == r.rptr[n].compare(m_exclude))
+			continue;
+		const int i = (r.ipv4[n] && m_irc[1]) ? 1 : 0;
+		header.setYourCall(r.dest[n]);
+		header.setDestination(r.addr[n], r.ipv4[n] ? G2_DV_PORT : G2_IPV6_PORT);
+		header.setRepeaters(r.gate[n], r.rptr[n]);
+		m_g2Handler[i]->writeHeader(header);
+		count++;
+	}
+	m_fanout.set(count);
+}
+
+void CGroupHandler::sendToRepeaters(CAMBEData &data) const
+{
+	const CSGSRepeaters &r = m_repeaters;
+	for (size_t n = 0; n < r.size(); n++) {
+		if (0 == r.rptr[n].compare(m_exclude))
+			continue;
+		const int i = (r.ipv4[n] && m_irc[1]) ? 1 : 0;
+		data.setDestination(r.addr[n], r.ipv4[n] ? G2_DV_PORT : G2_IPV6_PORT);
+		m_g2Handler[i]->writeAMBE(data);
+		m_framesOut.add();
+	}
+}
+
+// from the time the frame was read to now, after the last copy has been sent
+void CGroupHandler::recordLatency(const CAMBEData &data)
+{
+	if (std::chrono::steady_clock::time_point() == data.getRxTime())
+		return;
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - data.getRxTime()).count();
+	m_relayLatency.record(us < 0 ? 0UL : (unsigned long)us);
+}
+
 void CGroupHandler::sendFromText()
 {
 	std::string text("VIA SMARTGP ");
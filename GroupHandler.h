@@ -20,10 +20,12 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <ostream>
 #include <string>
-#include <map>
 #include <list>
-#include <set>
+#include <vector>
+#include <atomic>
+#include <functional>
 
 #include "RemoteGroup.h"
 #include "G2ProtocolHandler.h"
@@ -34,12 +36,24 @@
 #include "AMBEData.h"
 #include "IRCDDB.h"
 #include "Timer.h"
+#include "Metrics.h"
+#include "FlatMap.h"
+#include "Journal.h"
 
 enum LOGUSER {
 	LU_ON,
+	LU_UPDATE,	// a header from a user who is already logged on
 	LU_OFF
 };
 
+// who gets a group when a stream starts while another one has it
+enum ARBITRATION {
+	AR_FIRST,		// the stream that has the group keeps it
+	AR_PRIORITY,	// a priority callsign takes it from anyone else
+	AR_LOCAL,		// a user's stream takes it from a linked reflector
+	AR_REFLECTOR	// a linked reflector's stream takes it from a user
+};
+
 class CSGSUser {
 public:
 	CSGSUser(const std::string& callsign, unsigned int timeout);
@@ -63,7 +77,7 @@ private:
 
 class CSGSId {
 public:
-	CSGSId(unsigned int id, unsigned int timeout, CSGSUser* user);
+	CSGSId(unsigned int id, unsigned int timeout, const std::string &user);
 	~CSGSId();
 
 	unsigned int getId() const;
@@ -74,6 +88,7 @@ public:
 	void setInfo();
 	void setLogoff();
 	void setEnd();
+	void setBusy();
 
 	bool clock(unsigned int ms);
 	bool hasExpired();
@@ -81,8 +96,9 @@ public:
 	bool isLogin() const;
 	bool isLogoff() const;
 	bool isEnd() const;
+	bool isBusy() const;
 
-	CSGSUser* getUser() const;
+	const std::string &getUser() const;
 
 private:
 	unsigned int   m_id;
@@ -90,27 +106,80 @@ private:
 	bool           m_login;
 	bool           m_logoff;
 	bool           m_end;
-	CSGSUser      *m_user;
+	bool           m_busy;	// the stream wasn't relayed, because another one had the group
+	std::string    m_user;	// the callsign, the user may have logged off
+};
+
+// The repeaters a group sends to, sorted by repeater, with an array for
+// each field so that sending a frame to all of them walks through memory.
+class CSGSRepeaters {
+public:
+	size_t size() const { return rptr.size(); }
+	void clear();
+	// adds the repeater, unless it's already there
+	void add(const std::string &rptr, const std::string &gate, const std::string &addr);
+
+	std::vector<std::string>   dest;	// zone routed, "/" and the repeater
+	std::vector<std::string>   rptr;
+	std::vector<std::string>   gate;
+	std::vector<std::string>   addr;
+	std::vector<unsigned char> ipv4;
+};
+
+// a stream that wanted a group while another one had it
+class CContender {
+public:
+	CContender(unsigned int id, const std::string &callsign, bool reflector);
+
+	unsigned int id;
+	std::string  callsign;
+	bool         reflector;
+	CTimer       timer;		// restarted by each of its frames
 };
 
-class CSGSRepeater {
+// where the routing thread finds a group, which is owned by one of the workers
+class CGroupPlace {
 public:
-	std::string dest;
-	std::string rptr;
-	std::string gate;
-	std::string	addr;
+	CGroupPlace(const std::string &c, const std::string &l, unsigned int w) : callsign(c), logoff(l), worker(w) {}
+
+	std::string  callsign;
+	std::string  logoff;
+	unsigned int worker;
 };
 
-class CGroupHandler {
+class CGroupHandler : public ICacheListener {
 public:
 	static void add(const std::string &callsign, const std::string &logoff, const std::string &repeater, const std::string &infoText, unsigned int userTimeout, bool listenOnly, bool showlink, const std::string & eflector);
 	static void setG2Handler(CG2ProtocolHandler *handler0, CG2ProtocolHandler *handler1);
 	static void setIRC(CIRCDDB *irc0, CIRCDDB *irc1);
 	static void setGateway(const std::string &gateway);
 	static void link();
+	// for a reload: adds the group if it's new, or changes its settings in place, keeping its users
+	static void update(const std::string &callsign, const std::string &logoff, const std::string &repeater, const std::string &infoText, unsigned int userTimeout, bool listenOnly, bool showlink, const std::string &reflector);
+	// logs off the group's users, unlinks it and deletes it
+	static void remove(const std::string &callsign);
+	// returns true if the policy is unknown, priority is a list of callsigns
+	static bool setArbitration(const std::string &policy, const std::string &priority);
+	// for an upgrade or a standby, writes the reflector each group is linked to, as tab separated lines,
+	// and its users, as journal records of their last header
+	static void save(std::ostream &out, bool users);
+	// puts back a group line that save() wrote, before link(), returns true if it isn't one
+	static bool restore(const std::vector<std::string> &fields);
+	// puts back the users that haven't timed out, before link(), and returns how many
+	static unsigned int restore(const std::vector<CJournalEntry> &entries);
+	// journals the users, after they were taken over from another server
+	static void journal();
 
 	static std::list<std::string> listGroups();
 
+	// on the routing thread, runs fn with the group on its worker, returns true if there is no such group
+	static bool call(const std::string &callsign, const std::function<void(CGroupHandler *)> &fn);
+	// on the routing thread, runs fn with each group on its worker
+	static void forEach(const std::function<void(CGroupHandler *)> &fn);
+	// on the routing thread, finds the worker of the group with this callsign or logoff callsign, returns true if there is none
+	static bool findWorker(const std::string &callsign, unsigned int &worker);
+
+	// these find the groups of the thread they are called on
 	static CGroupHandler *findGroup(const std::string &callsign);
 	static CGroupHandler *findGroup(const CHeaderData &header);
 	static CGroupHandler *findGroup(const CAMBEData &data);
@@ -130,10 +199,11 @@ public:
 	void clearReflector();
 
 	CRemoteGroup *getInfo() const;
+	const CLatencyHistogram &getRelayLatency() const { return m_relayLatency; }
 
 	bool LogoffUser(const std::string& callsign);
 
-    // these two process functions are for linked reflectors
+    // these two process functions are for linked reflectors, and the peers that share the group
 	bool process(CHeaderData &header, DIRECTION direction, AUDIO_SOURCE source);
 	bool process(CAMBEData &data, DIRECTION direction, AUDIO_SOURCE source);
 
@@ -143,15 +213,19 @@ public:
 
 	bool singleHeader();
 
+	void cacheChanged(CACHE_EVENT type, const std::string &key);
+
 protected:
 	CGroupHandler(const std::string &callsign, const std::string &logoff, const std::string &repeater, const std::string &infoText, unsigned int userTimeout, bool listenOnly, bool showlink, const std::string &reflector);
 	~CGroupHandler();
 
 	bool linkInt();
+	void unlinkInt();
 	void clockInt(unsigned int ms);
 
 private:
-	static std::list<CGroupHandler *> m_Groups;
+	static thread_local std::list<CGroupHandler *> m_Groups;	// the groups this worker owns
+	static std::vector<CGroupPlace> m_places;	// all of them, in the order they were added, for the routing thread
 
 	static CG2ProtocolHandler *m_g2Handler[2];
 	static CIRCDDB            *m_irc[2];
@@ -159,30 +233,59 @@ private:
 
 	static std::string         m_name;
 
+	static ARBITRATION              m_arbitration;
+	static std::vector<std::string> m_priority;
+
 	// Group info
 	std::string    m_groupCallsign;
 	std::string    m_offCallsign;
 	std::string    m_repeater;
 	std::string    m_infoText;
 	std::string    m_linkReflector;
+	std::string    m_configReflector;	// the one in the configuration, a remote command may have changed m_linkReflector
 	std::string    m_linkGateway;
 	LINK_STATUS    m_linkStatus;
 	LINK_STATUS    m_oldlinkStatus;
 	CTimer         m_linkTimer;
+	bool           m_linkPending;	// the reflector's address wasn't known when it was linked
 	DSTAR_LINKTYPE m_linkType;
 	unsigned int   m_id;
+	std::string    m_talker;			// whose stream m_id is
+	bool           m_talkerReflector;	// and whether it came from the linked reflector
+	std::vector<CContender> m_contenders;	// the streams that didn't get the group, or lost it
 	CTimer         m_announceTimer;
 	CTimer         m_pingTimer;
 	unsigned int   m_userTimeout;
 	bool           m_listenOnly;
 	bool           m_showlink;
-	std::map<unsigned int, CSGSId *>      m_ids;
-	std::map<std::string, CSGSUser *>     m_users;
-	std::map<std::string, CSGSRepeater *> m_repeaters;
-
+	CFlatMap<unsigned int, CSGSId>   m_ids;
+	CFlatMap<std::string, CSGSUser>  m_users;
+	CSGSRepeaters  m_repeaters;			// where the users are, kept between streams
+	std::atomic<bool> m_repeatersValid;	// false after the users, or their cache entries, change, which ircDDB may do on its own thread
+	std::string    m_exclude;			// the sender's repeater, which doesn't get its own stream back
+	CMetric         m_headersIn;
+	CMetric         m_framesIn;
+	mutable CMetric m_framesOut;
+	mutable CMetric m_fanout;
+	CMetric         m_userCount;
+	CMetric         m_repeaterUpdates;
+	CMetric         m_collisions;
+	CMetric         m_preemptions;
+	CMetric         m_contenderFrames;
+	CLatencyHistogram m_relayLatency;
+
+	static CGroupPlace *findPlace(const std::string &callsign);
+	bool restoreUser(const std::string &callsign, unsigned int elapsed);
+	void updateRepeaters();
+	bool arbitrate(unsigned int id, const std::string &callsign, bool reflector);
+	bool wins(const std::string &callsign, bool reflector) const;
+	CContender *findContender(unsigned int id);
+	void addContender(unsigned int id, const std::string &callsign, bool reflector);
+	void removeContender(unsigned int id);
 	void sendFromText();
 	void sendToRepeaters(CHeaderData &header) const;
 	void sendToRepeaters(CAMBEData &data) const;
 	void sendAck(const int index, const std::string &user, const std::string &text) const;
+	void recordLatency(const CAMBEData &data);
 	void logUser(LOGUSER lu, const std::string channel, const std::string user);
 };
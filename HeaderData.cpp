@@ -20,11 +20,22 @@
 #include <ctime>
 #include <cstdlib>
 #include <cassert>
+#include <cstdio>
 #include <cstring>
 #include "HeaderData.h"
 
 #include "CCITTChecksum.h"
 #include "Utils.h"
+#include "Log.h"
+
+// a bad header is logged as hex on one line, so a flood of them can be rate limited
+static void checksumFailure(const char *source, const unsigned char *header)
+{
+	char hex[2U * RADIO_HEADER_LENGTH_BYTES + 1U];
+	for (unsigned int i=0U; i<RADIO_HEADER_LENGTH_BYTES; i++)
+		snprintf(hex + 2U * i, 3U, "%02X", header[i]);
+	LOG(LL_WARNING, "Header checksum failure", "from=%s header=%s", source, hex);
+}
 
 void CHeaderData::initialise()
 {
@@ -173,7 +184,7 @@ bool CHeaderData::setG2Data(const unsigned char *data, unsigned int length, bool
 		bool valid = cksum.check(data + 15U + RADIO_HEADER_LENGTH_BYTES - 2U);
 
 		if (!valid)
-			dump("Header checksum failure from G2", data + 15U, RADIO_HEADER_LENGTH_BYTES);
+			checksumFailure("G2", data + 15U);
 
 		return valid;
 	} else {
@@ -211,7 +222,7 @@ bool CHeaderData::setDExtraData(const unsigned char *data, unsigned int length,
 		bool valid = cksum.check(data + 15U + RADIO_HEADER_LENGTH_BYTES - 2U);
 
 		if (!valid)
-			dump("Header checksum failure from DExtra", data + 15U, RADIO_HEADER_LENGTH_BYTES);
+			checksumFailure("DExtra", data + 15U);
 
 		return valid;
 	} else {
@@ -240,7 +251,7 @@ bool CHeaderData::setDVTOOLData(const unsigned char *data, unsigned int length,
 		bool valid = cksum.check(data + RADIO_HEADER_LENGTH_BYTES - 2U);
 
 		if (!valid)
-			dump("Header checksum failure from DVTOOL", data, RADIO_HEADER_LENGTH_BYTES);
+			checksumFailure("DVTOOL", data);
 
 		return valid;
 	} else {
@@ -38,7 +38,8 @@ bool IRCClient::startWork()
 void IRCClient::stopWork()
 {
 	terminateThread = true;
-    client_thread.get();
+	if (client_thread.valid())
+		client_thread.get();
 }
 
 #define MAXIPV4ADDR 10
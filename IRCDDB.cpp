@@ -29,6 +29,7 @@ CIRCDDB::CIRCDDB(const std::string& hostName, unsigned int port, const std::stri
 	std::string update_channel("#dstar");
 	app = new IRCDDBApp(update_channel, &cache);
 	client = new IRCClient(app, update_channel, hostName, port, callsign, password, versionInfo);
+	app->registerMetrics(CMetrics::label("server", hostName));
 }
 
 CIRCDDB::~CIRCDDB()
@@ -27,7 +27,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "IRCDDBApp.h"
 #include "Utils.h"
 
-IRCDDBApp::IRCDDBApp(const std::string &u_chan, CCacheManager *cache)
+#define FIND_TIMEOUT 30	// seconds before an unanswered FIND is counted as a timeout
+
+IRCDDBApp::IRCDDBApp(const std::string &u_chan, CCacheManager *cache) :
+findSeconds({ 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 })
 {
 	this->cache = cache;
 	maxTime = ((time_t)950000000);	//februray 2000
@@ -51,6 +54,7 @@ IRCDDBApp::IRCDDBApp(const std::string &u_chan, CCacheManager *cache)
 
 IRCDDBApp::~IRCDDBApp()
 {
+	CMetrics::remove(this);
 	delete sendQ;
 }
 
@@ -152,7 +156,8 @@ void IRCDDBApp::startWork()
 void IRCDDBApp::stopWork()
 {
     terminateThread = true;
-	m_future.get();
+	if (m_future.valid())
+		m_future.get();
 }
 
 void IRCDDBApp::userJoin(const std::string &nick, const std::string &name, const std::string &addr)
@@ -293,11 +298,39 @@ bool IRCDDBApp::findUser(const std::string &usrCall)
 		IRCMessage *m = new IRCMessage(srv, std::string("FIND ") + usr );
 
 		q->putMessage(m);
+
+		const auto now = std::chrono::steady_clock::now();
+		std::lock_guard<std::mutex> lock(pendingFindsMutex);
+		for (auto it=pendingFinds.begin(); it!=pendingFinds.end(); ) {
+			if (now - it->second > std::chrono::seconds(FIND_TIMEOUT)) {
+				findTimeouts.add();
+				it = pendingFinds.erase(it);
+			} else
+				it++;
+		}
+		pendingFinds.insert(std::make_pair(usr, now));	// a repeated FIND keeps the first time
 	}
 
 	return true;
 }
 
+void IRCDDBApp::foundUser(const std::string &usr)
+{
+	std::lock_guard<std::mutex> lock(pendingFindsMutex);
+	auto it = pendingFinds.find(usr);
+	if (it != pendingFinds.end()) {
+		findSeconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - it->second).count());
+		pendingFinds.erase(it);
+	}
+}
+
+void IRCDDBApp::registerMetrics(const std::string &labels)
+{
+	CMetrics::add(this, "sgs_ircddb_find_seconds", labels, &findSeconds);
+	CMetrics::add(this, "sgs_ircddb_find_timeouts_total", labels, &findTimeouts);
+	cache->registerMetrics(labels);
+}
+
 void IRCDDBApp::msgChannel(IRCMessage *m)
 {
 	if (0==m->getPrefixNick().compare(0, 2, "s-") && m->numParams >= 2)  // server msg
@@ -411,6 +444,7 @@ void IRCDDBApp::doUpdate(std::string &msg)
 						maxTime = rtime;
 				}
 			} else if ((tableID == 0) && initReady) {
+				foundUser(key);
 				std::string user(key);
 				std::string rptr(value);
 
@@ -477,6 +511,7 @@ void IRCDDBApp::msgQuery(IRCMessage *m)
 			doNotFound(restOfLine, callsign);
 
 			if (callsign.size() > 0) {
+				foundUser(callsign);
 				ReplaceChar(callsign, '_', ' ');
 				findUser(callsign);
 			}
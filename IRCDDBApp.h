@@ -27,10 +27,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 #include <regex>
 #include <map>
+#include <mutex>
+#include <chrono>
 
 #include "IRCDDB.h"
 #include "IRCMessageQueue.h"
 #include "CacheManager.h"
+#include "Metrics.h"
 
 class IRCDDBApp
 {
@@ -61,6 +64,9 @@ public:
 
 	bool findUser(const std::string& s);
 
+	// FIND latency and the cache, labeled with the server
+	void registerMetrics(const std::string &labels);
+
 	bool sendHeard(const std::string &myCall, const std::string &myCallExt, const std::string &yourCall, const std::string &rpt1, const std::string &rpt2, unsigned char flag1, unsigned char flag2, unsigned char flag3, const std::string &destination, const std::string &tx_msg, const std::string &tx_stats);
 
 	int getConnectionState();
@@ -77,6 +83,7 @@ protected:
 private:
 	void doUpdate(std::string& msg);
 	void doNotFound(std::string &msg, std::string &retval);
+	void foundUser(const std::string &usr);
 	bool findServerUser();
 	std::string getLastEntryTime(int tableID);
 	time_t m_maxTime;
@@ -107,4 +114,9 @@ private:
 	std::mutex moduleQTHURLMutex;
 	std::map<std::string, std::string> moduleWD;
 	std::mutex moduleWDMutex;
+	// FINDs waiting for an answer, keyed by the callsign as it was sent
+	std::map<std::string, std::chrono::steady_clock::time_point> pendingFinds;
+	std::mutex pendingFindsMutex;
+	CMetricHistogram findSeconds;
+	CMetric findTimeouts;
 };
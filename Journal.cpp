@@ -0,0 +1,182 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Journal.h"
+
+// the journal is emptied when it has this many more records than there are users
+#define JOURNAL_COMPACT_RECORDS 10000U
+
+std::string CJournal::m_file;
+int CJournal::m_fd = -1;
+std::mutex CJournal::m_mutex;
+std::condition_variable CJournal::m_wake;
+std::vector<std::string> CJournal::m_queue;
+std::future<void> CJournal::m_thread;
+bool CJournal::m_running = false;
+std::map<std::string, time_t> CJournal::m_users;
+unsigned int CJournal::m_records = 0U;
+CMetric CJournal::m_written;
+CMetric CJournal::m_compactions;
+
+void CJournal::open(const std::string &file, std::vector<CJournalEntry> &entries)
+{
+	m_file.assign(file);
+	m_users.clear();
+	m_records = 0U;
+	load(m_file + ".snapshot");
+	m_records = 0U;
+	load(m_file);
+	for (auto it=m_users.begin(); it!=m_users.end(); it++) {
+		const auto tab = it->first.find('\t');
+		CJournalEntry entry;
+		entry.group.assign(it->first.substr(0, tab));
+		entry.user.assign(it->first.substr(tab + 1));
+		entry.active = it->second;
+		entries.push_back(entry);
+	}
+
+	m_fd = ::open(m_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (m_fd < 0) {
+		fprintf(stderr, "Can't open the journal %s: %s\n", m_file.c_str(), strerror(errno));
+		return;
+	}
+	printf("Journaling the Smart Group users to %s\n", m_file.c_str());
+
+	CMetrics::add(&m_written, "sgs_journal_records_total", "", &m_written);
+	CMetrics::add(&m_written, "sgs_journal_compactions_total", "", &m_compactions);
+
+	m_running = true;
+	m_thread = std::async(std::launch::async, &CJournal::run);
+}
+
+void CJournal::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (! m_running)
+			return;
+		m_running = false;
+	}
+	m_wake.notify_all();
+	m_thread.get();
+
+	CMetrics::remove(&m_written);
+	::close(m_fd);
+	m_fd = -1;
+}
+
+void CJournal::record(bool logon, const std::string &group, const std::string &user, time_t when)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (! m_running)
+		return;
+
+	char epoch[24];
+	snprintf(epoch, sizeof(epoch), "%ld", long(when ? when : time(NULL)));
+	m_queue.push_back(std::string(logon ? "on\t" : "off\t") + group + "\t" + user + "\t" + epoch);
+}
+
+void CJournal::run()
+{
+	std::vector<std::string> records;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_wake.wait_for(lock, std::chrono::seconds(1));
+		const bool running = m_running;
+		records.swap(m_queue);
+		lock.unlock();
+
+		if (records.size()) {
+			write(records);
+			for (auto it=records.begin(); it!=records.end(); it++)
+				apply(*it);
+			m_written.add(records.size());
+			records.clear();
+			// not on the last pass, the new server may already be appending to it after an upgrade
+			if (running && m_records > JOURNAL_COMPACT_RECORDS + m_users.size())
+				compact();
+		}
+
+		lock.lock();
+		if (! running)
+			return;
+	}
+}
+
+// each line is "on" or "off", the group, the user and when, separated by tabs
+void CJournal::load(const std::string &file)
+{
+	std::ifstream in(file);
+	std::string line;
+	while (std::getline(in, line))
+		apply(line);
+}
+
+void CJournal::apply(const std::string &record)
+{
+	const auto group = record.find('\t');
+	const auto when = record.rfind('\t');
+	if (record.npos == group || group == when)
+		return;
+
+	m_records++;
+	const std::string key(record.substr(group + 1, when - group - 1));
+	if (0 == record.compare(0, group, "on"))
+		m_users[key] = time_t(strtol(record.c_str() + when + 1, NULL, 10));
+	else
+		m_users.erase(key);
+}
+
+// the records are synced together, a crash loses no more than the last second
+void CJournal::write(const std::vector<std::string> &records)
+{
+	std::string text;
+	for (auto it=records.begin(); it!=records.end(); it++)
+		text.append(*it).append("\n");
+
+	if (::write(m_fd, text.data(), text.size()) != ssize_t(text.size()) || fdatasync(m_fd))
+		fprintf(stderr, "Can't write to the journal %s: %s\n", m_file.c_str(), strerror(errno));
+}
+
+// a crash before the journal is emptied just means its records are read again, over the snapshot
+void CJournal::compact()
+{
+	const std::string snapshot(m_file + ".snapshot"), temp(snapshot + ".tmp");
+	FILE *fp = fopen(temp.c_str(), "w");
+	if (NULL == fp) {
+		fprintf(stderr, "Can't write the journal snapshot %s: %s\n", temp.c_str(), strerror(errno));
+		return;
+	}
+	for (auto it=m_users.begin(); it!=m_users.end(); it++)
+		fprintf(fp, "on\t%s\t%ld\n", it->first.c_str(), long(it->second));
+	bool failed = fflush(fp) || fsync(fileno(fp));
+	failed = fclose(fp) || failed;
+	if (failed || rename(temp.c_str(), snapshot.c_str()) || ftruncate(m_fd, 0)) {
+		fprintf(stderr, "Can't compact the journal %s: %s\n", m_file.c_str(), strerror(errno));
+		return;
+	}
+	m_records = 0U;
+	m_compactions.add();
+}
@@ -0,0 +1,72 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+
+#include "Metrics.h"
+
+class CJournalEntry {
+public:
+	std::string group;
+	std::string user;
+	time_t      active;		// the user's last header
+};
+
+// Keeps the users of the Smart Groups across a restart, or a crash. Each
+// logon, header and logoff is queued by the routing thread, and a thread
+// appends the queue to the journal and syncs it once a second. When the
+// journal has many more records than there are users, the users are written
+// to a snapshot next to it and the journal is emptied. At the next start the
+// snapshot and the journal are read back, and the users that haven't timed
+// out are put back in their groups.
+class CJournal {
+public:
+	// reads the snapshot and the journal into entries, the users that were logged on when it was last written, then starts the thread
+	static void open(const std::string &file, std::vector<CJournalEntry> &entries);
+	// writes what is queued, then stops the thread, without emptying the journal, which another server may have open
+	static void close();
+
+	// logon is true for a logon, or a header from a user who is logged on, at when, or now if it's 0
+	static void record(bool logon, const std::string &group, const std::string &user, time_t when = 0);
+
+private:
+	static void run();
+	static void load(const std::string &file);
+	static void apply(const std::string &record);
+	static void write(const std::vector<std::string> &records);
+	static void compact();
+
+	static std::string m_file;
+	static int m_fd;
+	static std::mutex m_mutex;		// for m_queue and m_running
+	static std::condition_variable m_wake;
+	static std::vector<std::string> m_queue;
+	static std::future<void> m_thread;
+	static bool m_running;
+	static std::map<std::string, time_t> m_users;	// by group and user, only used by the thread once it has started
+	static unsigned int m_records;	// in the journal since it was last emptied
+	static CMetric m_written, m_compactions;
+};
@@ -0,0 +1,98 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "Keepalive.h"
+
+#define KEEPALIVE_INTERVAL_MS 10000UL
+
+CG2ProtocolHandler *CKeepalive::m_g2Handler[2] = { NULL, NULL };
+std::mutex CKeepalive::m_mutex;
+std::list<CKeepalive::CEntry> CKeepalive::m_entries;
+std::unordered_map<std::string, std::list<CKeepalive::CEntry>::iterator> CKeepalive::m_index;
+std::list<CKeepalive::CEntry>::iterator CKeepalive::m_next = CKeepalive::m_entries.end();
+unsigned long CKeepalive::m_now = 0UL;
+unsigned long CKeepalive::m_credit = 0UL;
+CMetric CKeepalive::m_pings;
+
+void CKeepalive::open(CG2ProtocolHandler *handler0, CG2ProtocolHandler *handler1)
+{
+	m_g2Handler[0] = handler0;
+	m_g2Handler[1] = handler1;
+	m_next = m_entries.end();
+	m_now = m_credit = 0UL;
+	CMetrics::add(&m_pings, "sgs_keepalive_pings_total", "", &m_pings);
+	CMetrics::add(&m_pings, "sgs_keepalive_addresses", "", []() { std::lock_guard<std::mutex> lock(m_mutex); return double(m_entries.size()); });
+}
+
+void CKeepalive::close()
+{
+	CMetrics::remove(&m_pings);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_index.clear();
+	m_entries.clear();
+	m_next = m_entries.end();
+}
+
+void CKeepalive::want(const std::string &address)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_index.find(address);
+	if (m_index.end() != it) {
+		it->second->wanted = m_now;
+		return;
+	}
+
+	// a new address goes just behind the cursor, so it waits a whole interval like the rest
+	CEntry entry;
+	entry.address.assign(address);
+	entry.wanted = m_now;
+	m_index[address] = m_entries.insert(m_next, entry);
+}
+
+void CKeepalive::clock(unsigned int ms)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_now += ms;
+
+	// each address is owed one ping an interval
+	m_credit += ms * m_entries.size();
+	while (m_credit >= KEEPALIVE_INTERVAL_MS && ! m_entries.empty()) {
+		m_credit -= KEEPALIVE_INTERVAL_MS;
+		if (m_entries.end() == m_next)
+			m_next = m_entries.begin();
+
+		if (m_now - m_next->wanted > 2UL * KEEPALIVE_INTERVAL_MS) {	// none of the groups want it any more
+			m_index.erase(m_next->address);
+			m_next = m_entries.erase(m_next);
+			continue;
+		}
+		ping(m_next->address);
+		m_next++;
+	}
+	if (m_entries.empty())
+		m_credit = 0UL;
+}
+
+void CKeepalive::ping(const std::string &address)
+{
+	if (address.npos != address.find('.') && m_g2Handler[1])	// an IPv4 address on a dual stack server
+		m_g2Handler[1]->writePing(address);
+	else
+		m_g2Handler[0]->writePing(address);	// it's either an IPv6 address, or we are single stack
+	m_pings.add();
+}
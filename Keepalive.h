@@ -0,0 +1,63 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+#include "G2ProtocolHandler.h"
+#include "Metrics.h"
+
+// Pings the address of every subscribed user once each interval, so the
+// NAT in front of a hotspot keeps its port open. The groups say which
+// addresses they want pinged, and an address wanted by several groups is
+// pinged only once. The pings are spread evenly over the interval, a few on
+// each pass of the routing loop, instead of all at once. The groups ask from
+// their workers, so the list is locked.
+class CKeepalive {
+public:
+	static void open(CG2ProtocolHandler *handler0, CG2ProtocolHandler *handler1);
+	static void close();
+
+	// address needs pinging, until no group has asked for it for two intervals
+	static void want(const std::string &address);
+
+	// sends the pings due in the last ms milliseconds
+	static void clock(unsigned int ms);
+
+private:
+	class CEntry {
+	public:
+		std::string address;
+		unsigned long wanted;	// when a group last asked for it
+	};
+
+	static void ping(const std::string &address);
+
+	static CG2ProtocolHandler *m_g2Handler[2];
+	static std::mutex m_mutex;
+	static std::list<CEntry> m_entries;	// in the order they are pinged
+	static std::unordered_map<std::string, std::list<CEntry>::iterator> m_index;
+	static std::list<CEntry>::iterator m_next;
+	static unsigned long m_now;		// ms since open()
+	static unsigned long m_credit;	// ms times the number of addresses, owed in pings
+	static CMetric m_pings;
+};
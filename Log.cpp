@@ -0,0 +1,194 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <ctime>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <strings.h>
+#include <thread>
+#include <chrono>
+
+#include "Log.h"
+
+#define LOG_SITE_LIMIT 10		// messages a second from one LOG()
+#define WRITER_SLEEP_MS 10
+
+static const char *levelNames[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+std::atomic<LOG_LEVEL> CLog::m_level(LL_INFO);
+std::atomic<bool>      CLog::m_running(false);
+std::future<void>      CLog::m_future;
+CLog::CCell            CLog::m_ring[RING_SIZE];
+std::atomic<uint64_t>  CLog::m_head(0U);
+std::atomic<uint64_t>  CLog::m_tail(0U);
+CMetric                CLog::m_dropped;
+CMetric                CLog::m_suppressed;
+
+bool CLogSite::allow(uint64_t second, unsigned int &suppressed)
+{
+	uint64_t was = m_second.load(std::memory_order_relaxed);
+	if (was != second && m_second.compare_exchange_strong(was, second, std::memory_order_relaxed))
+		m_count.store(0U, std::memory_order_relaxed);
+
+	if (m_count.fetch_add(1U, std::memory_order_relaxed) >= LOG_SITE_LIMIT) {
+		m_suppressed.fetch_add(1U, std::memory_order_relaxed);
+		return false;
+	}
+	suppressed = m_suppressed.exchange(0U, std::memory_order_relaxed);
+	return true;
+}
+
+bool CLog::parseLevel(const std::string &name, LOG_LEVEL &level)
+{
+	for (int i=LL_DEBUG; i<=LL_ERROR; i++) {
+		if (0 == strcasecmp(name.c_str(), levelNames[i])) {
+			level = LOG_LEVEL(i);
+			return false;
+		}
+	}
+	return true;
+}
+
+void CLog::open()
+{
+	if (m_running)
+		return;
+	for (unsigned int i=0; i<RING_SIZE; i++)
+		m_ring[i].sequence.store(i, std::memory_order_relaxed);
+	m_head = m_tail = 0U;
+	CMetrics::add(&m_dropped, "sgs_log_dropped_total", "", &m_dropped);
+	CMetrics::add(&m_dropped, "sgs_log_suppressed_total", "", &m_suppressed);
+	m_running = true;
+	m_future = std::async(std::launch::async, &CLog::Run);
+}
+
+void CLog::close()
+{
+	if (m_running) {
+		m_running = false;
+		m_future.get();
+		CMetrics::remove(&m_dropped);
+	}
+}
+
+void CLog::write(CLogSite &site, LOG_LEVEL level, const char *message, const char *format, ...)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	unsigned int suppressed;
+	if (! site.allow(ts.tv_sec, suppressed)) {
+		m_suppressed.add();
+		return;
+	}
+
+	char line[LINE_SIZE];
+	int len = snprintf(line, LINE_SIZE, "%s %s", levelNames[level], message);
+	if (len > 0 && len < int(LINE_SIZE) - 1 && *format) {
+		line[len++] = ' ';
+		va_list args;
+		va_start(args, format);
+		int n = vsnprintf(line + len, LINE_SIZE - len, format, args);
+		va_end(args);
+		if (n > 0)
+			len += n;
+	}
+	if (suppressed && len > 0 && len < int(LINE_SIZE))
+		snprintf(line + len, LINE_SIZE - len, " suppressed=%u", suppressed);
+
+	if (! m_running)
+		output(level, line);
+	else if (push(level, line))
+		m_dropped.add();
+}
+
+// returns true if the ring is full
+bool CLog::push(LOG_LEVEL level, const char *line)
+{
+	uint64_t pos = m_head.load(std::memory_order_relaxed);
+	CCell *cell;
+	while (true) {
+		cell = &m_ring[pos & (RING_SIZE - 1U)];
+		const uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+		const int64_t diff = int64_t(seq) - int64_t(pos);
+		if (0 == diff) {
+			if (m_head.compare_exchange_weak(pos, pos + 1U, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0)
+			return true;
+		else
+			pos = m_head.load(std::memory_order_relaxed);
+	}
+
+	cell->level = level;
+	strncpy(cell->line, line, LINE_SIZE - 1U);
+	cell->line[LINE_SIZE - 1U] = '\0';
+	cell->sequence.store(pos + 1U, std::memory_order_release);
+	return false;
+}
+
+// only the writer thread pops, returns false if nothing is ready
+bool CLog::pop(LOG_LEVEL &level, char *line)
+{
+	const uint64_t pos = m_tail.load(std::memory_order_relaxed);
+	CCell &cell = m_ring[pos & (RING_SIZE - 1U)];
+	if (cell.sequence.load(std::memory_order_acquire) != pos + 1U)
+		return false;
+
+	level = LOG_LEVEL(cell.level);
+	memcpy(line, cell.line, LINE_SIZE);
+	m_tail.store(pos + 1U, std::memory_order_relaxed);
+	cell.sequence.store(pos + RING_SIZE, std::memory_order_release);
+	return true;
+}
+
+void CLog::output(LOG_LEVEL level, const char *line)
+{
+	FILE *fp = (LL_ERROR == level) ? stderr : stdout;
+	fprintf(fp, "%s\n", line);
+}
+
+void CLog::Run()
+{
+	long reported = 0L;
+	char line[LINE_SIZE];
+	LOG_LEVEL level;
+	while (true) {
+		const bool running = m_running;	// read first, so nothing pushed before close() is missed
+		bool wrote = false;
+		while (pop(level, line)) {
+			output(level, line);
+			wrote = true;
+		}
+
+		const long dropped = m_dropped.get();
+		if (dropped > reported) {
+			fprintf(stderr, "WARNING Log lines dropped count=%ld\n", dropped - reported);
+			reported = dropped;
+		}
+
+		if (! running)
+			break;
+		if (wrote) {
+			fflush(stdout);
+			fflush(stderr);
+		} else
+			std::this_thread::sleep_for(std::chrono::milliseconds(WRITER_SLEEP_MS));
+	}
+	fflush(stdout);
+}
@@ -0,0 +1,106 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <future>
+
+#include "Metrics.h"
+
+enum LOG_LEVEL {
+	LL_DEBUG,
+	LL_INFO,
+	LL_WARNING,
+	LL_ERROR
+};
+
+// Where a LOG() is, and how often it has been used lately. Each site may
+// log LOG_SITE_LIMIT messages a second; the rest are counted, and the count
+// is added to the next message from the site that gets through.
+class CLogSite {
+public:
+	CLogSite(const char *file, int line) : m_file(file), m_line(line), m_second(0U), m_count(0U), m_suppressed(0U) {}
+
+	// false if this message is over the limit, otherwise how many were suppressed before it
+	bool allow(uint64_t second, unsigned int &suppressed);
+
+	const char *m_file;
+	const int m_line;
+
+private:
+	std::atomic<uint64_t> m_second;
+	std::atomic<unsigned int> m_count;
+	std::atomic<unsigned int> m_suppressed;
+};
+
+// A logger for the routing path. LOG() formats the line on the calling
+// thread and puts it on a lock-free ring, and a writer thread empties the
+// ring to stdout, or stderr for errors, so a slow terminal or journal never
+// holds up routing. If the ring is full the line is dropped and counted.
+// Before open() and after close() lines are written straight away.
+//
+// Every line is the level, a fixed message and then key=value fields:
+//   LOG(LL_INFO, "User added", "user=\"%s\" group=\"%s\"", user.c_str(), group.c_str());
+#define LOG(level, message, ...) \
+	do { \
+		static CLogSite logSite(__FILE__, __LINE__); \
+		if (CLog::isEnabled(level)) \
+			CLog::write(logSite, level, message, __VA_ARGS__); \
+	} while (0)
+
+class CLog {
+public:
+	static void setLevel(LOG_LEVEL level) { m_level = level; }
+	static bool isEnabled(LOG_LEVEL level) { return level >= m_level; }
+	// "debug", "info", "warning" or "error", returns true if it isn't one of them
+	static bool parseLevel(const std::string &name, LOG_LEVEL &level);
+
+	// starts and stops the writer thread
+	static void open();
+	static void close();
+
+	static void write(CLogSite &site, LOG_LEVEL level, const char *message, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+private:
+	static const unsigned int RING_SIZE = 1024U;		// a power of two
+	static const unsigned int LINE_SIZE = 240U;
+
+	class CCell {
+	public:
+		std::atomic<uint64_t> sequence;
+		uint8_t level;
+		char line[LINE_SIZE];
+	};
+
+	static bool push(LOG_LEVEL level, const char *line);
+	static bool pop(LOG_LEVEL &level, char *line);
+	static void output(LOG_LEVEL level, const char *line);
+	static void Run();
+
+	static std::atomic<LOG_LEVEL> m_level;
+	static std::atomic<bool> m_running;
+	static std::future<void> m_future;
+	static CCell m_ring[RING_SIZE];
+	static std::atomic<uint64_t> m_head;	// the next cell to write
+	static std::atomic<uint64_t> m_tail;	// the next cell to read
+	static CMetric m_dropped;
+	static CMetric m_suppressed;
+};
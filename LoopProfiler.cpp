@@ -0,0 +1,159 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "LoopProfiler.h"
+
+static const char *phaseNames[LP_COUNT] = { "ircddb", "g2", "dextra", "dcs", "remote", "group_clock", "dextra_clock", "dcs_clock", "federation" };
+
+uint64_t CLoopProfiler::m_budget = 0U;
+uint64_t CLoopProfiler::m_start = 0U;
+uint64_t CLoopProfiler::m_last = 0U;
+uint64_t CLoopProfiler::m_current[LP_COUNT];
+uint64_t CLoopProfiler::m_max[LP_COUNT];
+std::atomic<uint64_t> CLoopProfiler::m_totalNs[LP_COUNT];
+CLatencyHistogram CLoopProfiler::m_phaseUs[LP_COUNT];
+CMetric CLoopProfiler::m_passes;
+CMetric CLoopProfiler::m_overruns;
+CLoopProfiler::CSample CLoopProfiler::m_ring[RING_SIZE];
+unsigned int CLoopProfiler::m_ringNext = 0U;
+CLoopProfiler::CSample CLoopProfiler::m_worst;
+
+const char *CLoopProfiler::getName(LOOP_PHASE phase)
+{
+	return (phase < LP_COUNT) ? phaseNames[phase] : "unknown";
+}
+
+void CLoopProfiler::open(unsigned int budgetMs)
+{
+	m_budget = 1000000ULL * budgetMs;
+	memset(m_current, 0, sizeof(m_current));
+	memset(m_max, 0, sizeof(m_max));
+	memset(m_ring, 0, sizeof(m_ring));
+	memset(&m_worst, 0, sizeof(m_worst));
+	m_ringNext = 0U;
+	for (int i=0; i<LP_COUNT; i++) {
+		m_totalNs[i] = 0U;
+		const std::string label(CMetrics::label("phase", phaseNames[i]));
+		m_phaseUs[i].addTo(&m_passes, "sgs_loop_phase_seconds", label);
+		std::atomic<uint64_t> *total = &m_totalNs[i];
+		CMetrics::add(&m_passes, "sgs_loop_phase_seconds_total", label, [total]() { return total->load(std::memory_order_relaxed) / 1.0e9; });
+	}
+	CMetrics::add(&m_passes, "sgs_loop_passes_total", "", &m_passes);
+	CMetrics::add(&m_passes, "sgs_loop_overruns_total", "", &m_overruns);
+}
+
+void CLoopProfiler::close()
+{
+	CMetrics::remove(&m_passes);
+}
+
+uint64_t CLoopProfiler::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+void CLoopProfiler::start()
+{
+	m_start = m_last = now();
+}
+
+void CLoopProfiler::mark(LOOP_PHASE phase)
+{
+	const uint64_t t = now();
+	m_current[phase] += t - m_last;
+	m_last = t;
+}
+
+uint64_t CLoopProfiler::end()
+{
+	const uint64_t total = m_last - m_start;
+	for (int i=0; i<LP_COUNT; i++) {
+		m_phaseUs[i].record(m_current[i] / 1000U);
+		m_totalNs[i].fetch_add(m_current[i], std::memory_order_relaxed);
+		if (m_current[i] > m_max[i])
+			m_max[i] = m_current[i];
+	}
+	m_passes.add();
+
+	if (total > m_budget || total > m_worst.total) {
+		CSample sample;
+		sample.when = time(NULL);
+		sample.total = total;
+		memcpy(sample.phase, m_current, sizeof(m_current));
+		if (total > m_worst.total)
+			m_worst = sample;
+		if (total > m_budget) {
+			m_overruns.add();
+			m_ring[m_ringNext] = sample;
+			m_ringNext = (m_ringNext + 1U) % RING_SIZE;
+		}
+	}
+
+	memset(m_current, 0, sizeof(m_current));
+	return total;
+}
+
+static void appendSample(std::string &json, time_t when, uint64_t total, const uint64_t *phase)
+{
+	char num[64];
+	snprintf(num, 64, "{\"time\":%ld,\"total_us\":%lu,\"phases_us\":{", (long)when, (unsigned long)(total / 1000U));
+	json.append(num);
+	for (int i=0; i<LP_COUNT; i++) {
+		snprintf(num, 64, "%s\"%s\":%lu", i ? "," : "", phaseNames[i], (unsigned long)(phase[i] / 1000U));
+		json.append(num);
+	}
+	json.append("}}");
+}
+
+std::string CLoopProfiler::json()
+{
+	char num[256];
+	snprintf(num, 256, "{\"type\":\"profile\",\"time\":%ld,\"budget_us\":%lu,\"passes\":%ld,\"overruns\":%ld,\"phases\":[",
+		(long)time(NULL), (unsigned long)(m_budget / 1000U), m_passes.get(), m_overruns.get());
+	std::string json(num);
+
+	for (int i=0; i<LP_COUNT; i++) {
+		const CLatencyHistogram &h = m_phaseUs[i];
+		snprintf(num, 256, "%s{\"phase\":\"%s\",\"p50_us\":%lu,\"p99_us\":%lu,\"p999_us\":%lu,\"max_us\":%lu,\"total_ms\":%lu}", i ? "," : "", phaseNames[i],
+			h.percentile(0.5), h.percentile(0.99), h.percentile(0.999), (unsigned long)(m_max[i] / 1000U), (unsigned long)(m_totalNs[i].load(std::memory_order_relaxed) / 1000000U));
+		json.append(num);
+	}
+
+	json.append("],\"worst\":");
+	appendSample(json, m_worst.when, m_worst.total, m_worst.phase);
+
+	// newest first
+	json.append(",\"overrun_passes\":[");
+	bool first = true;
+	for (unsigned int n=1U; n<=RING_SIZE; n++) {
+		const CSample &s = m_ring[(m_ringNext + RING_SIZE - n) % RING_SIZE];
+		if (0U == s.total)
+			break;
+		if (! first)
+			json.push_back(',');
+		first = false;
+		appendSample(json, s.when, s.total, s.phase);
+	}
+	json.append("]}");
+	return json;
+}
@@ -0,0 +1,86 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <ctime>
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+#include "Metrics.h"
+
+enum LOOP_PHASE {
+	LP_IRCDDB,
+	LP_G2,
+	LP_DEXTRA,
+	LP_DCS,
+	LP_REMOTE,
+	LP_GROUP_CLOCK,
+	LP_DEXTRA_CLOCK,
+	LP_DCS_CLOCK,
+	LP_FEDERATION,
+	LP_COUNT
+};
+
+// Times each phase of a pass of the routing loop with CLOCK_MONOTONIC_RAW.
+// start() begins a pass, mark() charges the time since the last call to a
+// phase and end() finishes the pass. A pass that takes longer than the
+// budget is an overrun; it is counted and kept, with its phases, in a ring
+// of the most recent overruns. Everything but the metrics is only touched
+// by the routing thread, which is also where the remote commands are run.
+class CLoopProfiler {
+public:
+	static void open(unsigned int budgetMs);
+	static void close();
+
+	static void start();
+	static void mark(LOOP_PHASE phase);
+	// returns the length of the pass in nanoseconds
+	static uint64_t end();
+
+	// the phase statistics and the recent overruns as one line of JSON
+	static std::string json();
+
+	static const char *getName(LOOP_PHASE phase);
+
+private:
+	static const unsigned int RING_SIZE = 32U;
+
+	class CSample {
+	public:
+		time_t   when;
+		uint64_t total;
+		uint64_t phase[LP_COUNT];
+	};
+
+	static uint64_t now();
+
+	static uint64_t m_budget;
+	static uint64_t m_start;
+	static uint64_t m_last;
+	static uint64_t m_current[LP_COUNT];
+	static uint64_t m_max[LP_COUNT];
+	static std::atomic<uint64_t> m_totalNs[LP_COUNT];
+	static CLatencyHistogram m_phaseUs[LP_COUNT];
+	static CMetric m_passes;
+	static CMetric m_overruns;
+	static CSample m_ring[RING_SIZE];
+	static unsigned int m_ringNext;
+	static CSample m_worst;
+};
@@ -0,0 +1,311 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include "Metrics.h"
+
+std::mutex            CMetrics::m_mutex;
+std::list<CMetrics::CEntry> CMetrics::m_entries;
+
+// the type and help text for each metric name
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} families[] = {
+	{ "sgs_udp_rx_packets_total",     "counter",   "UDP packets received on a socket" },
+	{ "sgs_udp_rx_bytes_total",       "counter",   "UDP bytes received on a socket" },
+	{ "sgs_udp_tx_packets_total",     "counter",   "UDP packets sent from a socket" },
+	{ "sgs_udp_tx_bytes_total",       "counter",   "UDP bytes sent from a socket" },
+	{ "sgs_group_headers_total",      "counter",   "Voice headers received by a Smart Group" },
+	{ "sgs_group_frames_in_total",    "counter",   "Voice frames received by a Smart Group" },
+	{ "sgs_group_frames_out_total",   "counter",   "Voice frames sent by a Smart Group to its repeaters" },
+	{ "sgs_group_fanout",             "gauge",     "Repeaters the last header of a Smart Group was sent to" },
+	{ "sgs_group_users",              "gauge",     "Users logged on to a Smart Group" },
+	{ "sgs_group_repeater_updates_total", "counter", "Times a Smart Group looked up its users' repeaters again at the start of a stream" },
+	{ "sgs_group_collisions_total",   "counter",   "Streams that started on a Smart Group while another one had it, and weren't relayed" },
+	{ "sgs_group_preemptions_total",  "counter",   "Streams that lost a Smart Group to one with precedence under the arbitration policy" },
+	{ "sgs_group_contender_frames_total", "counter", "Voice frames of the streams a Smart Group wasn't relaying" },
+	{ "sgs_link_frames_in_total",     "counter",   "Voice frames received from a linked reflector" },
+	{ "sgs_link_frames_out_total",    "counter",   "Voice frames sent to a linked reflector" },
+	{ "sgs_ircddb_find_seconds",      "histogram", "Time from an ircDDB FIND to its answer" },
+	{ "sgs_ircddb_find_timeouts_total", "counter", "ircDDB FINDs that were never answered" },
+	{ "sgs_cache_lookups_total",      "counter",   "ircDDB cache lookups" },
+	{ "sgs_cache_entries",            "gauge",     "Entries in an ircDDB cache table" },
+	{ "sgs_cache_events_total",       "counter",   "Changes to where users are routed, put on the ring for the routing thread" },
+	{ "sgs_cache_event_overflows_total", "counter", "Changes lost because the ring for the routing thread was full" },
+	{ "sgs_group_relay_seconds",      "summary",   "Time from a voice frame arriving to the last copy of it being sent" },
+	{ "sgs_loop_seconds",             "histogram", "Time spent in one pass of the routing loop, not counting the sleep" },
+	{ "sgs_loop_phase_seconds",       "summary",   "Time spent in one phase of a pass of the routing loop" },
+	{ "sgs_loop_phase_seconds_total", "counter",   "Total time spent in one phase of the routing loop" },
+	{ "sgs_loop_passes_total",        "counter",   "Passes of the routing loop" },
+	{ "sgs_loop_overruns_total",      "counter",   "Passes of the routing loop that took longer than the tick" },
+	{ "sgs_worker_packets_total",     "counter",   "G2 and federation packets handled by a worker thread" },
+	{ "sgs_worker_dropped_total",     "counter",   "Packets dropped because a worker thread's queue was full" },
+	{ "sgs_worker_queue_depth",       "gauge",     "Packets waiting for a worker thread" },
+	{ "sgs_g2_reader_dropped_total",  "counter",   "G2 datagrams dropped because the routing thread had not taken the earlier ones" },
+	{ "sgs_keepalive_pings_total",    "counter",   "Keepalive pings sent to user addresses" },
+	{ "sgs_keepalive_addresses",      "gauge",     "Distinct user addresses being kept alive" },
+	{ "sgs_resolver_lookups_total",   "counter",   "Reflector host name lookups done" },
+	{ "sgs_resolver_failures_total",  "counter",   "Reflector host name lookups that found no address" },
+	{ "sgs_resolver_pending",         "gauge",     "Reflector host name lookups waiting or in progress" },
+	{ "sgs_journal_records_total",    "counter",   "Smart Group user records written to the journal" },
+	{ "sgs_journal_compactions_total", "counter",  "Times the journal was written to a snapshot and emptied" },
+	{ "sgs_replication_records_total", "counter",  "Records sent to the standby server" },
+	{ "sgs_replication_standby",      "gauge",     "1 while a standby server is connected" },
+	{ "sgs_replication_failover_seconds", "gauge", "From the last heartbeat of the active server to this one routing, when it took over" },
+	{ "sgs_federation_packets_total", "counter",   "Voice packets sent to, or received from, the peers sharing the Smart Groups" },
+	{ "sgs_federation_rejected_total", "counter",  "Datagrams on the federation port that weren't from a peer, or weren't voice packets" },
+	{ "sgs_log_dropped_total",        "counter",   "Log lines dropped because the log ring was full" },
+	{ "sgs_log_suppressed_total",     "counter",   "Log lines suppressed by the rate limit of their call site" },
+	{ NULL, NULL, NULL }
+};
+
+CMetricHistogram::CMetricHistogram(const std::vector<double> &bounds) :
+m_bounds(bounds),
+m_buckets(new std::atomic<unsigned long>[bounds.size() + 1]),
+m_count(0UL),
+m_sumus(0UL)
+{
+	for (unsigned int i=0; i<=m_bounds.size(); i++)
+		m_buckets[i] = 0UL;
+}
+
+void CMetricHistogram::observe(double seconds)
+{
+	unsigned int i = 0;
+	while (i < m_bounds.size() && seconds > m_bounds[i])
+		i++;
+	m_buckets[i].fetch_add(1UL, std::memory_order_relaxed);
+	m_count.fetch_add(1UL, std::memory_order_relaxed);
+	m_sumus.fetch_add((unsigned long)(seconds * 1.0e6 + 0.5), std::memory_order_relaxed);
+}
+
+void CMetricHistogram::render(std::string &out, const std::string &name, const std::string &labels) const
+{
+	const std::string sep(labels.empty() ? "" : ",");
+	char line[256];
+	unsigned long cumulative = 0UL;
+	for (unsigned int i=0; i<=m_bounds.size(); i++) {
+		cumulative += m_buckets[i].load(std::memory_order_relaxed);
+		if (i < m_bounds.size())
+			snprintf(line, 256, "%s_bucket{%s%sle=\"%g\"} %lu\n", name.c_str(), labels.c_str(), sep.c_str(), m_bounds[i], cumulative);
+		else
+			snprintf(line, 256, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name.c_str(), labels.c_str(), sep.c_str(), cumulative);
+		out.append(line);
+	}
+	const std::string braced(labels.empty() ? "" : "{" + labels + "}");
+	snprintf(line, 256, "%s_sum%s %.6f\n", name.c_str(), braced.c_str(), m_sumus.load(std::memory_order_relaxed) / 1.0e6);
+	out.append(line);
+	snprintf(line, 256, "%s_count%s %lu\n", name.c_str(), braced.c_str(), m_count.load(std::memory_order_relaxed));
+	out.append(line);
+}
+
+CLatencyHistogram::CLatencyHistogram() : m_count(0UL), m_sumus(0UL)
+{
+	for (unsigned int i=0; i<BUCKETS; i++)
+		m_buckets[i] = 0UL;
+}
+
+void CLatencyHistogram::record(unsigned long us)
+{
+	unsigned int index;
+	if (us < SUB_COUNT)
+		index = us;
+	else {
+		unsigned int bits = 63U - __builtin_clzl(us);	// us is in [2^bits, 2^(bits+1))
+		if (bits > MAX_BITS)
+			index = BUCKETS - 1U;
+		else
+			index = (bits - SUB_BITS + 1U) * SUB_COUNT + ((us >> (bits - SUB_BITS)) & (SUB_COUNT - 1U));
+	}
+	m_buckets[index].fetch_add(1UL, std::memory_order_relaxed);
+	m_count.fetch_add(1UL, std::memory_order_relaxed);
+	m_sumus.fetch_add(us, std::memory_order_relaxed);
+}
+
+unsigned long CLatencyHistogram::getCount() const
+{
+	return m_count.load(std::memory_order_relaxed);
+}
+
+unsigned long CLatencyHistogram::percentile(double q) const
+{
+	unsigned long count = getCount();
+	if (0UL == count)
+		return 0UL;
+	unsigned long target = (unsigned long)(q * count + 0.5);
+	if (target < 1UL)
+		target = 1UL;
+
+	unsigned long seen = 0UL;
+	unsigned int index = 0U;
+	for ( ; index<BUCKETS-1U; index++) {
+		seen += m_buckets[index].load(std::memory_order_relaxed);
+		if (seen >= target)
+			break;
+	}
+
+	if (index < SUB_COUNT)
+		return index;
+	// the middle of the bucket
+	const unsigned int shift = index / SUB_COUNT - 1U;
+	const unsigned long low = (unsigned long)(SUB_COUNT + index % SUB_COUNT) << shift;
+	return low + ((1UL << shift) >> 1);
+}
+
+void CLatencyHistogram::addTo(const void *owner, const std::string &name, const std::string &labels) const
+{
+	CMetrics::add(owner, name, labels, this);
+}
+
+void CLatencyHistogram::render(std::string &out, const std::string &name, const std::string &labels) const
+{
+	const std::string sep(labels.empty() ? "" : ",");
+	char line[256];
+	const struct { const char *label; double q; } quantiles[] = { { "0.5", 0.5 }, { "0.99", 0.99 }, { "0.999", 0.999 } };
+	for (auto &quantile : quantiles) {
+		snprintf(line, 256, "%s{%s%squantile=\"%s\"} %g\n", name.c_str(), labels.c_str(), sep.c_str(), quantile.label, percentile(quantile.q) / 1.0e6);
+		out.append(line);
+	}
+	const std::string braced(labels.empty() ? "" : "{" + labels + "}");
+	snprintf(line, 256, "%s_sum%s %.6f\n", name.c_str(), braced.c_str(), m_sumus.load(std::memory_order_relaxed) / 1.0e6);
+	out.append(line);
+	snprintf(line, 256, "%s_count%s %lu\n", name.c_str(), braced.c_str(), getCount());
+	out.append(line);
+}
+
+void CMetrics::add(const void *owner, const std::string &name, const std::string &labels, CMetric *metric)
+{
+	CEntry entry = { owner, name, labels, metric, NULL, NULL, nullptr };
+	add(entry);
+}
+
+void CMetrics::add(const void *owner, const std::string &name, const std::string &labels, CMetricHistogram *histogram)
+{
+	CEntry entry = { owner, name, labels, NULL, histogram, NULL, nullptr };
+	add(entry);
+}
+
+void CMetrics::add(const void *owner, const std::string &name, const std::string &labels, const CLatencyHistogram *latency)
+{
+	CEntry entry = { owner, name, labels, NULL, NULL, latency, nullptr };
+	add(entry);
+}
+
+void CMetrics::add(const void *owner, const std::string &name, const std::string &labels, std::function<double()> gauge)
+{
+	CEntry entry = { owner, name, labels, NULL, NULL, NULL, gauge };
+	add(entry);
+}
+
+void CMetrics::add(const CEntry &entry)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.push_back(entry);
+}
+
+void CMetrics::remove(const void *owner)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto it=m_entries.begin(); it!=m_entries.end(); ) {
+		if (it->owner == owner)
+			it = m_entries.erase(it);
+		else
+			it++;
+	}
+}
+
+std::string CMetrics::label(const std::string &key, const std::string &value)
+{
+	std::string out(key + "=\"");
+	for (auto it=value.begin(); it!=value.end(); it++) {
+		if ('"' == *it || '\\' == *it)
+			out.push_back('\\');
+		if ('\n' == *it)
+			out.append("\\n");
+		else
+			out.push_back(*it);
+	}
+	out.push_back('"');
+	return out;
+}
+
+std::string CMetrics::render()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// gather the entries by name, so each name gets one HELP and TYPE line
+	std::map<std::string, std::list<const CEntry *>> names;
+	for (auto it=m_entries.begin(); it!=m_entries.end(); it++)
+		names[it->name].push_back(&(*it));
+
+	std::string out;
+	char line[256];
+	for (auto nit=names.begin(); nit!=names.end(); nit++) {
+		const std::string &name = nit->first;
+		for (int i=0; families[i].name; i++) {
+			if (0 == name.compare(families[i].name)) {
+				out.append("# HELP " + name + " " + families[i].help + "\n");
+				out.append("# TYPE " + name + " " + families[i].type + "\n");
+				break;
+			}
+		}
+		// entries with the same labels, like two links to one reflector, or a link and the one replacing it, are added up into one sample
+		std::vector<CSample> samples;
+		std::map<std::string, size_t> byLabels;
+		for (auto eit=nit->second.begin(); eit!=nit->second.end(); eit++) {
+			const CEntry *entry = *eit;
+			if (entry->histogram) {
+				entry->histogram->render(out, name, entry->labels);
+				continue;
+			}
+			if (entry->latency) {
+				entry->latency->render(out, name, entry->labels);
+				continue;
+			}
+			if (NULL == entry->metric && ! entry->gauge)
+				continue;
+			auto sit = byLabels.find(entry->labels);
+			if (byLabels.end() == sit) {
+				sit = byLabels.insert(std::make_pair(entry->labels, samples.size())).first;
+				samples.push_back(CSample{ entry->labels, 0L, 0.0, true });
+			}
+			CSample &sample = samples[sit->second];
+			if (entry->metric)
+				sample.count += entry->metric->get();
+			else {
+				sample.value += entry->gauge();
+				sample.isCount = false;
+			}
+		}
+		for (auto sit=samples.begin(); sit!=samples.end(); sit++) {
+			const std::string braced(sit->labels.empty() ? "" : "{" + sit->labels + "}");
+			if (sit->isCount)
+				snprintf(line, 256, " %ld\n", sit->count);
+			else
+				snprintf(line, 256, " %g\n", sit->value + sit->count);
+			out.append(name + braced + line);
+		}
+	}
+
+	return out;
+}
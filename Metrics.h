@@ -0,0 +1,128 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <functional>
+
+// A counter or a gauge. Updates are relaxed atomics, so any thread can
+// change one without a lock.
+class CMetric {
+public:
+	CMetric() : m_value(0L) {}
+
+	void add(long n = 1L) { m_value.fetch_add(n, std::memory_order_relaxed); }
+	void set(long v)      { m_value.store(v, std::memory_order_relaxed); }
+	long get() const      { return m_value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<long> m_value;
+};
+
+// A histogram with fixed bucket bounds, in seconds
+class CMetricHistogram {
+public:
+	CMetricHistogram(const std::vector<double> &bounds);
+
+	void observe(double seconds);
+	void render(std::string &out, const std::string &name, const std::string &labels) const;
+
+private:
+	std::vector<double> m_bounds;
+	std::unique_ptr<std::atomic<unsigned long>[]> m_buckets;
+	std::atomic<unsigned long> m_count;
+	std::atomic<unsigned long> m_sumus;
+};
+
+// A log-linear histogram of microsecond delays, like HdrHistogram: every
+// power of two is split into 16 linear buckets, so any percentile is within
+// about 6% of the real value from one microsecond to a quarter of an hour.
+class CLatencyHistogram {
+public:
+	CLatencyHistogram();
+
+	void record(unsigned long us);
+
+	unsigned long getCount() const;
+	// the value, in microseconds, below which a fraction q of the records fall
+	unsigned long percentile(double q) const;
+
+	// p50, p99 and p999 as a summary, with the sum and the count
+	void addTo(const void *owner, const std::string &name, const std::string &labels) const;
+	void render(std::string &out, const std::string &name, const std::string &labels) const;
+
+private:
+	static const unsigned int SUB_BITS = 4U;
+	static const unsigned int SUB_COUNT = 1U << SUB_BITS;
+	static const unsigned int MAX_BITS = 30U;
+	static const unsigned int BUCKETS = (MAX_BITS - SUB_BITS + 2U) * SUB_COUNT;
+
+	std::atomic<unsigned long> m_buckets[BUCKETS];
+	std::atomic<unsigned long> m_count;
+	std::atomic<unsigned long> m_sumus;
+};
+
+// The registry. Each component owns its metrics and adds them here with
+// itself as the owner, and removes them all with remove(owner) before they
+// go away. Only adding, removing and rendering take the registry lock.
+class CMetrics {
+public:
+	static void add(const void *owner, const std::string &name, const std::string &labels, CMetric *metric);
+	static void add(const void *owner, const std::string &name, const std::string &labels, CMetricHistogram *histogram);
+	static void add(const void *owner, const std::string &name, const std::string &labels, const CLatencyHistogram *latency);
+	// a gauge computed when the metrics are rendered
+	static void add(const void *owner, const std::string &name, const std::string &labels, std::function<double()> gauge);
+	static void remove(const void *owner);
+
+	// key="value" with the value escaped
+	static std::string label(const std::string &key, const std::string &value);
+
+	// the Prometheus text exposition format
+	static std::string render();
+
+private:
+	class CEntry {
+	public:
+		const void *owner;
+		std::string name;
+		std::string labels;
+		CMetric *metric;
+		CMetricHistogram *histogram;
+		const CLatencyHistogram *latency;
+		std::function<double()> gauge;
+	};
+
+	class CSample {
+	public:
+		std::string labels;
+		long count;		// the sum of the CMetrics
+		double value;	// and of the gauges
+		bool isCount;	// there were no gauges
+	};
+
+	static void add(const CEntry &entry);
+
+	static std::mutex m_mutex;
+	static std::list<CEntry> m_entries;
+};
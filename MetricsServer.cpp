@@ -0,0 +1,162 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+
+#include "MetricsServer.h"
+#include "Metrics.h"
+
+#define REQUEST_TIMEOUT_MS 1000
+
+CMetricsServer::~CMetricsServer()
+{
+	close();
+}
+
+bool CMetricsServer::open(const std::string &address, unsigned short port)
+{
+	struct sockaddr_storage addr;
+	memset(&addr, 0, sizeof(struct sockaddr_storage));
+	socklen_t size;
+
+	int family;
+	if (address.npos != address.find(':')) {
+		struct sockaddr_in6 *a = (struct sockaddr_in6 *)&addr;
+		a->sin6_family = family = AF_INET6;
+		a->sin6_port = htons(port);
+		size = sizeof(struct sockaddr_in6);
+		if (1 != inet_pton(AF_INET6, address.c_str(), &(a->sin6_addr))) {
+			fprintf(stderr, "Improper metrics address [%s]\n", address.c_str());
+			return true;
+		}
+	} else {
+		struct sockaddr_in *a = (struct sockaddr_in *)&addr;
+		a->sin_family = family = AF_INET;
+		a->sin_port = htons(port);
+		size = sizeof(struct sockaddr_in);
+		if (1 != inet_pton(AF_INET, address.c_str(), &(a->sin_addr))) {
+			fprintf(stderr, "Improper metrics address [%s]\n", address.c_str());
+			return true;
+		}
+	}
+
+	m_sock = socket(family, SOCK_STREAM, 0);
+	if (m_sock < 0) {
+		perror("Unable to create the metrics socket");
+		return true;
+	}
+
+	int reuse = 1;
+	setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if (bind(m_sock, (struct sockaddr *)&addr, size) || listen(m_sock, 4)) {
+		fprintf(stderr, "Unable to open the metrics port [%s]:%u: %s\n", address.c_str(), port, strerror(errno));
+		::close(m_sock);
+		m_sock = -1;
+		return true;
+	}
+
+	fcntl(m_sock, F_SETFL, fcntl(m_sock, F_GETFL, 0) | O_NONBLOCK);
+
+	if (AF_INET6 == family)
+		printf("Metrics are available at http://[%s]:%u/metrics\n", address.c_str(), port);
+	else
+		printf("Metrics are available at http://%s:%u/metrics\n", address.c_str(), port);
+	m_running = true;
+	m_future = std::async(std::launch::async, &CMetricsServer::Run, this);
+	return false;
+}
+
+void CMetricsServer::close()
+{
+	if (m_running) {
+		m_running = false;
+		m_future.get();
+	}
+	if (m_sock >= 0) {
+		::close(m_sock);
+		m_sock = -1;
+	}
+}
+
+void CMetricsServer::Run()
+{
+	while (m_running) {
+		struct pollfd pfd = { m_sock, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		int client = accept(m_sock, NULL, NULL);
+		if (client < 0)
+			continue;
+
+		fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+		Serve(client);
+		::close(client);
+	}
+}
+
+// one request per connection, then close
+void CMetricsServer::Serve(int client)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(REQUEST_TIMEOUT_MS);
+	auto left = [&deadline]() {
+		return (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+	};
+
+	std::string request;
+	char buf[1024];
+	while (request.npos == request.find("\r\n\r\n") && request.size() < 8192) {
+		struct pollfd pfd = { client, POLLIN, 0 };
+		if (left() <= 0 || poll(&pfd, 1, left()) <= 0)
+			return;
+		ssize_t len = recv(client, buf, 1024, 0);
+		if (len <= 0)
+			return;
+		request.append(buf, len);
+	}
+
+	std::string response;
+	if (0 == request.compare(0, 13, "GET /metrics ") || 0 == request.compare(0, 6, "GET / ")) {
+		std::string body(CMetrics::render());
+		response.assign("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ");
+		response.append(std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+	} else
+		response.assign("HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+	size_t sent = 0;
+	while (sent < response.size()) {
+		struct pollfd pfd = { client, POLLOUT, 0 };
+		if (left() <= 0 || poll(&pfd, 1, left()) <= 0)
+			return;
+		ssize_t len = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+		if (len <= 0)
+			return;
+		sent += len;
+	}
+}
@@ -0,0 +1,44 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <future>
+
+// Serves GET /metrics over plain HTTP from its own thread. The sockets are
+// non-blocking and every request has a one second limit, so a scraper can't
+// hold anything up. Meant to be bound to a local or private address.
+class CMetricsServer {
+public:
+	CMetricsServer() : m_sock(-1), m_running(false) {}
+	~CMetricsServer();
+
+	// returns true on error
+	bool open(const std::string &address, unsigned short port);
+	void close();
+
+private:
+	int m_sock;
+	std::atomic<bool> m_running;
+	std::future<void> m_future;
+
+	void Run();
+	void Serve(int client);
+};
@@ -0,0 +1,86 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+// Recycles the packet objects handed out by the protocol handlers. Each
+// thread keeps its own free list, so acquire() and release() never lock,
+// and once the list has grown to the number of packets in flight the
+// routing loop stops calling new and delete altogether.
+template <class T> class CObjectPool {
+public:
+	static T *acquire()
+	{
+		std::vector<T *> &list = m_free.list;
+		if (list.empty()) {
+			m_allocated.fetch_add(1UL, std::memory_order_relaxed);
+			m_inUse.fetch_add(1UL, std::memory_order_relaxed);
+			return new T;
+		}
+
+		T *obj = list.back();
+		list.pop_back();
+		// assigning a fresh object resets every field but keeps string capacity
+		*obj = T();
+
+		m_reused.fetch_add(1UL, std::memory_order_relaxed);
+		m_inUse.fetch_add(1UL, std::memory_order_relaxed);
+		return obj;
+	}
+
+	static void release(T *obj)
+	{
+		if (obj == NULL)
+			return;
+
+		m_inUse.fetch_sub(1UL, std::memory_order_relaxed);
+		m_free.list.push_back(obj);
+	}
+
+	// number of objects ever created with new
+	static unsigned long getAllocated() { return m_allocated.load(std::memory_order_relaxed); }
+	// number of acquires satisfied from a free list
+	static unsigned long getReused()    { return m_reused.load(std::memory_order_relaxed); }
+	// number of objects currently handed out
+	static unsigned long getInUse()     { return m_inUse.load(std::memory_order_relaxed); }
+
+private:
+	class CFreeList {
+	public:
+		~CFreeList()
+		{
+			for (auto it=list.begin(); it!=list.end(); it++)
+				delete *it;
+		}
+
+		std::vector<T *> list;
+	};
+
+	static thread_local CFreeList m_free;
+	static std::atomic<unsigned long> m_allocated;
+	static std::atomic<unsigned long> m_reused;
+	static std::atomic<unsigned long> m_inUse;
+};
+
+template <class T> thread_local typename CObjectPool<T>::CFreeList CObjectPool<T>::m_free;
+template <class T> std::atomic<unsigned long> CObjectPool<T>::m_allocated(0UL);
+template <class T> std::atomic<unsigned long> CObjectPool<T>::m_reused(0UL);
+template <class T> std::atomic<unsigned long> CObjectPool<T>::m_inUse(0UL);
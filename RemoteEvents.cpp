@@ -0,0 +1,129 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <ctime>
+#include <cstdio>
+
+#include "RemoteEvents.h"
+
+// a subscriber that stops reading loses its oldest events beyond this
+#define MAX_QUEUED_EVENTS 1000U
+
+std::mutex                      CRemoteEvents::m_mutex;
+std::list<CRemoteSubscriber *>  CRemoteEvents::m_subscribers;
+std::atomic<unsigned int>       CRemoteEvents::m_count(0U);
+
+void CRemoteEvents::userLog(bool logon, const std::string &group, const std::string &user)
+{
+	if (0U == m_count)
+		return;
+
+	char line[128];
+	snprintf(line, 128, "{\"type\":\"%s\",\"time\":%ld,\"group\":%s,\"user\":%s}", logon ? "logon" : "logoff", (long)time(NULL), quote(group).c_str(), quote(user).c_str());
+	post(line);
+}
+
+void CRemoteEvents::linkChange(const std::string &group, const std::string &reflector, LINK_STATUS status)
+{
+	if (0U == m_count)
+		return;
+
+	char line[128];
+	snprintf(line, 128, "{\"type\":\"link\",\"time\":%ld,\"group\":%s,\"reflector\":%s,\"status\":\"%s\"}", (long)time(NULL), quote(group).c_str(), quote(reflector).c_str(), linkStatus(status));
+	post(line);
+}
+
+void CRemoteEvents::post(const std::string &line)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto it=m_subscribers.begin(); it!=m_subscribers.end(); it++) {
+		CRemoteSubscriber *sub = *it;
+		if (sub->lines.size() >= MAX_QUEUED_EVENTS) {
+			sub->lines.pop_front();
+			sub->overflow = true;
+		}
+		sub->lines.push_back(line);
+	}
+}
+
+CRemoteSubscriber *CRemoteEvents::subscribe()
+{
+	CRemoteSubscriber *sub = new CRemoteSubscriber;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_subscribers.push_back(sub);
+	m_count = m_subscribers.size();
+	return sub;
+}
+
+void CRemoteEvents::unsubscribe(CRemoteSubscriber *subscriber)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_subscribers.remove(subscriber);
+	m_count = m_subscribers.size();
+	delete subscriber;
+}
+
+bool CRemoteEvents::get(CRemoteSubscriber *subscriber, std::deque<std::string> &lines)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (subscriber->overflow) {
+		lines.push_back(std::string("{\"type\":\"overflow\"}"));
+		subscriber->overflow = false;
+	}
+	while (! subscriber->lines.empty()) {
+		lines.push_back(subscriber->lines.front());
+		subscriber->lines.pop_front();
+	}
+	return ! lines.empty();
+}
+
+std::string CRemoteEvents::quote(const std::string &str)
+{
+	std::string out("\"");
+	for (auto it=str.begin(); it!=str.end(); it++) {
+		const char c = *it;
+		if ('"' == c || '\\' == c) {
+			out.push_back('\\');
+			out.push_back(c);
+		} else if ((unsigned char)c < 0x20U) {
+			char esc[8];
+			snprintf(esc, 8, "\\u%04x", (unsigned char)c);
+			out.append(esc);
+		} else
+			out.push_back(c);
+	}
+	out.push_back('"');
+	return out;
+}
+
+const char *CRemoteEvents::linkStatus(LINK_STATUS status)
+{
+	switch (status) {
+		case LS_LINKING_DCS:
+		case LS_LINKING_DEXTRA:
+		case LS_LINKING_LOOPBACK:
+		case LS_PENDING_IRCDDB:
+			return "linking";
+		case LS_LINKED_DCS:
+		case LS_LINKED_DEXTRA:
+		case LS_LINKED_LOOPBACK:
+			return "linked";
+		default:
+			return "unlinked";
+	}
+}
@@ -0,0 +1,61 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+#include "Defs.h"
+
+// the JSON lines waiting for one subscribed remote session
+class CRemoteSubscriber {
+public:
+	CRemoteSubscriber() : overflow(false) {}
+
+	std::deque<std::string> lines;
+	bool overflow;
+};
+
+// Status changes for remote clients in subscribe mode. The routing thread
+// posts events and every subscriber gets its own copy, one JSON object per
+// line. Posting costs nothing when no one is subscribed.
+class CRemoteEvents {
+public:
+	static void userLog(bool logon, const std::string &group, const std::string &user);
+	static void linkChange(const std::string &group, const std::string &reflector, LINK_STATUS status);
+
+	static CRemoteSubscriber *subscribe();
+	static void unsubscribe(CRemoteSubscriber *subscriber);
+	// move everything waiting for subscriber into lines, returns false if there was nothing
+	static bool get(CRemoteSubscriber *subscriber, std::deque<std::string> &lines);
+
+	// JSON helpers shared with the snapshot
+	static std::string quote(const std::string &str);
+	static const char *linkStatus(LINK_STATUS status);
+
+private:
+	static void post(const std::string &line);
+
+	static std::mutex m_mutex;
+	static std::list<CRemoteSubscriber *> m_subscribers;
+	static std::atomic<unsigned int> m_count;
+};
@@ -19,6 +19,11 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <csignal>
+#include <ctime>
+#include <deque>
 #include <list>
 #include <vector>
 #include <sstream>
@@ -28,18 +33,199 @@
 #include "DExtraHandler.h"
 #include "DStarDefines.h"
 #include "DCSHandler.h"
+#include "RemoteEvents.h"
+#include "LoopProfiler.h"
+#include "ObjectPool.h"
 #include "Utils.h"
+#include "SGSThread.h"
+
+// how long a client will wait for the routing thread to run its command
+#define REPLY_TIMEOUT_MS 5000
+// how long a json session may sit idle between commands
+#define SESSION_IDLE_MS 60000
+// how many clients can be connected at once
+#define MAX_SESSIONS 4
+
+CRemoteHandler::~CRemoteHandler()
+{
+	close();
+	while (! m_queue.empty()) {
+		delete m_queue.front();
+		m_queue.pop();
+	}
+}
 
 bool CRemoteHandler::open(const std::string &password, const unsigned short port, const bool isIPV6)
 {
-	return m_tlsserver.OpenSocket(password, isIPV6 ? "::" : "0.0.0.0", port);
+	if (m_tlsserver.OpenSocket(password, isIPV6 ? "::" : "0.0.0.0", port))
+		return true;
+
+	m_running = true;
+	m_future = std::async(std::launch::async, &CRemoteHandler::Run, this);
+	return false;
+}
+
+void CRemoteHandler::close()
+{
+	if (m_running) {
+		m_running = false;
+		m_future.get();
+	}
+}
+
+// the remote thread, it accepts clients and starts a session for each one
+void CRemoteHandler::Run()
+{
+	while (m_running) {
+		CTLSClient *client = m_tlsserver.Accept(100U);
+
+		for (auto it=m_sessions.begin(); it!=m_sessions.end(); ) {
+			if (std::future_status::ready == it->wait_for(std::chrono::seconds(0)))
+				it = m_sessions.erase(it);
+			else
+				it++;
+		}
+
+		if (NULL == client)
+			continue;
+
+		if (m_sessions.size() >= MAX_SESSIONS) {
+			fprintf(stderr, "Too many remote sessions, dropping the new client\n");
+			delete client;
+			continue;
+		}
+
+		m_sessions.push_back(std::async(std::launch::async, &CRemoteHandler::Session, this, client));
+	}
+
+	// the sessions see m_running and quit
+	m_sessions.clear();
+}
+
+// A session thread. The original commands get their reply and the client is
+// closed. After "json" or "profile" the session stays open for more commands,
+// so a dashboard can poll without a new handshake, and "subscribe" streams
+// events.
+void CRemoteHandler::Session(CTLSClient *client)
+{
+	if (client->Login(m_tlsserver.GetPassword())) {
+		delete client;
+		return;
+	}
+
+	char buf[1024];
+	int len = client->Read(buf, 1024, 5000U);
+	while (m_running && len > 0) {
+		std::string command(buf);
+		while (command.size() && isspace(command.back()))
+			command.pop_back();
+
+		if (0 == command.compare("subscribe")) {
+			Subscribe(client);
+			break;
+		}
+		if (0 == command.compare("quit"))
+			break;
+
+		std::vector<std::string> lines;
+		if (request(command, lines)) {
+			fprintf(stderr, "Remote command \"%s\" was not run in time\n", command.c_str());
+			break;
+		}
+		for (auto it=lines.begin(); it!=lines.end(); it++) {
+			if (0 > client->Write(it->c_str()))
+				break;
+		}
+
+		if (command.compare("json") && command.compare("profile"))
+			break;
+
+		// wait for the next command in short steps, so a shutdown isn't held up
+		len = 0;
+		for (unsigned int waited=0U; m_running && 0==len && waited<SESSION_IDLE_MS; waited+=100U)
+			len = client->Read(buf, 1024, 100U);
+	}
+
+	delete client;
+}
+
+// a snapshot first, then a JSON line for every change until the client leaves
+void CRemoteHandler::Subscribe(CTLSClient *client)
+{
+	CRemoteSubscriber *subscriber = CRemoteEvents::subscribe();
+
+	std::vector<std::string> lines;
+	bool ok = ! request("json", lines);
+	for (auto it=lines.begin(); ok && it!=lines.end(); it++)
+		ok = (0 <= client->Write(it->c_str()));
+
+	std::deque<std::string> events;
+	while (ok && m_running) {
+		if (CRemoteEvents::get(subscriber, events)) {
+			for ( ; ok && events.size(); events.pop_front()) {
+				std::string line(events.front() + "\n");
+				ok = (0 <= client->Write(line.c_str()));
+			}
+		} else {
+			char buf[64];
+			int len = client->Read(buf, 64, 100U);
+			if (len < 0 || (len > 0 && 0 == strncmp(buf, "quit", 4)))
+				ok = false;
+		}
+	}
+
+	CRemoteEvents::unsubscribe(subscriber);
+}
+
+// Run a command on the routing thread. Returns true if it wasn't done in time.
+bool CRemoteHandler::request(const std::string &command, std::vector<std::string> &lines)
+{
+	CRemoteCommand *cmd = new CRemoteCommand;
+	cmd->command.assign(command);
+	auto pending = cmd->reply.get_future();
+	m_mutex.lock();
+	m_queue.push(cmd);
+	m_mutex.unlock();
+
+	if (std::future_status::ready != pending.wait_for(std::chrono::milliseconds(REPLY_TIMEOUT_MS)))
+		return true;
+
+	lines = pending.get();
+	return false;
 }
 
+// called every loop by the routing thread, returns true if it should halt
 bool CRemoteHandler::process()
 {
-	std::string command;
-	if (m_tlsserver.GetCommand(command))
-		return false;	// nothing to do...
+	CRemoteCommand *cmd = NULL;
+
+	// never wait on the remote thread
+	if (m_mutex.try_lock()) {
+		if (! m_queue.empty()) {
+			cmd = m_queue.front();
+			m_queue.pop();
+		}
+		m_mutex.unlock();
+	}
+
+	if (NULL == cmd)
+		return false;
+
+	m_reply.clear();
+	bool halt = execute(cmd->command);
+	cmd->reply.set_value(m_reply);
+	delete cmd;
+
+	return halt;
+}
+
+void CRemoteHandler::reply(const char *line)
+{
+	m_reply.push_back(line);
+}
+
+bool CRemoteHandler::execute(const std::string &command)
+{
 	// parse the command into words
 	std::stringstream ss(command);
 	std::istream_iterator<std::string> begin(ss);
@@ -51,6 +237,16 @@ bool CRemoteHandler::process()
 		return false;
 	}
 
+	if (0 == cwords[0].compare("json")) {
+		sendJSON();
+		return false;
+	}
+
+	if (0 == cwords[0].compare("profile")) {
+		m_reply.push_back(CLoopProfiler::json());
+		return false;
+	}
+
 	if (0 == cwords[0].compare("halt")) {
 		printf("Received halt command from remote client, shutting down...\n");
 		//auto groups = CGroupHandler::listGroups();
@@ -61,6 +257,13 @@ bool CRemoteHandler::process()
 		return true;
 	}
 
+	if (0 == cwords[0].compare("reload")) {
+		printf("Received reload command from remote client\n");
+		CSGSThread::ReloadCatch(SIGHUP);
+		reply("Reloading the configuration");
+		return false;
+	}
+
 	if (cwords.size() < 2) {
 		fprintf(stderr, "Not enough words in the command: [%s]\n", command.c_str());
 		return false;
@@ -69,14 +272,11 @@ bool CRemoteHandler::process()
 	ReplaceChar(cwords[1], '_', ' ');	// this is the subscribe callsign
 	cwords[1].resize(8, ' ');
 
-	CGroupHandler *group = CGroupHandler::findGroup(cwords[1]);
+	// the group is on its worker, so the command is run there
 	if (0 == cwords[0].compare("list")) {
-		sendGroup(group);
-	} else if (NULL == group) {
-		char emsg[128];
-		snprintf(emsg, 128, "Smart Group [%s] not found", cwords[1].c_str());
-		m_tlsserver.Write(emsg);
-	} else {
+		if (CGroupHandler::call(cwords[1], [this](CGroupHandler *group) { sendGroup(group); }))
+			sendGroup(NULL);
+	} else if (CGroupHandler::call(cwords[1], [&](CGroupHandler *group) {
 		if (cwords.size() > 2 && 0 == cwords[0].compare("link")) {
 			ReplaceChar(cwords[2], '_', ' ');
 			cwords[2].resize(8, ' ');
@@ -96,12 +296,65 @@ bool CRemoteHandler::process()
 		else {
 			printf("The command \"%s\" is bad\n", command.c_str());
 		}
+	})) {
+		char emsg[128];
+		snprintf(emsg, 128, "Smart Group [%s] not found", cwords[1].c_str());
+		reply(emsg);
 	}
-	m_tlsserver.CloseClient();
 	return false;
 }
 
 
+// every group, its users and link, and the packet counters as a single line
+void CRemoteHandler::sendJSON()
+{
+	char num[128];
+	snprintf(num, 128, "{\"type\":\"snapshot\",\"time\":%ld,\"groups\":[", (long)time(NULL));
+	std::string json(num);
+
+	// each group is read on its worker, in the order they were configured
+	auto groups = CGroupHandler::listGroups();
+	for (auto it=groups.begin(); it!=groups.end(); it++) {
+		CGroupHandler::call(*it, [&](CGroupHandler *group) {
+			CRemoteGroup *data = group->getInfo();
+			if (NULL == data)
+				return;
+			if (it != groups.begin())
+				json.push_back(',');
+			json.append("{\"callsign\":" + CRemoteEvents::quote(data->getCallsign()));
+			json.append(",\"logoff\":" + CRemoteEvents::quote(data->getLogoff()));
+			json.append(",\"module\":" + CRemoteEvents::quote(data->getRepeater()));
+			json.append(",\"info\":" + CRemoteEvents::quote(data->getInfoText()));
+			json.append(",\"reflector\":" + CRemoteEvents::quote(data->getReflector()));
+			snprintf(num, 128, ",\"link\":\"%s\",\"timeout\":%u,\"users\":[", CRemoteEvents::linkStatus(data->getLinkStatus()), data->getUserTimeout() * 60U);
+			json.append(num);
+			for (uint32_t i=0; i<data->getUserCount(); i++) {
+				CRemoteUser *user = data->getUser(i);
+				if (i)
+					json.push_back(',');
+				json.append("{\"callsign\":" + CRemoteEvents::quote(user->getCallsign()));
+				snprintf(num, 128, ",\"timer\":%u,\"timeout\":%u}", user->getTimer(), user->getTimeout());
+				json.append(num);
+			}
+			const CLatencyHistogram &latency = group->getRelayLatency();
+			snprintf(num, 128, "],\"relay_us\":{\"count\":%lu,\"p50\":%lu,\"p99\":%lu,\"p999\":%lu}}", latency.getCount(), latency.percentile(0.5), latency.percentile(0.99), latency.percentile(0.999));
+			json.append(num);
+			delete data;
+		});
+	}
+
+	snprintf(num, 128, "],\"counters\":{\"header_alloc\":%lu,\"header_reuse\":%lu,", CObjectPool<CHeaderData>::getAllocated(), CObjectPool<CHeaderData>::getReused());
+	json.append(num);
+	snprintf(num, 128, "\"ambe_alloc\":%lu,\"ambe_reuse\":%lu,", CObjectPool<CAMBEData>::getAllocated(), CObjectPool<CAMBEData>::getReused());
+	json.append(num);
+	snprintf(num, 128, "\"poll_alloc\":%lu,\"poll_reuse\":%lu,", CObjectPool<CPollData>::getAllocated(), CObjectPool<CPollData>::getReused());
+	json.append(num);
+	snprintf(num, 128, "\"connect_alloc\":%lu,\"connect_reuse\":%lu}}\n", CObjectPool<CConnectData>::getAllocated(), CObjectPool<CConnectData>::getReused());
+	json.append(num);
+
+	m_reply.push_back(json);
+}
+
 void CRemoteHandler::sendGroup(CGroupHandler *group)
 {
 	char msg[128];
@@ -109,44 +362,43 @@ void CRemoteHandler::sendGroup(CGroupHandler *group)
 		CRemoteGroup *data = group->getInfo();
 		if (data) {
 			snprintf(msg, 128, "Subscribe    = %s", data->getCallsign().c_str());
-			m_tlsserver.Write(msg);
+			reply(msg);
 			snprintf(msg, 128, "Unsubscribe  = %s", data->getLogoff().c_str());
-			m_tlsserver.Write(msg);
+			reply(msg);
 			snprintf(msg, 128, "Module       = %s", data->getRepeater().c_str());
-			m_tlsserver.Write(msg);
+			reply(msg);
 			snprintf(msg, 128, "Description  = %s", data->getInfoText().c_str());
-			m_tlsserver.Write(msg);
+			reply(msg);
 			snprintf(msg, 128, "Reflector    = %s", data->getReflector().c_str());
-			m_tlsserver.Write(msg);
+			reply(msg);
 			switch (data->getLinkStatus()) {
 				case LS_LINKING_DCS:
 				case LS_LINKING_DEXTRA:
-					m_tlsserver.Write("Link Status  = Linking");
+					reply("Link Status  = Linking");
 					break;
 				case LS_LINKED_DCS:
 				case LS_LINKED_DEXTRA:
-					m_tlsserver.Write("Link Status  = Linked");
+					reply("Link Status  = Linked");
 					break;
 				default:
-					m_tlsserver.Write("Link Status  = Unlinked");
+					reply("Link Status  = Unlinked");
 					break;
 			}
 			snprintf(msg, 128, "User Timeout = %u min", data->getUserTimeout());
-			m_tlsserver.Write(msg);
+			reply(msg);
 			for (uint32_t i=0; i<data->getUserCount(); i++) {
 				CRemoteUser *user = data->getUser(i);
 				snprintf(msg, 128, "    User = %s, timer = %u min, timeout = %u min", user->getCallsign().c_str(), user->getTimer()/60U, user->getTimeout()/60U);
-				m_tlsserver.Write(msg);
+				reply(msg);
 			}
 		}
 		delete data;
 	} else {
 		// no group, so let's summarize all groups
 		auto groups = CGroupHandler::listGroups();
-		m_tlsserver.Write("Logon    Logoff   Channel  Description          Status   Reflector Timeout");
+		reply("Logon    Logoff   Channel  Description          Status   Reflector Timeout");
 		for (auto it=groups.begin(); it!=groups.end(); it++) {
-			CGroupHandler *group = CGroupHandler::findGroup(*it);
-			if (group) {
+			CGroupHandler::call(*it, [&](CGroupHandler *group) {
 				CRemoteGroup *data = group->getInfo();
 				if (data) {
 					std::string linkstat;
@@ -164,10 +416,10 @@ void CRemoteHandler::sendGroup(CGroupHandler *group)
 							break;
 					}
 					snprintf(msg, 128, "%s %s %s %s %s %8.8s   %4u", data->getCallsign().c_str(), data->getLogoff().c_str(), data->getRepeater().c_str(), data->getInfoText().c_str(), linkstat.c_str(), data->getReflector().c_str(), data->getUserTimeout());
-					m_tlsserver.Write(msg);
+					reply(msg);
 					delete data;
 				}
-			}
+			});
 		}
 	}
 }
@@ -180,7 +432,7 @@ void CRemoteHandler::link(CGroupHandler *group, const std::string &reflector)
 		snprintf(msg, 128, "Smart Group %s linked to %s", data->getCallsign().c_str(), reflector.c_str());
 	else
 		snprintf(msg, 128, "Failed to link Smart Group %s to %s", data->getCallsign().c_str(), reflector.c_str());
-	m_tlsserver.Write(msg);
+	reply(msg);
 	delete data;
 }
 
@@ -199,14 +451,14 @@ void CRemoteHandler::unlink(CGroupHandler *group)
 			break;
 		default:
 			snprintf(msg, 128, "Smart Group %s is already unlinked", data->getCallsign().c_str());
-			m_tlsserver.Write(msg);
+			reply(msg);
 			delete data;
 			return;
 	}
 	delete data;
 	group->setLinkType(LT_NONE);
 	group->clearReflector();
-    m_tlsserver.Write(msg);
+    reply(msg);
 }
 
 void CRemoteHandler::logoff(CGroupHandler *group, const std::string &user)
@@ -217,6 +469,6 @@ void CRemoteHandler::logoff(CGroupHandler *group, const std::string &user)
 		snprintf(msg, 128, "Logging off %s from Smart Group %s", user.c_str(), data->getCallsign().c_str());
 	else
 		snprintf(msg, 128, "Could not logoff %s from Smart Group %s", user.c_str(), data->getCallsign().c_str());
-	m_tlsserver.Write(msg);
+	reply(msg);
 	delete data;
 }
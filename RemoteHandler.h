@@ -21,23 +21,54 @@
 
 #include <string>
 #include <cstdint>
+#include <vector>
+#include <list>
+#include <queue>
+#include <mutex>
+#include <future>
+#include <atomic>
 
 #include "GroupHandler.h"
 #include "TLSServer.h"
 
+// a client command waiting to be run on the routing thread
+class CRemoteCommand {
+public:
+	std::string command;
+	std::promise<std::vector<std::string>> reply;
+};
+
+// The TLS server runs on its own thread and each client session gets a
+// thread of its own. Commands are handed to the routing thread, which runs
+// them in process() and hands back the reply lines.
 class CRemoteHandler {
 public:
-	CRemoteHandler() {};
-	~CRemoteHandler() {};
+	CRemoteHandler() : m_running(false) {};
+	~CRemoteHandler();
 
 	bool open(const std::string &password, const unsigned short port, const bool isIPV6);
+	void close();
 
 	bool process();
 
 private:
 	std::string	m_password;
 	CTLSServer	m_tlsserver;
+	std::atomic<bool> m_running;
+	std::future<void> m_future;
+	std::list<std::future<void>> m_sessions;
+	std::mutex m_mutex;
+	std::queue<CRemoteCommand *> m_queue;
+	std::vector<std::string> m_reply;
+
+	void Run();
+	void Session(CTLSClient *client);
+	void Subscribe(CTLSClient *client);
+	bool request(const std::string &command, std::vector<std::string> &lines);
+	bool execute(const std::string &command);
+	void reply(const char *line);
 
+	void sendJSON();
 	void sendGroup(CGroupHandler *group);
 	void link(CGroupHandler *group, const std::string &reflector);
 	void unlink(CGroupHandler *group);
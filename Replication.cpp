@@ -0,0 +1,439 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "Replication.h"
+#include "CacheManager.h"
+
+// a standby that falls this far behind is dropped, and sent a new snapshot when it connects again
+#define REPLICATION_MAX_QUEUE 200000U
+#define REPLICATION_HELLO "SGSR1"
+
+int CReplication::m_listen = -1;
+std::atomic<bool> CReplication::m_sending(false);
+std::atomic<bool> CReplication::m_snapshotWanted(false);
+std::mutex CReplication::m_mutex;
+std::condition_variable CReplication::m_wake;
+std::deque<std::string> CReplication::m_queue;
+std::future<void> CReplication::m_thread;
+bool CReplication::m_running = false;
+CMetric CReplication::m_records;
+CMetric CReplication::m_standby;
+std::string CReplication::m_peer;
+std::string CReplication::m_secret;
+int CReplication::m_fd = -1;
+std::chrono::steady_clock::time_point CReplication::m_heartbeat;
+bool CReplication::m_armed = false;
+std::map<std::string, std::vector<std::string>> CReplication::m_links;
+std::map<std::string, std::vector<std::string>> CReplication::m_ports;
+std::map<std::string, std::string> CReplication::m_users;
+
+static bool setAddress(const std::string &address, unsigned short port, struct sockaddr_in &addr)
+{
+	memset(&addr, 0, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	return 1 != inet_pton(AF_INET, address.c_str(), &addr.sin_addr);
+}
+
+static void setTimeout(int fd, int secs)
+{
+	struct timeval tv = { secs, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// a byte at a time, so nothing after the line is read
+static bool readLine(int fd, std::string &line)
+{
+	line.clear();
+	char c;
+	while (line.size() < 256U) {
+		if (1 != read(fd, &c, 1))
+			return true;
+		if ('\n' == c)
+			return false;
+		line.push_back(c);
+	}
+	return true;
+}
+
+static bool writeLine(int fd, const std::string &line)
+{
+	const std::string text(line + "\n");
+	return ::send(fd, text.data(), text.size(), MSG_NOSIGNAL) != ssize_t(text.size());
+}
+
+static std::string toHex(const unsigned char *data, unsigned int length)
+{
+	std::string hex;
+	char digits[3];
+	for (unsigned int i=0U; i<length; i++) {
+		snprintf(digits, sizeof(digits), "%02x", data[i]);
+		hex.append(digits);
+	}
+	return hex;
+}
+
+static std::string makeNonce()
+{
+	unsigned char nonce[16];
+	if (1 != RAND_bytes(nonce, sizeof(nonce)))
+		return std::string();
+	return toHex(nonce, sizeof(nonce));
+}
+
+// who is signing is part of what is signed, so one side's answer can't be sent back to it
+static std::string sign(const std::string &secret, const char *who, const std::string &nonce)
+{
+	const std::string message(std::string(who) + "\t" + nonce);
+	unsigned char mac[EVP_MAX_MD_SIZE];
+	unsigned int length = 0U;
+	if (NULL == HMAC(EVP_sha256(), secret.data(), int(secret.size()), (const unsigned char *)message.data(), message.size(), mac, &length))
+		return std::string();
+	return toHex(mac, length);
+}
+
+static bool matches(const std::string &expected, const std::string &received)
+{
+	return expected.size() && expected.size() == received.size() && 0 == CRYPTO_memcmp(expected.data(), received.data(), expected.size());
+}
+
+// the active server sends a nonce, the standby answers with its signature of it and a nonce of its own,
+// and the active server answers with its signature of that
+bool CReplication::authenticate(int fd, bool active)
+{
+	setTimeout(fd, 3);
+	std::string line;
+	bool failed = true;
+	if (active) {
+		const std::string nonce(makeNonce());
+		if (nonce.size() && ! writeLine(fd, std::string(REPLICATION_HELLO " ") + nonce) && ! readLine(fd, line)) {
+			const auto space = line.find(' ');
+			if (line.npos != space && matches(sign(m_secret, "standby", nonce), line.substr(0, space)))
+				failed = writeLine(fd, sign(m_secret, "active", line.substr(space + 1)));
+		}
+	} else if (! readLine(fd, line) && 0 == line.compare(0, strlen(REPLICATION_HELLO " "), REPLICATION_HELLO " ")) {
+		const std::string nonce(makeNonce());
+		if (nonce.size() && ! writeLine(fd, sign(m_secret, "standby", line.substr(strlen(REPLICATION_HELLO " "))) + " " + nonce) && ! readLine(fd, line))
+			failed = ! matches(sign(m_secret, "active", nonce), line);
+	}
+	setTimeout(fd, 0);
+	return failed;
+}
+
+bool CReplication::listen(const std::string &local, const std::string &peer, unsigned short port, const std::string &secret)
+{
+	struct sockaddr_in addr;
+	if (setAddress(local, port, addr)) {
+		fprintf(stderr, "Improper replication address to listen on [%s]\n", local.c_str());
+		return true;
+	}
+	m_peer.assign(peer);
+	m_secret.assign(secret);
+
+	m_listen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_listen < 0) {
+		fprintf(stderr, "Cannot create the replication socket: %s\n", strerror(errno));
+		return true;
+	}
+	int reuse = 1;
+	setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if (bind(m_listen, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) || ::listen(m_listen, 1)) {
+		fprintf(stderr, "Cannot listen for a standby on %s:%u: %s\n", local.c_str(), port, strerror(errno));
+		::close(m_listen);
+		m_listen = -1;
+		return true;
+	}
+	printf("Listening on %s:%u for the standby at %s\n", local.c_str(), port, peer.c_str());
+
+	CMetrics::add(&m_records, "sgs_replication_records_total", "", &m_records);
+	CMetrics::add(&m_records, "sgs_replication_standby", "", &m_standby);
+
+	m_running = true;
+	m_thread = std::async(std::launch::async, &CReplication::run);
+	return false;
+}
+
+void CReplication::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (! m_running)
+			return;
+		m_running = false;
+	}
+	m_wake.notify_all();
+	m_thread.get();
+
+	CMetrics::remove(&m_records);
+	::close(m_listen);
+	m_listen = -1;
+}
+
+void CReplication::snapshot(const std::string &state)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_sending)
+		m_queue.push_front("snapshot\n" + state);
+	m_wake.notify_one();
+}
+
+void CReplication::send(const std::string &record)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_sending)
+		m_queue.push_back(record + "\n");
+	m_wake.notify_one();
+}
+
+// called by the ircDDB threads, like CCapture::cache()
+void CReplication::cache(CAPTURE_TYPE type, const CCacheManager *cache, const std::vector<std::string> &fields)
+{
+	std::string record("update\t");
+	record.push_back((cache == CCapture::getCache(1)) ? '1' : '0');
+	record.append("\t").append(std::to_string(type));
+	for (auto it=fields.begin(); it!=fields.end(); it++)
+		record.append("\t").append(*it);
+	send(record);
+}
+
+// sends the queue to the standby, and takes a new one when it connects
+void CReplication::run()
+{
+	int fd = -1;
+	std::string text;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_running) {
+		if (fd < 0) {
+			lock.unlock();
+			struct pollfd pfd = { m_listen, POLLIN, 0 };
+			if (1 == poll(&pfd, 1, 200)) {
+				struct sockaddr_in addr;
+				socklen_t size = sizeof(struct sockaddr_in);
+				fd = accept4(m_listen, (struct sockaddr *)&addr, &size, SOCK_CLOEXEC);
+				char from[INET_ADDRSTRLEN] = "";
+				if (fd >= 0)
+					inet_ntop(AF_INET, &addr.sin_addr, from, INET_ADDRSTRLEN);
+				// only the standby gets the users and the caches, and it can't be kept out by another connection
+				if (fd >= 0 && m_peer.compare(from)) {
+					fprintf(stderr, "Refused a replication connection from %s, it isn't the standby\n", from);
+					::close(fd);
+					fd = -1;
+				} else if (fd >= 0 && authenticate(fd, true)) {
+					fprintf(stderr, "The replication connection from %s doesn't have the secret\n", from);
+					::close(fd);
+					fd = -1;
+				}
+			}
+			lock.lock();
+			if (fd >= 0) {
+				int nodelay = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+				printf("A standby has connected\n");
+				m_queue.clear();
+				m_sending = true;
+				m_snapshotWanted = true;
+				m_standby.set(1);
+			}
+			continue;
+		}
+
+		m_wake.wait_for(lock, std::chrono::milliseconds(200));
+		bool dropped = (m_queue.size() > REPLICATION_MAX_QUEUE);
+		text.clear();
+		m_records.add(long(m_queue.size()));
+		while (m_queue.size()) {
+			text.append(m_queue.front());
+			m_queue.pop_front();
+		}
+		lock.unlock();
+
+		for (size_t sent = 0; !dropped && sent < text.size(); ) {
+			ssize_t n = ::send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+			if (n <= 0)
+				dropped = true;
+			else
+				sent += n;
+		}
+		// the standby sends nothing, so anything readable is it going away
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (! dropped && 1 == poll(&pfd, 1, 0))
+			dropped = true;
+
+		lock.lock();
+		if (dropped) {
+			printf("The standby has gone\n");
+			::close(fd);
+			fd = -1;
+			m_sending = false;
+			m_queue.clear();
+			m_standby.set(0);
+		}
+	}
+	if (fd >= 0)
+		::close(fd);
+	m_sending = false;
+}
+
+bool CReplication::connect(const std::string &address, unsigned short port)
+{
+	struct sockaddr_in addr;
+	if (setAddress(address, port, addr))
+		return false;
+
+	m_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_fd < 0)
+		return false;
+	if (::connect(m_fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in))) {
+		::close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+	if (authenticate(m_fd, false)) {
+		fprintf(stderr, "The active server at %s:%u doesn't have the secret, or refused this standby\n", address.c_str(), port);
+		::close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+	printf("Following the active server at %s:%u\n", address.c_str(), port);
+	return true;
+}
+
+bool CReplication::follow(const std::string &address, unsigned short port, const std::string &secret, unsigned int timeout, const std::atomic<bool> &killed, std::vector<std::vector<std::string>> &state)
+{
+	m_secret.assign(secret);
+	m_heartbeat = std::chrono::steady_clock::now();
+	m_armed = false;
+	std::string text;
+	char buffer[65536];
+	auto retry = m_heartbeat;
+	bool connected = false;
+	while (sinceHeartbeat() < (m_armed ? timeout : REPLICATION_FIRST_WAIT)) {
+		if (killed)
+			return true;
+
+		if (m_fd < 0) {
+			if (std::chrono::steady_clock::now() >= retry && ! connect(address, port))
+				retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+			if (m_fd < 0)
+				usleep(100000);
+			else
+				connected = true;
+			text.clear();
+			continue;
+		}
+
+		struct pollfd pfd = { m_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 200) < 1)
+			continue;
+		ssize_t n = read(m_fd, buffer, sizeof(buffer));
+		if (n <= 0) {
+			printf("Lost the connection to the active server\n");
+			::close(m_fd);
+			m_fd = -1;
+			continue;
+		}
+		text.append(buffer, n);
+
+		std::string::size_type start = 0U;
+		for (auto eol = text.find('\n'); text.npos != eol; eol = text.find('\n', start)) {
+			std::vector<std::string> fields;
+			auto tab = text.find('\t', start);
+			while (tab < eol) {
+				fields.push_back(text.substr(start, tab - start));
+				start = tab + 1U;
+				tab = text.find('\t', start);
+			}
+			fields.push_back(text.substr(start, eol - start));
+			start = eol + 1U;
+			apply(fields);
+		}
+		text.erase(0, start);
+	}
+
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+	if (! m_armed)
+		fprintf(stderr, "%s the active server at %s:%u in %u seconds, starting without its state\n", connected ? "Had no snapshot or heartbeat from" : "Couldn't connect to", address.c_str(), port, REPLICATION_FIRST_WAIT);
+	for (auto it=m_ports.begin(); it!=m_ports.end(); it++)
+		state.push_back(it->second);
+	for (auto it=m_links.begin(); it!=m_links.end(); it++)
+		state.push_back(it->second);
+	for (auto it=m_users.begin(); it!=m_users.end(); it++) {
+		const auto tab = it->first.find('\t');
+		state.push_back({ "on", it->first.substr(0, tab), it->first.substr(tab + 1), it->second });
+	}
+	printf("Taking over from the active server with %u users\n", (unsigned int)m_users.size());
+	return false;
+}
+
+double CReplication::sinceHeartbeat()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_heartbeat).count();
+}
+
+void CReplication::apply(const std::vector<std::string> &fields)
+{
+	const std::string &type = fields[0];
+	if (0 == type.compare("hb")) {
+		m_heartbeat = std::chrono::steady_clock::now();
+		m_armed = true;
+	} else if (0 == type.compare("snapshot")) {
+		m_heartbeat = std::chrono::steady_clock::now();
+		m_armed = true;
+		m_links.clear();
+		m_ports.clear();
+		m_users.clear();
+	} else if (0 == type.compare("group") && 3U == fields.size()) {
+		m_links[fields[1]] = fields;
+	} else if (0 == type.compare(0, 4, "port") && 3U == fields.size()) {
+		m_ports[type + "\t" + fields[1]] = fields;
+	} else if ((0 == type.compare("on") || 0 == type.compare("off")) && 4U == fields.size()) {
+		const std::string key(fields[1] + "\t" + fields[2]);
+		if (0 == type.compare("on"))
+			m_users[key] = fields[3];
+		else
+			m_users.erase(key);
+	} else if (0 == type.compare(0, 5, "cache") && 4U == fields.size()) {
+		CCacheManager *cache = CCapture::getCache(('1' == type[5]) ? 1 : 0);
+		if (cache)
+			cache->restore(fields[1], fields[2], fields[3]);
+	} else if (0 == type.compare("update") && fields.size() >= 3U) {
+		CCacheManager *cache = CCapture::getCache(('1' == fields[1][0]) ? 1 : 0);
+		if (cache)
+			cache->replay(CAPTURE_TYPE(std::stoi(fields[2])), std::vector<std::string>(fields.begin() + 3, fields.end()));
+	}
+}
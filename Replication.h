@@ -0,0 +1,99 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+
+#include "Capture.h"
+#include "Metrics.h"
+
+// the seconds a standby waits to hear from the active server for the first time
+#define REPLICATION_FIRST_WAIT 120U
+
+// Keeps a standby server ready to take over from the active one. The active
+// server listens on the replication port. When the standby connects it is
+// sent a snapshot: the ircDDB caches, the hotspot ports, the reflector each
+// group is linked to and the users of each group. After that it is sent
+// every cache update and every user record as they happen, and every second
+// a heartbeat with the group links. The standby doesn't open the G2 port,
+// log in to ircDDB or link to the reflectors. When it has had no heartbeat
+// for the timeout it does all of those, with the users and links it was
+// sent. Until it has had a snapshot or a heartbeat, it waits much longer, so
+// a standby started first, or an active server that is slow to restart,
+// doesn't leave two active servers. The active server only accepts the
+// standby's address, and each proves to the other that it has the shared
+// secret, with an HMAC of a nonce from the other, before anything is sent.
+// Each record is a line of tab separated fields.
+class CReplication {
+public:
+	// the active server: listens on local:port for the standby at peer, returns true if it can't
+	static bool listen(const std::string &local, const std::string &peer, unsigned short port, const std::string &secret);
+	static void close();
+	static bool isSending() { return m_sending; }
+	// true once after a standby connects, then the routing thread sends it a snapshot
+	static bool snapshotWanted() { return m_snapshotWanted.exchange(false); }
+	static void snapshot(const std::string &state);
+	static void send(const std::string &record);
+	static void cache(CAPTURE_TYPE type, const CCacheManager *cache, const std::vector<std::string> &fields);
+
+	// the standby: follows the server at address, applying the cache updates as they come, until it has
+	// had no heartbeat for timeout seconds, or hasn't heard from it at all for REPLICATION_FIRST_WAIT. Returns true if killed is set first, otherwise state has the
+	// port, group and user records to take over with.
+	static bool follow(const std::string &address, unsigned short port, const std::string &secret, unsigned int timeout, const std::atomic<bool> &killed, std::vector<std::vector<std::string>> &state);
+	// the seconds since the last heartbeat, or since follow() started if there wasn't one
+	static double sinceHeartbeat();
+
+private:
+	static void run();
+	static bool connect(const std::string &address, unsigned short port);
+	// the handshake on a new connection, returns true if the other side doesn't have the secret
+	static bool authenticate(int fd, bool active);
+	static void apply(const std::vector<std::string> &fields);
+
+	// the active server
+	static int m_listen;
+	static std::atomic<bool> m_sending;			// a standby is connected
+	static std::atomic<bool> m_snapshotWanted;
+	static std::mutex m_mutex;					// for m_queue and m_running
+	static std::condition_variable m_wake;
+	static std::deque<std::string> m_queue;
+	static std::future<void> m_thread;
+	static bool m_running;
+	static CMetric m_records, m_standby;
+	static std::string m_peer;					// the standby's address
+
+	// both
+	static std::string m_secret;
+
+	// the standby
+	static int m_fd;
+	static std::chrono::steady_clock::time_point m_heartbeat;
+	static bool m_armed;		// a snapshot or a heartbeat has come, so the timeout applies
+	static std::map<std::string, std::vector<std::string>> m_links;	// by group
+	static std::map<std::string, std::vector<std::string>> m_ports;	// by handler and address
+	static std::map<std::string, std::string> m_users;				// the time of the last header, by group and user
+};
@@ -0,0 +1,247 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "Resolver.h"
+#include "Capture.h"
+
+#define RESOLVER_FIRST_RETRY 30
+#define RESOLVER_MAX_RETRY 300
+
+CCacheManager *CResolver::m_cache = NULL;
+std::string CResolver::m_file;
+time_t CResolver::m_ttl = 0;
+std::mutex CResolver::m_mutex;
+std::condition_variable CResolver::m_wake;
+std::unordered_map<std::string, CResolver::CEntry> CResolver::m_entries;
+std::deque<std::string> CResolver::m_queue;
+std::vector<std::future<void>> CResolver::m_threads;
+unsigned int CResolver::m_busy = 0U;
+bool CResolver::m_running = false;
+bool CResolver::m_dirty = false;
+CMetric CResolver::m_lookups;
+CMetric CResolver::m_failures;
+CMetric CResolver::m_pending;
+
+void CResolver::open(CCacheManager *cache, const std::string &file, unsigned int hours, unsigned int count)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_cache = cache;
+	m_ttl = time_t(hours) * 3600;
+	m_running = true;
+	m_busy = 0U;
+	m_dirty = false;
+
+	// the capture already has the addresses the server found
+	if (CReplay::isActive())
+		return;
+
+	m_file.assign(file);
+	load();
+
+	CMetrics::add(&m_lookups, "sgs_resolver_lookups_total", "", &m_lookups);
+	CMetrics::add(&m_lookups, "sgs_resolver_failures_total", "", &m_failures);
+	CMetrics::add(&m_lookups, "sgs_resolver_pending", "", &m_pending);
+
+	for (unsigned int i=0; i<count; i++)
+		m_threads.push_back(std::async(std::launch::async, &CResolver::run));
+}
+
+void CResolver::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	m_wake.notify_all();
+	for (auto it=m_threads.begin(); it!=m_threads.end(); it++)
+		it->get();
+	m_threads.clear();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	CMetrics::remove(&m_lookups);
+	if (m_dirty)
+		save();
+	m_queue.clear();
+	m_entries.clear();
+}
+
+void CResolver::add(const std::string &gate, const std::string &host)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (CReplay::isActive() || ! m_running)
+		return;
+
+	CEntry &entry = m_entries[host];
+	if (entry.gates.end() != std::find(entry.gates.begin(), entry.gates.end(), gate))
+		return;
+	entry.gates.push_back(gate);
+
+	// an expired address is better than none until the lookup is done
+	if (entry.address.size())
+		m_cache->updateGate(gate, entry.address);
+
+	if (time(NULL) >= entry.due)
+		queue(host, entry);
+}
+
+void CResolver::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto it=m_entries.begin(); it!=m_entries.end(); it++)
+		it->second.gates.clear();
+}
+
+// m_mutex is locked
+void CResolver::queue(const std::string &host, CEntry &entry)
+{
+	if (entry.queued)
+		return;
+	entry.queued = true;
+	m_queue.push_back(host);
+	m_pending.set(long(m_queue.size() + m_busy));
+	m_wake.notify_one();
+}
+
+void CResolver::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_running) {
+		if (m_queue.empty()) {
+			if (std::cv_status::timeout == m_wake.wait_for(lock, std::chrono::seconds(RESOLVER_FIRST_RETRY)))
+				refresh();
+			continue;
+		}
+
+		const std::string host(m_queue.front());
+		m_queue.pop_front();
+		m_busy++;
+		lock.unlock();
+		const std::string address(lookup(host));
+		lock.lock();
+		m_busy--;
+		m_lookups.add();
+
+		CEntry &entry = m_entries[host];
+		entry.queued = false;
+		const time_t now = time(NULL);
+		if (address.empty()) {
+			// a name server that didn't answer shouldn't keep a group unlinked until the address expires
+			m_failures.add();
+			entry.backoff = entry.backoff ? std::min(entry.backoff * 2, time_t(RESOLVER_MAX_RETRY)) : time_t(RESOLVER_FIRST_RETRY);
+			entry.due = now + entry.backoff;
+		} else {
+			if (address.compare(entry.address)) {
+				for (auto it=entry.gates.begin(); it!=entry.gates.end(); it++)
+					m_cache->updateGate(*it, address);
+				entry.address.assign(address);
+			}
+			entry.found = now;
+			entry.due = now + m_ttl;
+			entry.backoff = 0;
+			m_dirty = true;
+		}
+		m_pending.set(long(m_queue.size() + m_busy));
+
+		if (m_queue.empty() && 0U == m_busy && m_dirty)
+			save();
+	}
+}
+
+std::string CResolver::lookup(const std::string &host)
+{
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_INET;	// the reflector links are IPv4
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host.c_str(), NULL, &hints, &res))
+		return std::string();
+
+	char str[INET_ADDRSTRLEN];
+	std::string address;
+	if (inet_ntop(AF_INET, &((struct sockaddr_in *)res->ai_addr)->sin_addr, str, INET_ADDRSTRLEN))
+		address.assign(str);
+	freeaddrinfo(res);
+	return address;
+}
+
+// m_mutex is locked, queues the hosts that are in use whose address has expired, or whose lookup failed
+void CResolver::refresh()
+{
+	const time_t now = time(NULL);
+	for (auto it=m_entries.begin(); it!=m_entries.end(); it++) {
+		if (it->second.gates.size() && now >= it->second.due)
+			queue(it->first, it->second);
+	}
+}
+
+// m_mutex is locked, each line of the file is a host, its address and when it was found
+void CResolver::load()
+{
+	if (m_file.empty())
+		return;
+
+	std::ifstream file(m_file);
+	std::string host, address;
+	time_t found;
+	unsigned int count = 0U;
+	while (file >> host >> address >> found) {
+		CEntry &entry = m_entries[host];
+		entry.address.assign(address);
+		entry.found = found;
+		entry.due = found + m_ttl;
+		count++;
+	}
+	if (count)
+		printf("Read %u reflector addresses from %s\n", count, m_file.c_str());
+}
+
+// m_mutex is locked, only the hosts in use are saved
+void CResolver::save()
+{
+	m_dirty = false;
+	if (m_file.empty())
+		return;
+
+	const std::string temp(m_file + ".tmp");
+	FILE *fp = fopen(temp.c_str(), "w");
+	if (NULL == fp) {
+		fprintf(stderr, "Can't save the reflector addresses to %s: %s\n", temp.c_str(), strerror(errno));
+		return;
+	}
+	unsigned int count = 0U;
+	for (auto it=m_entries.begin(); it!=m_entries.end(); it++) {
+		if (it->second.gates.size() && it->second.address.size()) {
+			fprintf(fp, "%s %s %ld\n", it->first.c_str(), it->second.address.c_str(), long(it->second.found));
+			count++;
+		}
+	}
+	if (fclose(fp) || rename(temp.c_str(), m_file.c_str()))
+		fprintf(stderr, "Can't save the reflector addresses to %s: %s\n", m_file.c_str(), strerror(errno));
+	else
+		printf("Saved %u reflector addresses to %s\n", count, m_file.c_str());
+}
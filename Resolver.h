@@ -0,0 +1,86 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+
+#include "CacheManager.h"
+#include "Metrics.h"
+
+// Finds the addresses of the reflectors in the host files. Looking up a
+// thousand names one after the other could hold up routing for minutes, so
+// a few threads do the lookups with getaddrinfo() and each address goes into
+// the ircDDB cache as soon as it's found. The addresses are saved to a file,
+// and at the next start those that haven't expired are used at once, without
+// a lookup, and those that have are used until their lookup is done. While
+// the server runs, an address is looked up again when it expires. A lookup
+// that fails is tried again after 30 seconds, then after twice as long each
+// time, up to 5 minutes.
+class CResolver {
+public:
+	// reads the addresses saved in file, if there is one, and starts count lookup threads
+	static void open(CCacheManager *cache, const std::string &file, unsigned int hours, unsigned int count);
+	// lets the lookups that have started finish, then saves the addresses
+	static void close();
+
+	// the address of host is put in the cache for gate
+	static void add(const std::string &gate, const std::string &host);
+	// forgets which gates use each host, before the host files are read again, but not the addresses
+	static void clear();
+
+private:
+	class CEntry {
+	public:
+		CEntry() : found(0), due(0), backoff(0), queued(false) {}
+
+		std::string address;	// empty until a lookup succeeds
+		time_t found;			// when address was found
+		time_t due;				// when it's to be looked up again
+		time_t backoff;			// the seconds to wait after a failed lookup, 0 after one that succeeded
+		bool queued;
+		std::vector<std::string> gates;
+	};
+
+	static void run();
+	static std::string lookup(const std::string &host);
+	static void queue(const std::string &host, CEntry &entry);
+	static void refresh();
+	static void load();
+	static void save();
+
+	static CCacheManager *m_cache;
+	static std::string m_file;
+	static time_t m_ttl;
+	static std::mutex m_mutex;	// for everything below
+	static std::condition_variable m_wake;
+	static std::unordered_map<std::string, CEntry> m_entries;	// by host
+	static std::deque<std::string> m_queue;
+	static std::vector<std::future<void>> m_threads;
+	static unsigned int m_busy;		// lookups in progress
+	static bool m_running;
+	static bool m_dirty;			// found addresses that haven't been saved
+	static CMetric m_lookups, m_failures, m_pending;
+};
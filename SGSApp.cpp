@@ -21,6 +21,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <csignal>
+#include <cstring>
 #include <string>
 
 #include "SGSConfig.h"
@@ -28,12 +29,33 @@
 #include "Version.h"
 #include "IRCDDB.h"
 #include "Utils.h"
+#include "Capture.h"
+#include "Log.h"
+#include "GroupHandler.h"
 
 int main(int argc, char *argv[])
 {
 	setbuf(stdout, NULL);
+	if (4 == argc && 0 == strcmp(argv[1], "-r")) {
+		// play a capture file through the routing thread instead of using the network
+		if (CReplay::open(argv[2]))
+			return 1;
+		argv[1] = argv[3];
+		argc = 2;
+	}
+
+	bool upgrade = false;
+	if (3 == argc && 0 == strcmp(argv[1], "-u")) {
+		// take over the sockets and the state of the server that is running
+		upgrade = true;
+		argv[1] = argv[2];
+		argc = 2;
+	}
+
 	if (2 != argc) {
 		printf("usage: %s path_to_config_file\n", argv[0]);
+		printf("       %s -r capture_file path_to_config_file\n", argv[0]);
+		printf("       %s -u path_to_config_file\n", argv[0]);
 		printf("       %s --version\n", argv[0]);
 		return 1;
 	}
@@ -47,7 +69,7 @@ int main(int argc, char *argv[])
 
 	std::string cfgFile(argv[1]);
 
-	CSGSApp gateway(cfgFile);
+	CSGSApp gateway(cfgFile, upgrade);
 
 	if (!gateway.init()) {
 		return 1;
@@ -58,7 +80,7 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
-CSGSApp::CSGSApp(const std::string &configFile) : m_configFile(configFile), m_thread(NULL)
+CSGSApp::CSGSApp(const std::string &configFile, bool upgrade) : m_configFile(configFile), m_upgrade(upgrade), m_thread(NULL)
 {
 }
 
@@ -74,10 +96,12 @@ bool CSGSApp::init()
 void CSGSApp::run()
 {
 	std::signal(SIGTERM, CSGSThread::SignalCatch);
-	std::signal(SIGHUP,  CSGSThread::SignalCatch);
+	std::signal(SIGHUP,  CSGSThread::ReloadCatch);
 	std::signal(SIGINT,  CSGSThread::SignalCatch);
 
+	CLog::open();
 	m_thread->run();
+	CLog::close();
 
 	printf("exiting\n");
 }
@@ -86,6 +110,7 @@ bool CSGSApp::createThread()
 {
 	CSGSConfig config(m_configFile);
 	m_thread = new CSGSThread(config.getLinkCount("XRF"), config.getLinkCount("DCS"));
+	m_thread->setConfigFile(m_configFile);
 
 	std::string CallSign;
 	config.getGateway(CallSign);
@@ -95,13 +120,42 @@ bool CSGSApp::createThread()
 
 	printf("Gateway callsign set to %s\n", CallSign.c_str());
 
+	std::string role, replicationAddress, replicationLocal, takeover, secret;
+	unsigned short replicationPort;
+	unsigned int replicationTimeout;
+	config.getReplication(role, replicationAddress, replicationLocal, replicationPort, replicationTimeout, takeover, secret);
+	const bool standby = (0 == role.compare("standby"));
+	if (standby || 0 == role.compare("active")) {
+		if (replicationAddress.empty()) {
+			fprintf(stderr, "Replication needs the address of the %s server\n", standby ? "active" : "standby");
+			return false;
+		}
+		if (! standby && replicationLocal.empty()) {
+			fprintf(stderr, "The active server needs the local address to listen for the standby on\n");
+			return false;
+		}
+		if (secret.empty()) {
+			fprintf(stderr, "Replication needs a secret, shared by the active server and the standby\n");
+			return false;
+		}
+		m_thread->setReplication(standby, replicationAddress, replicationLocal, replicationPort, replicationTimeout, takeover, secret);
+	} else if (role.size())
+		fprintf(stderr, "Unknown replication role '%s', replication is off\n", role.c_str());
+
+	std::string peers;
+	unsigned short federationPort;
+	if (config.getFederation(federationPort, peers))
+		return false;
+	m_thread->setFederation(federationPort, peers);
+
 	for (unsigned int i=0; i<config.getIRCCount(); i++) {
 		std::string hostname, username, password;
 		config.getIrcDDB(i, hostname, username, password);
 
 		if (hostname.size() && username.size()) {
 			CIRCDDB *ircDDB = new CIRCDDB(hostname, 9007U, username, password, std::string("linux_SmartGroupServer") + std::string("-") + VERSION);
-			bool res = ircDDB->open();
+			// a standby logs in when it takes over
+			bool res = (CReplay::isActive() || standby) ? true : ircDDB->open();
 			if (!res) {
 				printf("Cannot initialise the ircDDB protocol handler\n");
 				return false;
@@ -140,6 +194,50 @@ bool CSGSApp::createThread()
 	printf("Remote control is %sabled, port set to %u, using IPV%c\n", remoteEnabled ? "en" : "dis", remotePort, remoteIPV6 ? '6' : '4');
 	m_thread->setRemote(remoteEnabled, remotePassword, remotePort, remoteIPV6);
 
+	bool metricsEnabled;
+	std::string metricsAddress;
+	unsigned short metricsPort;
+	config.getMetrics(metricsEnabled, metricsAddress, metricsPort);
+	m_thread->setMetrics(metricsEnabled, metricsAddress, metricsPort);
+
+	std::string captureFile;
+	config.getCapture(captureFile);
+	m_thread->setCapture(captureFile);
+	std::string upgradeSocket;
+	config.getUpgrade(upgradeSocket);
+	if (m_upgrade && upgradeSocket.empty()) {
+		fprintf(stderr, "There is no upgrade socket in %s to take over from\n", m_configFile.c_str());
+		return false;
+	}
+	m_thread->setUpgrade(upgradeSocket, m_upgrade);
+	std::string journalFile;
+	config.getJournal(journalFile);
+	m_thread->setJournal(journalFile);
+	m_thread->setWorkers(config.getWorkers());
+	unsigned int receiveSockets;
+	bool steerByAddress;
+	config.getReceiveSockets(receiveSockets, steerByAddress);
+	m_thread->setReceiveSockets(receiveSockets, steerByAddress);
+	m_thread->setG2Port(config.getG2Port());
+
+	std::string addressFile;
+	unsigned int addressHours, lookupThreads;
+	config.getReflectors(addressFile, addressHours, lookupThreads);
+	m_thread->setResolver(addressFile, addressHours, lookupThreads);
+
+	std::string arbitration, priority;
+	config.getArbitration(arbitration, priority);
+	if (CGroupHandler::setArbitration(arbitration, priority))
+		fprintf(stderr, "Unknown arbitration '%s', the first stream keeps a group\n", arbitration.c_str());
+
+	std::string logLevel;
+	config.getLogLevel(logLevel);
+	LOG_LEVEL level;
+	if (CLog::parseLevel(logLevel, level))
+		fprintf(stderr, "Unknown log level '%s', using info\n", logLevel.c_str());
+	else
+		CLog::setLevel(level);
+
 	m_thread->setCallsign(CallSign);
 
 	return true;
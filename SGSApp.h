@@ -25,7 +25,7 @@
 class CSGSApp
 {
 public:
-	CSGSApp(const std::string &configFile);
+	CSGSApp(const std::string &configFile, bool upgrade);
 	~CSGSApp();
 
 	bool init();
@@ -33,6 +33,7 @@ public:
 
 private:
 	std::string m_configFile;
+	bool m_upgrade;		// take over from the server that is running
 	CSGSThread *m_thread;
 
 	bool createThread();
@@ -18,12 +18,20 @@
  */
 
 #include <string>
+#include <cstdlib>
+#include <arpa/inet.h>
 
 #include "Utils.h"
+#include "DStarDefines.h"
 #include "SGSConfig.h"
 
+#ifndef CFG_DIR
+#define CFG_DIR "/usr/local/etc"
+#endif
 
-CSGSConfig::CSGSConfig(const std::string &pathname)
+
+CSGSConfig::CSGSConfig(const std::string &pathname) :
+m_federationValid(true)
 {
 
 	if (pathname.size() < 1) {
@@ -230,6 +238,89 @@ CSGSConfig::CSGSConfig(const std::string &pathname)
 		m_ipv6 = false;
 		printf("Remote disabled\n");
 	}
+
+	// metrics
+	get_value(cfg, "metrics.enabled", m_metricsEnabled, false);
+	if (m_metricsEnabled) {
+		get_value(cfg, "metrics.address", m_metricsAddress, 7, 45, "127.0.0.1");
+		int ivalue;
+		get_value(cfg, "metrics.port", ivalue, 1000, 65000, 9101);
+		m_metricsPort = (unsigned short)ivalue;
+		printf("Metrics enabled: address=%s, port=%u\n", m_metricsAddress.c_str(), m_metricsPort);
+	} else {
+		m_metricsPort = 0U;
+		m_metricsAddress.clear();
+		printf("Metrics disabled\n");
+	}
+
+	// traffic capture, for replaying with sgs -r
+	get_value(cfg, "capture.file", m_captureFile, 0, 255, "");
+	if (m_captureFile.size())
+		printf("Capture file: %s\n", m_captureFile.c_str());
+
+	// where a new binary asks for the sockets, for sgs -u
+	get_value(cfg, "upgrade.socket", m_upgradeSocket, 0, 100, "");
+
+	// the users are kept here across restarts
+	get_value(cfg, "journal.file", m_journalFile, 0, 255, "");
+
+	// the active server sends its state to a standby, which takes over when the heartbeats stop
+	get_value(cfg, "replication.role", m_replicationRole, 0, 16, "");
+	// the other server's address, and this one's, which it listens on when it's the active server
+	get_value(cfg, "replication.address", m_replicationAddress, 0, 64, "");
+	get_value(cfg, "replication.local", m_replicationLocal, 0, 64, "");
+	get_value(cfg, "replication.secret", m_replicationSecret, 0, 255, "");
+	int port;
+	get_value(cfg, "replication.port", port, 1024, 65535, 40600);
+	m_replicationPort = (unsigned short)port;
+	int timeout;
+	get_value(cfg, "replication.timeout", timeout, 1, 60, 3);
+	m_replicationTimeout = (unsigned int)timeout;
+	get_value(cfg, "replication.takeover", m_takeoverCommand, 0, 255, "");
+	if (m_replicationRole.size())
+		printf("Replication: role=%s, address=%s, local=%s, port=%u, timeout=%u\n", m_replicationRole.c_str(), m_replicationAddress.c_str(), m_replicationLocal.c_str(), m_replicationPort, m_replicationTimeout);
+
+	// other servers sharing the Smart Groups, as address:port, separated by commas
+	get_value(cfg, "federation.peers", m_federationPeers, 0, 1024, "");
+	get_value(cfg, "federation.port", port, 1024, 65535, 40700);
+	m_federationPort = (unsigned short)port;
+	m_federationValid = checkPeers(m_federationPeers);
+	if (m_federationPeers.size())
+		printf("Federation: port=%u, peers=%s\n", m_federationPort, m_federationPeers.c_str());
+
+	// the lowest severity that is logged: debug, info, warning or error
+	get_value(cfg, "log.level", m_logLevel, 4, 7, "info");
+
+	// threads that the groups, and their reflector links, are split over, 0 keeps them on the routing thread
+	int threads;
+	get_value(cfg, "routing.workers", threads, 0, 16, 0);
+	m_workers = (unsigned int)threads;
+	if (m_workers)
+		printf("Workers: %u\n", m_workers);
+
+	// SO_REUSEPORT sockets, each with a thread, that read the G2 port, 0 reads it from the routing thread
+	get_value(cfg, "routing.receive_sockets", threads, 0, 16, 0);
+	m_receiveSockets = (unsigned int)threads;
+	get_value(cfg, "routing.steer_by_address", m_steerByAddress, false);
+	if (m_receiveSockets)
+		printf("Receive sockets: %u%s\n", m_receiveSockets, m_steerByAddress ? ", steered by address" : "");
+
+	// the IPv4 G2 port, only changed for servers sharing one host
+	get_value(cfg, "routing.g2_port", port, 1024, 65535, G2_DV_PORT);
+	m_g2Port = (unsigned short)port;
+	if (G2_DV_PORT != m_g2Port)
+		printf("G2 port: %u\n", m_g2Port);
+
+	// who gets a group when two streams want it: first, priority, local or reflector
+	get_value(cfg, "routing.arbitration", m_arbitration, 5, 9, "first");
+	get_value(cfg, "routing.priority", m_priority, 0, 1023, "");
+
+	// the reflector hosts are looked up in the background, and the addresses saved for the next start
+	get_value(cfg, "reflectors.lookup_threads", threads, 1, 64, 8);
+	m_lookupThreads = (unsigned int)threads;
+	get_value(cfg, "reflectors.address_file", m_addressFile, 0, 255, CFG_DIR "/Reflector_Addresses.txt");
+	get_value(cfg, "reflectors.address_hours", threads, 0, 8760, 24);
+	m_addressHours = (unsigned int)threads;
 }
 
 CSGSConfig::~CSGSConfig()
@@ -264,6 +355,33 @@ unsigned int CSGSConfig::getLinkCount(const char *type)
 	return count;
 }
 
+// each of the comma separated peers has to be an IPv4 address:port
+bool CSGSConfig::checkPeers(const std::string &peers) const
+{
+	bool valid = true;
+	std::string::size_type start = 0U;
+	while (start < peers.size()) {
+		auto comma = peers.find(',', start);
+		if (peers.npos == comma)
+			comma = peers.size();
+		std::string peer(peers.substr(start, comma - start));
+		start = comma + 1U;
+		peer.erase(0, peer.find_first_not_of(' '));
+		peer.erase(peer.find_last_not_of(' ') + 1U);
+		if (peer.empty())
+			continue;
+
+		const auto colon = peer.rfind(':');
+		struct in_addr addr;
+		const unsigned long port = (peer.npos == colon) ? 0UL : strtoul(peer.c_str() + colon + 1, NULL, 10);
+		if (0UL == port || port > 65535UL || 1 != inet_pton(AF_INET, peer.substr(0, colon).c_str(), &addr)) {
+			fprintf(stderr, "Improper federation peer [%s], it should be address:port\n", peer.c_str());
+			valid = false;
+		}
+	}
+	return valid;
+}
+
 bool CSGSConfig::get_value(const Config &cfg, const char *path, int &value, int min, int max, int default_value)
 {
 	if (cfg.lookupValue(path, value)) {
@@ -326,3 +444,77 @@ void CSGSConfig::getRemote(bool &enabled, std::string &password, unsigned short
 	port     = m_remotePort;
 	is_ipv6  = m_ipv6;
 }
+
+void CSGSConfig::getCapture(std::string &file) const
+{
+	file = m_captureFile;
+}
+
+void CSGSConfig::getUpgrade(std::string &socket) const
+{
+	socket = m_upgradeSocket;
+}
+
+void CSGSConfig::getReplication(std::string &role, std::string &address, std::string &local, unsigned short &port, unsigned int &timeout, std::string &takeover, std::string &secret) const
+{
+	role = m_replicationRole;
+	address = m_replicationAddress;
+	local = m_replicationLocal;
+	secret = m_replicationSecret;
+	port = m_replicationPort;
+	timeout = m_replicationTimeout;
+	takeover = m_takeoverCommand;
+}
+
+bool CSGSConfig::getFederation(unsigned short &port, std::string &peers) const
+{
+	port = m_federationPort;
+	peers = m_federationPeers;
+	return ! m_federationValid;
+}
+
+void CSGSConfig::getJournal(std::string &file) const
+{
+	file = m_journalFile;
+}
+
+void CSGSConfig::getLogLevel(std::string &level) const
+{
+	level = m_logLevel;
+}
+
+unsigned int CSGSConfig::getWorkers() const
+{
+	return m_workers;
+}
+
+void CSGSConfig::getReceiveSockets(unsigned int &count, bool &steer) const
+{
+	count = m_receiveSockets;
+	steer = m_steerByAddress;
+}
+
+unsigned short CSGSConfig::getG2Port() const
+{
+	return m_g2Port;
+}
+
+void CSGSConfig::getReflectors(std::string &file, unsigned int &hours, unsigned int &threads) const
+{
+	file = m_addressFile;
+	hours = m_addressHours;
+	threads = m_lookupThreads;
+}
+
+void CSGSConfig::getArbitration(std::string &policy, std::string &priority) const
+{
+	policy = m_arbitration;
+	priority = m_priority;
+}
+
+void CSGSConfig::getMetrics(bool &enabled, std::string &address, unsigned short &port) const
+{
+	enabled = m_metricsEnabled;
+	address = m_metricsAddress;
+	port    = m_metricsPort;
+}
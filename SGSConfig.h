@@ -53,12 +53,26 @@ public:
 	void getGroup(unsigned int mod, std::string &band, std::string &callsign, std::string &logoff, std::string &info, unsigned int &userTimeout, bool &listen_only, bool &showlink, std::string &reflector) const;
 
 	void getRemote(bool &enabled, std::string &password, unsigned short &port, bool &is_ipv6) const;
+	void getMetrics(bool &enabled, std::string &address, unsigned short &port) const;
+	void getCapture(std::string &file) const;
+	void getUpgrade(std::string &socket) const;
+	void getJournal(std::string &file) const;
+	void getReplication(std::string &role, std::string &address, std::string &local, unsigned short &port, unsigned int &timeout, std::string &takeover, std::string &secret) const;
+	// returns true if one of the peers isn't address:port
+	bool getFederation(unsigned short &port, std::string &peers) const;
+	void getLogLevel(std::string &level) const;
+	unsigned int getWorkers() const;
+	void getReceiveSockets(unsigned int &count, bool &steer) const;
+	unsigned short getG2Port() const;
+	void getArbitration(std::string &policy, std::string &priority) const;
+	void getReflectors(std::string &file, unsigned int &hours, unsigned int &threads) const;
 
 	unsigned int getModCount();
 	unsigned int getLinkCount(const char *type);
 	unsigned int getIRCCount();
 
 private:
+	bool checkPeers(const std::string &peers) const;
 	bool get_value(const Config &cfg, const char *path, int &value, int min, int max, int default_value);
 	bool get_value(const Config &cfg, const char *path, bool &value, bool default_value);
 	bool get_value(const Config &cfg, const char *path, std::string &value, int min, int max, const char *default_value);
@@ -72,5 +86,35 @@ private:
 	std::string m_remotePassword;
 	unsigned short m_remotePort;
 	bool m_ipv6;
+
+	bool m_metricsEnabled;
+	std::string m_metricsAddress;
+	unsigned short m_metricsPort;
+
+	std::string m_captureFile;
+	std::string m_upgradeSocket;
+	std::string m_journalFile;
+	std::string m_replicationRole;
+	std::string m_replicationAddress;
+	std::string m_replicationLocal;
+	std::string m_replicationSecret;
+	unsigned short m_replicationPort;
+	unsigned int m_replicationTimeout;
+	std::string m_takeoverCommand;
+	unsigned short m_federationPort;
+	std::string m_federationPeers;
+	bool m_federationValid;
+
+	std::string m_logLevel;
+
+	unsigned int m_workers;
+	unsigned int m_receiveSockets;
+	unsigned short m_g2Port;
+	bool m_steerByAddress;
+	std::string m_arbitration;
+	std::string m_priority;
+	std::string m_addressFile;
+	unsigned int m_addressHours;
+	unsigned int m_lookupThreads;
 }
 ;
@@ -23,11 +23,14 @@
 #include <sys/stat.h>
 #include <netdb.h>
 #include <pwd.h>
+#include <unistd.h>
 #include <signal.h>
 #include <ctime>
 #include <fstream>
 #include <cstring>
 #include <cassert>
+#include <set>
+#include <sstream>
 
 #include "SGSThread.h"
 #include "GroupHandler.h"
@@ -37,9 +40,22 @@
 #include "G2Handler.h"
 #include "AMBEData.h"
 #include "Utils.h"
+#include "ObjectPool.h"
+#include "Capture.h"
+#include "Resolver.h"
+#include "SGSConfig.h"
+#include "Log.h"
+#include "LoopProfiler.h"
+#include "Workers.h"
+#include "Keepalive.h"
+#include "Upgrade.h"
+#include "Journal.h"
+#include "Replication.h"
+#include "Federation.h"
 
 const unsigned int REMOTE_DUMMY_PORT = 65015U;
 std::atomic<bool> CSGSThread::m_killed(false);
+std::atomic<bool> CSGSThread::m_reload(false);
 
 CSGSThread::CSGSThread(unsigned int countDExtra, unsigned int countDCS) :
 m_countDExtra(countDExtra),
@@ -53,7 +69,24 @@ m_lastStatus(IS_DISCONNECTED),
 m_remoteEnabled(false),
 m_remotePassword(),
 m_remotePort(0U),
-m_remote(NULL)
+m_remote(NULL),
+m_metricsEnabled(false),
+m_metricsPort(0U),
+m_workers(0U),
+m_receiveSockets(0U),
+m_steerByAddress(false),
+m_g2Port(G2_DV_PORT),
+m_loopSeconds({ 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05 }),
+m_hostsHours(24U),
+m_resolveThreads(8U),
+m_upgrade(false),
+m_handedOff(false),
+m_standby(false),
+m_replicationPort(0U),
+m_replicationTimeout(3U),
+m_heartbeatTimer(1000U, 1U),
+m_heartbeats(0U),
+m_federationPort(40700U)
 {
 	m_g2Handler[0] = m_g2Handler[1] = NULL;
 	m_irc[0] = m_irc[1] = NULL;
@@ -72,26 +105,51 @@ CSGSThread::~CSGSThread()
 }
 
 void CSGSThread::run() {
+	std::vector<int> sockets;
+	std::vector<std::vector<std::string>> state;	// of the server this one takes over from
+	if (m_standby && ! CReplay::isActive()) {
+		if (CReplication::follow(m_replicationAddress, m_replicationPort, m_replicationSecret, m_replicationTimeout, m_killed, state)) {
+			for (int i=0; i<2; i++) {
+				if (m_irc[i]) {
+					m_irc[i]->close();
+					delete m_irc[i];
+				}
+			}
+			return;
+		}
+		if (m_takeoverCommand.size() && system(m_takeoverCommand.c_str()))
+			fprintf(stderr, "The takeover command \"%s\" failed\n", m_takeoverCommand.c_str());
+		for (int i=0; m_irc[i] && i<2; i++)
+			m_irc[i]->open();
+	}
+
 	int family[2] = { AF_UNSPEC, AF_UNSPEC };
 	for (int i=0; m_irc[i] && i<2; i++) {
+		if (CReplay::isActive())	// the ircDDB servers aren't used in a replay
+			family[i] = CReplay::getFamily(i);
 		while (AF_UNSPEC == family[i]) {
 			std::this_thread::sleep_for(std::chrono::milliseconds(200));
 			family[i] = m_irc[i]->GetFamily();
 		}
 		printf("IRC Server %d family is %s\n", i, ((AF_INET==family[i]) ? "IPV4" : ((AF_INET6==family[i]) ? "IPV6" : "Family UNSPECIFIED")));
-		if (AF_INET6 == family[i])
-			m_g2Handler[i] = new CG2ProtocolHandler(family[i], G2_IPV6_PORT);
-		else
-			m_g2Handler[i] = new CG2ProtocolHandler(family[i], G2_DV_PORT);
-
-		bool ret = m_g2Handler[i]->open();
-		if (!ret) {
-			printf("Could not open the G2 protocol handler\n");
-			delete m_g2Handler[i];
-			m_g2Handler[i] = NULL;
-		}
 	}
 
+	if (m_captureFile.size())
+		CCapture::open(m_captureFile, family[0], family[1]);
+
+	// the groups are owned by the workers, and the port maps have a copy for each
+	CWorkers::open(m_workers);
+	for (auto it=m_groups.begin(); it!=m_groups.end(); it++)
+		CGroupHandler::add(it->callsign, it->logoff, it->repeater, it->infoText, it->userTimeout, it->listenOnly, it->showlink, it->reflector);
+	m_groups.clear();
+
+	if (m_upgrade && ! CReplay::isActive())
+		receiveState(sockets, state);
+	openG2(family, sockets, state);
+	const bool tookOver = state.size() > 0U;
+	if (tookOver)
+		printf("Took over %u users\n", restoreGroups(state));
+
 	if (m_irc[1] && family[0] == family[1]) {
 		fprintf(stderr, "Each irc server must be from a different IP family\n");
 		m_killed = true;
@@ -107,6 +165,7 @@ void CSGSThread::run() {
 		std::this_thread::sleep_for(std::chrono::milliseconds(500));
 
 	if (m_killed) {
+		CWorkers::close();
 		for (int i=0; i<2; i++) {
 			if (m_g2Handler[i]) {
 				m_g2Handler[i]->close();
@@ -123,6 +182,7 @@ void CSGSThread::run() {
 
 	printf("Starting the Smart Group Server thread\n");
 
+	CResolver::open(&m_irc[m_irc[1] ? 1 : 0]->cache, m_hostsFile, m_hostsHours, m_resolveThreads);
 	loadReflectors(DEXTRA_HOSTS_FILE_NAME, DP_DEXTRA);
 	loadReflectors(DCS_HOSTS_FILE_NAME, DP_DCS);
 	CDExtraProtocolHandlerPool dextraPool;
@@ -135,47 +195,94 @@ void CSGSThread::run() {
 
 	CGroupHandler::setGateway(m_callsign);
 	CGroupHandler::setG2Handler(m_g2Handler[0], m_g2Handler[1]);
+	CKeepalive::open(m_g2Handler[0], m_g2Handler[1]);
 	CGroupHandler::setIRC(m_irc[0], m_irc[1]);
+	if (m_journalFile.size() && ! CReplay::isActive()) {
+		std::vector<CJournalEntry> entries;
+		CJournal::open(m_journalFile, entries);
+		if (tookOver)		// the running server's users are more up to date, and its journal may not have the last of them
+			CGroupHandler::journal();
+		else
+			printf("Restored %u users from the journal\n", CGroupHandler::restore(entries));
+	}
 	if (m_countDExtra || m_countDCS)
 		CGroupHandler::link();
 
-	if (m_remoteEnabled && m_remotePassword.size() && m_remotePort > 0U) {
-		m_remote = new CRemoteHandler();
-		if (m_remote->open(m_remotePassword, m_remotePort, m_remoteIPV6)) {
-			fprintf(stderr, "Unable to create instance of CRemoteHandler\n");
-			delete m_remote;
-			m_remote = NULL;
-		}
+	CMetrics::add(this, "sgs_loop_seconds", "", &m_loopSeconds);
+	CLoopProfiler::open(TIME_PER_TIC_MS);
+	openServices();
+	if (m_upgradeSocket.size() && ! CReplay::isActive())
+		CUpgrade::listen(m_upgradeSocket);
+	if (m_standby && ! CReplay::isActive()) {
+		const double seconds = CReplication::sinceHeartbeat();
+		printf("Took over from the active server %.3f seconds after its last heartbeat\n", seconds);
+		CMetrics::add(this, "sgs_replication_failover_seconds", "", [seconds]() { return seconds; });
+	}
+	// a standby that has taken over is the active server for the next standby, on the host that failed
+	if (m_replicationPort && m_replicationLocal.size() && ! CReplay::isActive())
+		CReplication::listen(m_replicationLocal, m_replicationAddress, m_replicationPort, m_replicationSecret);
+	// a server whose shared groups aren't shared would split them without anyone knowing
+	if (m_federationPeers.size() && ! CReplay::isActive() && CFederation::open(m_federationPort, m_federationPeers)) {
+		fprintf(stderr, "Stopping, the groups can't be shared with the peers\n");
+		m_killed = true;
 	}
+	m_heartbeatTimer.start();
 
 	m_statusTimer.start();
 	auto then = std::chrono::steady_clock::now();
 	try {
 		while (!m_killed) {
+			if (CReplay::isActive() && ! CReplay::advance(TIME_PER_TIC_MS))
+				m_killed = true;
+			CLoopProfiler::start();
 			processIrcDDB(0);
+			CLoopProfiler::mark(LP_IRCDDB);
 			processG2(0);
+			CLoopProfiler::mark(LP_G2);
 			if (m_irc[1]) {
 				processIrcDDB(1);
+				CLoopProfiler::mark(LP_IRCDDB);
 				processG2(1);
+				CLoopProfiler::mark(LP_G2);
 			}
-			processDExtra(&dextraPool);
-			processDCS(&dcsPool);
+			CDExtraHandler::receive();	// the links of the groups on this thread, when there are no workers
+			CLoopProfiler::mark(LP_DEXTRA);
+			CDCSHandler::receive();
+			CLoopProfiler::mark(LP_DCS);
+			CFederation::process();
+			CLoopProfiler::mark(LP_FEDERATION);
 			if (m_remote != NULL) {
 				if (m_remote->process())
 					m_killed = true;
 			}
+			if (m_reload.exchange(false)) {
+				CWorkers::pause();	// the groups read the arbitration
+				reload();
+				CWorkers::resume();
+			}
+			if (CUpgrade::requested())
+				handOff();
+			CLoopProfiler::mark(LP_REMOTE);
 
 			auto now = std::chrono::steady_clock::now();
 			auto time_span = std::chrono::duration<double>(now - then);
 			then = now;
-			auto ms = (unsigned int)(1000.0 * time_span.count() + 0.5);
+			auto ms = CReplay::isActive() ? TIME_PER_TIC_MS : (unsigned int)(1000.0 * time_span.count() + 0.5);
 
 			m_statusTimer.clock(ms);
 			CGroupHandler::clock(ms);
+			CG2Handler::clock(ms);
+			CKeepalive::clock(ms);
+			CLoopProfiler::mark(LP_GROUP_CLOCK);
 			CDExtraHandler::clock(ms);
+			CLoopProfiler::mark(LP_DEXTRA_CLOCK);
 			CDCSHandler::clock(ms);
+			CLoopProfiler::mark(LP_DCS_CLOCK);
+			replicate(ms);
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(TIME_PER_TIC_MS));
+			m_loopSeconds.observe(CLoopProfiler::end() / 1.0e9);
+			if (! CReplay::isActive())
+				std::this_thread::sleep_for(std::chrono::milliseconds(TIME_PER_TIC_MS));
 		}
 	}
 	catch (std::exception& e) {
@@ -185,22 +292,33 @@ void CSGSThread::run() {
 		printf("Unknown exception raised\n");
 	}
 
-	printf("Logging off all users\n");
-	auto groups = CGroupHandler::listGroups();
-	for (auto it=groups.begin(); it!=groups.end(); it++) {
-		CGroupHandler *group = CGroupHandler::findGroup(*it);
-		group->LogoffUser("ALL     ");
+	CWorkers::pause();	// before anything the groups use is closed
+	CUpgrade::close();
+	CReplication::close();
+	CFederation::close();
+	m_metrics.close();
+	CMetrics::remove(this);
+	CLoopProfiler::close();
+	CKeepalive::close();
+	CResolver::close();
+	CJournal::close();	// before the users are logged off, so they are back after a restart
+	if (CReplay::isActive())
+		CReplay::report();
+
+	if (m_handedOff) {
+		printf("Leaving the users and the links to the new server\n");
+	} else {
+		printf("Logging off all users\n");
+		CGroupHandler::forEach([](CGroupHandler *group) { group->LogoffUser("ALL     "); });
 	}
 
-
 	printf("Stopping the Smart Group Server thread\n");
 
-	// Unlink from all reflectors
-	CDExtraHandler::unlink();
+	// Unlink from all reflectors, each worker from its own
+	if (! m_handedOff)
+		CWorkers::callAll([]() { CDExtraHandler::unlink(); CDCSHandler::unlink(); });
+	CWorkers::close();	// which deletes their groups and links
 	dextraPool.close();
-
-	// Unlink from all reflectors
-	CDCSHandler::unlink();
 	dcsPool.close();
 
 	m_g2Handler[0]->close();
@@ -223,6 +341,15 @@ void CSGSThread::run() {
 	if (m_remote != NULL) {
 		delete m_remote;
 	}
+
+	CCapture::close();
+	CReplay::close();
+
+	printf("Packet pools (allocated/reused): header %lu/%lu, ambe %lu/%lu, poll %lu/%lu, connect %lu/%lu\n",
+		CObjectPool<CHeaderData>::getAllocated(), CObjectPool<CHeaderData>::getReused(),
+		CObjectPool<CAMBEData>::getAllocated(), CObjectPool<CAMBEData>::getReused(),
+		CObjectPool<CPollData>::getAllocated(), CObjectPool<CPollData>::getReused(),
+		CObjectPool<CConnectData>::getAllocated(), CObjectPool<CConnectData>::getReused());
 }
 
 //void CSGSThread::kill()
@@ -240,7 +367,7 @@ void CSGSThread::setCallsign(const std::string &callsign)
 
 void CSGSThread::addGroup(const std::string &callsign, const std::string &logoff, const std::string &repeater, const std::string &infoText, unsigned int userTimeout, bool listen_only, bool showlink, const std::string &reflector)
 {
-	CGroupHandler::add(callsign, logoff, repeater, infoText, userTimeout, listen_only, showlink, reflector);
+	m_groups.push_back(CGroupSettings{ callsign, logoff, repeater, infoText, userTimeout, listen_only, showlink, reflector });
 }
 
 void CSGSThread::setIRC(const unsigned int i, CIRCDDB* irc)
@@ -248,6 +375,7 @@ void CSGSThread::setIRC(const unsigned int i, CIRCDDB* irc)
 	assert(irc != NULL);
 
 	m_irc[i] = irc;
+	CCapture::setCache(i, &irc->cache);
 }
 
 void CSGSThread::setRemote(bool enabled, const std::string& password, unsigned short port, bool is_ipv6)
@@ -265,8 +393,78 @@ void CSGSThread::setRemote(bool enabled, const std::string& password, unsigned s
 	}
 }
 
+void CSGSThread::setUpgrade(const std::string &socket, bool takeOver)
+{
+	m_upgradeSocket = socket;
+	m_upgrade = takeOver;
+}
+
+void CSGSThread::setReplication(bool standby, const std::string &address, const std::string &local, unsigned short port, unsigned int timeout, const std::string &takeover, const std::string &secret)
+{
+	m_standby = standby;
+	m_replicationAddress = address;
+	m_replicationLocal = local;
+	m_replicationSecret = secret;
+	m_replicationPort = port;
+	m_replicationTimeout = timeout;
+	m_takeoverCommand = takeover;
+}
+
+void CSGSThread::setFederation(unsigned short port, const std::string &peers)
+{
+	m_federationPort = port;
+	m_federationPeers = peers;
+}
+
+void CSGSThread::setJournal(const std::string &file)
+{
+	m_journalFile = file;
+}
+
+void CSGSThread::setCapture(const std::string &file)
+{
+	m_captureFile = file;
+}
+
+void CSGSThread::setWorkers(unsigned int count)
+{
+	m_workers = count;
+}
+
+void CSGSThread::setConfigFile(const std::string &file)
+{
+	m_configFile = file;
+}
+
+void CSGSThread::setResolver(const std::string &file, unsigned int hours, unsigned int threads)
+{
+	m_hostsFile = file;
+	m_hostsHours = hours;
+	m_resolveThreads = threads;
+}
+
+void CSGSThread::setReceiveSockets(unsigned int count, bool steer)
+{
+	m_receiveSockets = count;
+	m_steerByAddress = steer;
+}
+
+void CSGSThread::setG2Port(unsigned short port)
+{
+	m_g2Port = port;
+}
+
+void CSGSThread::setMetrics(bool enabled, const std::string &address, unsigned short port)
+{
+	m_metricsEnabled = enabled;
+	m_metricsAddress = address;
+	m_metricsPort    = port;
+}
+
 void CSGSThread::processIrcDDB(const int i)
 {
+	m_irc[i]->cache.dispatch();
+
 	// Once per second
 	if (m_statusTimer.hasExpired()) {
 		int status = m_irc[i]->getConnectionState();
@@ -296,93 +494,192 @@ void CSGSThread::processIrcDDB(const int i)
 	}
 }
 
-void CSGSThread::processDExtra(CDExtraProtocolHandlerPool *dextraPool)
+// the remote control and metrics servers, which a server that hands over closes first
+void CSGSThread::openServices()
 {
-	while (true) {
-		DEXTRA_TYPE type = dextraPool->read();
+	if (m_remoteEnabled && m_remotePassword.size() && m_remotePort > 0U) {
+		m_remote = new CRemoteHandler();
+		if (m_remote->open(m_remotePassword, m_remotePort, m_remoteIPV6)) {
+			fprintf(stderr, "Unable to create instance of CRemoteHandler\n");
+			delete m_remote;
+			m_remote = NULL;
+		}
+	}
 
-		switch (type) {
-			case DE_NONE:
-				return;
+	if (m_metricsEnabled && m_metricsPort > 0U) {
+		if (m_metrics.open(m_metricsAddress, m_metricsPort))
+			fprintf(stderr, "Unable to start the metrics server\n");
+	}
+}
 
-			case DE_POLL: {
-					CPollData* poll = dextraPool->newPoll();
-					if (poll != NULL) {
-						CDExtraHandler::process(*poll);
-						delete poll;
-					}
-				}
-				break;
+static std::vector<std::string> splitFields(const std::string &line)
+{
+	std::vector<std::string> fields;
+	std::string::size_type start = 0U;
+	while (true) {
+		const auto tab = line.find('\t', start);
+		fields.push_back(line.substr(start, tab - start));
+		if (line.npos == tab)
+			return fields;
+		start = tab + 1U;
+	}
+}
 
-			case DE_CONNECT: {
-					CConnectData* connect = dextraPool->newConnect();
-					if (connect != NULL) {
-						CDExtraHandler::process(*connect);
-						delete connect;
-					}
-				}
-				break;
+// gets the sockets and the state of the running server, when this one is an upgrade
+void CSGSThread::receiveState(std::vector<int> &sockets, std::vector<std::vector<std::string>> &state)
+{
+	std::string text;
+	if (CUpgrade::receive(m_upgradeSocket, sockets, text))
+		fprintf(stderr, "Starting without the sockets of the running server\n");
+	std::istringstream in(text);
+	std::string line;
+	while (std::getline(in, line))
+		state.push_back(splitFields(line));
+}
 
-			case DE_HEADER: {
-					CHeaderData* header = dextraPool->newHeader();
-					if (header != NULL) {
-						// printf("DExtra header - My: %s/%s  Your: %s  Rpt1: %s  Rpt2: %s\n", header->getMyCall1().c_str(), header->getMyCall2().c_str(), header->getYourCall().c_str(), header->getRptCall1().c_str(), header->getRptCall2().c_str());
-						CDExtraHandler::process(*header);
-						delete header;
-					}
-				}
-				break;
+// the G2 handlers use the sockets of the running server, if there are any, and the ports and caches of the server being taken over are put back
+void CSGSThread::openG2(const int family[2], const std::vector<int> &sockets, const std::vector<std::vector<std::string>> &state)
+{
+	unsigned int handlers = 0U, next = 0U;
+	for (int i=0; m_irc[i] && i<2; i++)
+		handlers++;
+	for (int i=0; m_irc[i] && i<2; i++) {
+		if (AF_INET6 == family[i])
+			m_g2Handler[i] = new CG2ProtocolHandler(family[i], G2_IPV6_PORT, m_receiveSockets, m_steerByAddress);
+		else
+			m_g2Handler[i] = new CG2ProtocolHandler(family[i], m_g2Port, m_receiveSockets, m_steerByAddress);
+
+		// without the state, each handler had the same number of sockets
+		unsigned int count = sockets.size() / handlers;
+		const std::string index(std::to_string(i));
+		for (auto it=state.begin(); it!=state.end(); it++) {
+			if (3U == it->size() && 0 == (*it)[0].compare("sockets") && 0 == (*it)[1].compare(index))
+				count = std::stoul((*it)[2]);
+		}
+		std::vector<int> fds;
+		for (; count && next < sockets.size(); count--)
+			fds.push_back(sockets[next++]);
 
-			case DE_AMBE: {
-					CAMBEData* data = dextraPool->newAMBE();
-					if (data != NULL) {
-						CDExtraHandler::process(*data);
-						delete data;
-					}
-				}
-				break;
+		bool ret = m_g2Handler[i]->open(fds);
+		if (!ret) {
+			printf("Could not open the G2 protocol handler\n");
+			delete m_g2Handler[i];
+			m_g2Handler[i] = NULL;
+			continue;
+		}
+
+		const std::string port("port" + index), cache("cache" + index);
+		for (auto it=state.begin(); it!=state.end(); it++) {
+			if (3U == it->size() && 0 == (*it)[0].compare(port))
+				m_g2Handler[i]->restorePort((*it)[1], (unsigned short)std::stoul((*it)[2]));
+			else if (4U == it->size() && 0 == (*it)[0].compare(cache))
+				m_irc[i]->cache.restore((*it)[1], (*it)[2], (*it)[3]);
 		}
 	}
+	for (; next < sockets.size(); next++)
+		close(sockets[next]);
 }
 
-void CSGSThread::processDCS(CDCSProtocolHandlerPool *dcsPool)
+// puts back the links and the users of the server being taken over, and returns how many users
+unsigned int CSGSThread::restoreGroups(const std::vector<std::vector<std::string>> &state)
 {
-	while (true) {
-		DCS_TYPE type = dcsPool->read();
+	std::vector<CJournalEntry> users;
+	for (auto it=state.begin(); it!=state.end(); it++) {
+		if (4U == it->size() && 0 == (*it)[0].compare("on"))
+			users.push_back(CJournalEntry{ (*it)[1], (*it)[2], time_t(std::stol((*it)[3])) });
+		else
+			CGroupHandler::restore(*it);
+	}
+	return CGroupHandler::restore(users);
+}
 
-		switch (type) {
-			case DC_NONE:
-				return;
+// the ports, the caches, the links and the users, for a new server or a standby
+void CSGSThread::saveState(std::ostream &out)
+{
+	for (int i=0; i<2 && m_g2Handler[i]; i++) {
+		m_g2Handler[i]->savePorts(out, "port" + std::to_string(i));
+		m_irc[i]->cache.save(out, "cache" + std::to_string(i));
+	}
+	CGroupHandler::save(out, true);
+}
 
-			case DC_POLL: {
-					CPollData* poll = dcsPool->readPoll();
-					if (poll != NULL) {
-						CDCSHandler::process(*poll);
-						delete poll;
-					}
-				}
-				break;
+// sends a snapshot to a standby that has just connected, and a heartbeat with the links every second
+void CSGSThread::replicate(unsigned int ms)
+{
+	if (CReplication::snapshotWanted()) {
+		std::ostringstream state;
+		saveState(state);
+		CReplication::snapshot(state.str());
+		m_heartbeatTimer.start();
+	}
 
-			case DC_CONNECT: {
-					CConnectData* connect = dcsPool->readConnect();
-					if (connect != NULL) {
-						CDCSHandler::process(*connect);
-						delete connect;
-					}
-				}
-				break;
+	m_heartbeatTimer.clock(ms);
+	if (! m_heartbeatTimer.hasExpired())
+		return;
+	m_heartbeatTimer.start();
+	if (! CReplication::isSending())
+		return;
 
-			case DC_DATA: {
-					CAMBEData* data = dcsPool->readData();
-					if (data != NULL) {
-						// printf("DCS header - My: %s/%s  Your: %s  Rpt1: %s  Rpt2: %s\n", header->getMyCall1().c_str(), header->getMyCall2().c_str(), header->getYourCall().c_str(), header->getRptCall1().c_str(), header->getRptCall2().c_str());
-						CDCSHandler::process(*data);
-						delete data;
-					}
-				}
-				break;
+	std::ostringstream links;
+	CGroupHandler::save(links, false);
+	if (++m_heartbeats % 60U == 0U) {	// the hotspot ports change without a record
+		for (int i=0; i<2 && m_g2Handler[i]; i++)
+			m_g2Handler[i]->savePorts(links, "port" + std::to_string(i));
+	}
+	std::string text(links.str());
+	text.append("hb");
+	CReplication::send(text);
+}
+
+// a new server is waiting: stop routing and give it the sockets and the state
+void CSGSThread::handOff()
+{
+	printf("Handing over to the new server\n");
+
+	std::ostringstream state;
+	std::vector<int> sockets;
+	for (int i=0; i<2 && m_g2Handler[i]; i++) {
+		const size_t count = sockets.size();
+		m_g2Handler[i]->handOff(sockets);
+		processG2(i);	// what the readers had queued
+		state << "sockets\t" << i << '\t' << sockets.size() - count << '\n';
+	}
+	CWorkers::pause();	// once they have handled it, and before what the groups use is closed
+
+	// it binds these as soon as it has the sockets, and a standby follows it instead
+	if (m_remote) {
+		delete m_remote;
+		m_remote = NULL;
+	}
+	m_metrics.close();
+	CReplication::close();
+	CFederation::close();
+
+	saveState(state);
+
+	// the new server reads the journal once it has the state, and appends to it from then on
+	CJournal::close();
+
+	if (CUpgrade::send(sockets, state.str())) {
+		fprintf(stderr, "The new server didn't take over, carrying on\n");
+		for (int i=0; i<2 && m_g2Handler[i]; i++)
+			m_g2Handler[i]->resume();
+		openServices();
+		CUpgrade::listen(m_upgradeSocket);
+		if (m_replicationPort && m_replicationLocal.size())
+			CReplication::listen(m_replicationLocal, m_replicationAddress, m_replicationPort, m_replicationSecret);
+		if (m_federationPeers.size())
+			CFederation::open(m_federationPort, m_federationPeers);
+		if (m_journalFile.size()) {
+			std::vector<CJournalEntry> entries;	// the users are all still here
+			CJournal::open(m_journalFile, entries);
 		}
+		CWorkers::resume();
+		return;
 	}
+
+	m_handedOff = true;
+	m_killed = true;
 }
 
 void CSGSThread::processG2(const int i)
@@ -399,7 +696,7 @@ void CSGSThread::processG2(const int i)
 					if (header != NULL) {
 //printf("G2 header - My: %s/%s  Your: %s  Rpt1: %s  Rpt2: %s  Flags: %02X %02X %02X\n", header->getMyCall1().c_str(), header->getMyCall2().c_str(), header->getYourCall().c_str(), header->getRptCall1().c_str(), header->getRptCall2().c_str(), header->getFlag1(), header->getFlag2(), header->getFlag3());
 						CG2Handler::process(*header);
-						delete header;
+						CObjectPool<CHeaderData>::release(header);
 					}
 				}
 				break;
@@ -408,7 +705,7 @@ void CSGSThread::processG2(const int i)
 					CAMBEData* data = m_g2Handler[i]->readAMBE();
 					if (data != NULL) {
 						CG2Handler::process(*data);
-						delete data;
+						CObjectPool<CAMBEData>::release(data);
 					}
 				}
 				break;
@@ -435,15 +732,12 @@ void CSGSThread::loadReflectors(const std::string fname, DSTAR_PROTOCOL dstarPro
 	hostfile.open(filepath, std::ifstream::in);
 	char line[256];
 	hostfile.getline(line, 256);
-	int count=0, tries=0, index=0;
-	if (m_irc[1])
-		index = 1;
+	int count=0;
 	while (hostfile.good()) {
 		const char *space = " \t\r";
 		char *first = strtok(line, space);
 		if (first) {
 			if ('#' != first[0]) {
-				tries++;
 				char *second = strtok(NULL, space);
 				if (second) {
 					char *third = strtok(NULL, space);
@@ -452,23 +746,86 @@ void CSGSThread::loadReflectors(const std::string fname, DSTAR_PROTOCOL dstarPro
 					std::string name(first);
 					name.resize(7, ' ');
 					name.push_back('G');
-					struct hostent *he = gethostbyname(second);
-					if (he) {
-						count++;
-						std::string address(inet_ntoa(*(struct in_addr*)(he->h_addr_list[0])));
-						m_irc[index]->cache.updateGate(name, address);
-//						printf("reflector:%s, address:%s lock:%s\n", name.c_str(), address.c_str(), third?"true":"false");
-					}
+					CResolver::add(name, second);	// looked up in the background
+					count++;
 				}
 			}
 		}
 		hostfile.getline(line, 256);
 	}
 
-	printf("Loaded %u of %u %s reflectors\n", count, tries, DP_DEXTRA==dstarProtocol?"DExtra":"DCS");
+	printf("Loaded %u %s reflectors\n", count, DP_DEXTRA==dstarProtocol?"DExtra":"DCS");
 }
 
 void CSGSThread::SignalCatch(const int)
 {
 	m_killed = true;
 }
+
+void CSGSThread::ReloadCatch(const int)
+{
+	m_reload = true;
+}
+
+// Reads the configuration file and the host files again. Groups that were
+// added are created and linked, those that were taken out are removed, and
+// the rest are changed in place, so their users stay logged on. The ircDDB
+// servers, ports, threads and the remote and metrics settings are only read
+// at startup.
+void CSGSThread::reload()
+{
+	if (CReplay::isActive())
+		return;
+
+	printf("Reloading %s\n", m_configFile.c_str());
+	CSGSConfig config(m_configFile);
+	std::string gateway;
+	config.getGateway(gateway);
+	if (gateway.empty()) {
+		fprintf(stderr, "Can't reload %s, nothing was changed\n", m_configFile.c_str());
+		return;
+	}
+	gateway.resize(7, ' ');
+	gateway.push_back('G');
+	if (gateway.compare(m_callsign))
+		fprintf(stderr, "Changing the gateway callsign needs a restart, still using %s\n", m_callsign.c_str());
+
+	std::set<std::string> groups;
+	for (unsigned int i=0; i<config.getModCount(); i++) {
+		std::string band, callsign, logoff, info, reflector;
+		unsigned int usertimeout;
+		bool listen_only, showlink;
+
+		config.getGroup(i, band, callsign, logoff, info, usertimeout, listen_only, showlink, reflector);
+		if (callsign.size() && isalnum(callsign[0])) {
+			std::string repeater(m_callsign);
+			repeater.resize(7, ' ');
+			repeater.push_back(band[0]);
+			CGroupHandler::update(callsign, logoff, repeater, info, usertimeout, listen_only, showlink, reflector);
+			groups.insert(callsign);
+		}
+	}
+	auto running = CGroupHandler::listGroups();
+	for (auto it=running.begin(); it!=running.end(); it++) {
+		if (groups.end() == groups.find(*it))
+			CGroupHandler::remove(*it);
+	}
+
+	std::string arbitration, priority;
+	config.getArbitration(arbitration, priority);
+	if (CGroupHandler::setArbitration(arbitration, priority))
+		fprintf(stderr, "Unknown arbitration '%s', the first stream keeps a group\n", arbitration.c_str());
+
+	std::string logLevel;
+	config.getLogLevel(logLevel);
+	LOG_LEVEL level;
+	if (! CLog::parseLevel(logLevel, level))
+		CLog::setLevel(level);
+
+	// a host that has changed is looked up, the others keep their address
+	CResolver::clear();
+	loadReflectors(DEXTRA_HOSTS_FILE_NAME, DP_DEXTRA);
+	loadReflectors(DCS_HOSTS_FILE_NAME, DP_DCS);
+
+	printf("Reloaded %s, %u Smart Groups\n", m_configFile.c_str(), (unsigned int)groups.size());
+}
@@ -20,21 +20,38 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <atomic>
 
 #include "DExtraProtocolHandlerPool.h"		// DEXTRA_LINK
 #include "DCSProtocolHandlerPool.h"			// DCS_LINK
 #include "G2ProtocolHandler.h"
 #include "RemoteHandler.h"
+#include "MetricsServer.h"
+#include "Metrics.h"
 #include "IRCDDB.h"
 #include "Timer.h"
 #include "Defs.h"
 
+// a group from the configuration, which is added once the workers have started
+class CGroupSettings {
+public:
+	std::string  callsign;
+	std::string  logoff;
+	std::string  repeater;
+	std::string  infoText;
+	unsigned int userTimeout;
+	bool         listenOnly;
+	bool         showlink;
+	std::string  reflector;
+};
+
 class CSGSThread {
 public:
 	CSGSThread(unsigned int countDExtra, unsigned int countDCS);
 
 	static void SignalCatch(const int signum);
+	static void ReloadCatch(const int signum);	// SIGHUP, the configuration is read again by the routing thread
 //	bool init();
 	void run();
 
@@ -46,11 +63,27 @@ public:
 
 	void setRemote(bool enabled, const std::string& password, unsigned short port, bool is_ipv6);
 	void setIRC(const unsigned int i, CIRCDDB* irc);
+	void setMetrics(bool enabled, const std::string &address, unsigned short port);
+	void setCapture(const std::string &file);
+	void setWorkers(unsigned int count);
+	void setReceiveSockets(unsigned int count, bool steer);
+	void setG2Port(unsigned short port);
+	void setResolver(const std::string &file, unsigned int hours, unsigned int threads);
+	void setConfigFile(const std::string &file);
+	// socket is where a new server asks for this one's sockets, takeOver makes this the new server
+	void setUpgrade(const std::string &socket, bool takeOver);
+	void setJournal(const std::string &file);
+	// port 0 turns replication off, address is the other server, a standby follows it and an active server
+	// only lets it follow, on local, and each has to know the secret
+	void setReplication(bool standby, const std::string &address, const std::string &local, unsigned short port, unsigned int timeout, const std::string &takeover, const std::string &secret);
+	// peers is a comma separated list of address:port, empty for a server on its own
+	void setFederation(unsigned short port, const std::string &peers);
 
 private:
 	unsigned int m_countDExtra;
 	unsigned int m_countDCS;
 	static std::atomic<bool> m_killed;
+	static std::atomic<bool> m_reload;
 	bool		m_stopped;
 	std::string	m_callsign;
 	std::string	m_address;
@@ -65,11 +98,46 @@ private:
 	unsigned short		m_remotePort;
 	bool				m_remoteIPV6;
 	CRemoteHandler     *m_remote;
+	bool				m_metricsEnabled;
+	std::string			m_metricsAddress;
+	unsigned short		m_metricsPort;
+	CMetricsServer		m_metrics;
+	unsigned int		m_workers;
+	std::vector<CGroupSettings> m_groups;
+	unsigned int		m_receiveSockets;
+	bool				m_steerByAddress;
+	unsigned short		m_g2Port;
+	CMetricHistogram	m_loopSeconds;
+	std::string			m_captureFile;
+	std::string			m_configFile;
+	std::string			m_hostsFile;
+	unsigned int		m_hostsHours;
+	unsigned int		m_resolveThreads;
+	std::string			m_upgradeSocket;
+	bool				m_upgrade;
+	bool				m_handedOff;	// the new server has the sockets, the users and the links
+	std::string			m_journalFile;
+	bool				m_standby;
+	std::string			m_replicationAddress;
+	std::string			m_replicationLocal;
+	std::string			m_replicationSecret;
+	unsigned short		m_replicationPort;
+	unsigned int		m_replicationTimeout;
+	std::string			m_takeoverCommand;	// run by a standby when it takes over
+	CTimer				m_heartbeatTimer;
+	unsigned int		m_heartbeats;
+	unsigned short		m_federationPort;
+	std::string			m_federationPeers;
 
 	void processIrcDDB(const int i);
 	void processG2(const int i);
 	void loadReflectors(const std::string fname, DSTAR_PROTOCOL dstarProtocol);
-
-	void processDExtra(CDExtraProtocolHandlerPool *dextraPool);
-	void processDCS(CDCSProtocolHandlerPool *dcsPool);
+	void reload();
+	void openServices();
+	void receiveState(std::vector<int> &sockets, std::vector<std::vector<std::string>> &state);
+	void openG2(const int family[2], const std::vector<int> &sockets, const std::vector<std::vector<std::string>> &state);
+	unsigned int restoreGroups(const std::vector<std::vector<std::string>> &state);
+	void saveState(std::ostream &out);
+	void replicate(unsigned int ms);
+	void handOff();
 };
@@ -17,17 +17,21 @@
  */
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
 
 #include <cstring>
+#include <cerrno>
 
 #include "TLSServer.h"
 
+// how long a client has to finish the handshake and login, or a write
+#define CLIENT_TIMEOUT_MS 5000
+
 CTLSServer::~CTLSServer()
 {
-	CloseClient();
 	if (m_sock >= 0)
 		    close(m_sock);
     if (m_ctx)
@@ -120,6 +124,9 @@ bool CTLSServer::CreateSocket()
 		return true;
 	}
 
+	int reuse = 1;	// so a server that is taking over from another one can bind at once
+	setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
 	if (0 > bind(m_sock, (struct sockaddr*)&addr, sizeof(addr))) {
 		perror("Unable to bind");
 		close(m_sock);
@@ -132,12 +139,15 @@ bool CTLSServer::CreateSocket()
 		return true;
 	}
 
+	fcntl(m_sock, F_SETFL, fcntl(m_sock, F_GETFL, 0) | O_NONBLOCK);
+
 	return false;
 }
 
-bool CTLSServer::GetCommand(std::string &command)
+// Wait up to waitms for a connection. The handshake is left to the caller.
+CTLSClient *CTLSServer::Accept(unsigned int waitms)
 {
-    struct sockaddr_storage addr;
+	struct sockaddr_storage addr;
 	uint len = sizeof(addr);
 	memset(&addr, 0, len);
 
@@ -146,85 +156,151 @@ bool CTLSServer::GetCommand(std::string &command)
 	FD_SET(m_sock, &readfds);
 
 	struct timeval tv;
-	tv.tv_sec = 0;
-	tv.tv_usec = 0;
+	tv.tv_sec = waitms / 1000U;
+	tv.tv_usec = (waitms % 1000U) * 1000U;
 
-	// don't care about writefds and exceptfds:
-	// and we will return immediately
 	int ret = select(m_sock+1, &readfds, NULL, NULL, &tv);
+	if (ret <= 0 || ! FD_ISSET(m_sock, &readfds))
+		return NULL;	// nothing to read
 
-	if (ret && FD_ISSET(m_sock, &readfds)) {
-		// there is someting to read
-		m_client = accept(m_sock, (struct sockaddr*)&addr, &len);
-		if (m_client < 0) {
+	int client = accept(m_sock, (struct sockaddr*)&addr, &len);
+	if (client < 0) {
+		if (EAGAIN != errno && EWOULDBLOCK != errno)
 			perror("Remote is unable to accept");
-			return true;
-		}
+		return NULL;
+	}
 
-		if (AF_INET6 == addr.ss_family) {
-			struct sockaddr_in6 *a = (struct sockaddr_in6 *)&addr;
-			char s[INET6_ADDRSTRLEN];
-			inet_ntop(AF_INET6, &(a->sin6_addr), s, INET6_ADDRSTRLEN);
-			printf("Remote IPV6 client from %s\n", s);
-		} else {
-			struct sockaddr_in *a = (struct sockaddr_in *)&addr;
-			char s[INET_ADDRSTRLEN];
-			inet_ntop(AF_INET, &(a->sin_addr), s, INET_ADDRSTRLEN);
-			printf("Remote IPV4 client from %s\n", s);
-		}
+	if (AF_INET6 == addr.ss_family) {
+		struct sockaddr_in6 *a = (struct sockaddr_in6 *)&addr;
+		char s[INET6_ADDRSTRLEN];
+		inet_ntop(AF_INET6, &(a->sin6_addr), s, INET6_ADDRSTRLEN);
+		printf("Remote IPV6 client from %s\n", s);
+	} else {
+		struct sockaddr_in *a = (struct sockaddr_in *)&addr;
+		char s[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &(a->sin_addr), s, INET_ADDRSTRLEN);
+		printf("Remote IPV4 client from %s\n", s);
+	}
+
+	fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
 
-		m_ssl = SSL_new(m_ctx);
-		if (NULL == m_ssl) {
-			CloseClient();
-			perror("Remote can't create a new SSL");
+	SSL *ssl = SSL_new(m_ctx);
+	if (NULL == ssl) {
+		close(client);
+		perror("Remote can't create a new SSL");
+		return NULL;
+	}
+
+	if (0 == SSL_set_fd(ssl, client)) {
+		SSL_free(ssl);
+		close(client);
+		perror("Remote can't set fd");
+		return NULL;
+	}
+
+	return new CTLSClient(ssl, client);
+}
+
+CTLSClient::~CTLSClient()
+{
+	if (m_ssl)
+		SSL_free(m_ssl);
+	if (m_sock >= 0)
+		close(m_sock);
+}
+
+// The TLS handshake and password check. Returns true on failure.
+bool CTLSClient::Login(const std::string &password)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CLIENT_TIMEOUT_MS);
+
+	int ret;
+	while ((ret = SSL_accept(m_ssl)) <= 0) {
+		if (WaitForSSL(ret, deadline)) {
+			fprintf(stderr, "Remote client failed the TLS handshake\n");
+			ERR_print_errors_fp(stderr);
 			return true;
-		} else {
-			if (0 == SSL_set_fd(m_ssl, m_client)) {
-				CloseClient();
-				perror("Remote can't set fd");
-				return true;
-			} else {
-				if (SSL_accept(m_ssl) <= 0) {
-					CloseClient();
-					ERR_print_errors_fp(stderr);
-					return true;
-				} else {
-					char buf[256] = { 0 };
-					SSL_read(m_ssl, buf, 256);
-					if (m_password.compare(buf)) {
-						printf("Password [%s] from remote client failed.\n", buf);
-						SSL_write(m_ssl, "fail", 4);
-						CloseClient();
-						return true;
-					} else {
-						SSL_write(m_ssl, "pass", 4);
-						char com[1024] = { 0 };
-						SSL_read(m_ssl, com, 1024);
-						command.assign(com);
-					}
-				}
-			}
 		}
-		return false;
-	} else {
-		// nothing to read
-		command.clear();
+	}
+
+	char buf[256] = { 0 };
+	if (Read(buf, 256, deadline) <= 0) {
+		fprintf(stderr, "Remote client did not send a password\n");
+		return true;
+	}
+
+	if (password.compare(buf)) {
+		printf("Password [%s] from remote client failed.\n", buf);
+		Write("fail");
 		return true;
 	}
 
+	Write("pass");
+	return false;
+}
+
+// Wait for the socket to be ready for whatever the last SSL call wants.
+// Returns true on error, or if the deadline passed first.
+bool CTLSClient::WaitForSSL(int ret, const std::chrono::steady_clock::time_point &deadline)
+{
+	int err = SSL_get_error(m_ssl, ret);
+	if (SSL_ERROR_WANT_READ != err && SSL_ERROR_WANT_WRITE != err)
+		return true;
+
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+	if (left <= 0)
+		return true;
+
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(m_sock, &fds);
+
+	struct timeval tv;
+	tv.tv_sec = left / 1000;
+	tv.tv_usec = (left % 1000) * 1000;
+
+	if (SSL_ERROR_WANT_READ == err)
+		return 0 >= select(m_sock+1, &fds, NULL, NULL, &tv);
+	else
+		return 0 >= select(m_sock+1, NULL, &fds, NULL, &tv);
 }
 
-int CTLSServer::Write(const char *line)
+// read at most size-1 bytes into a null terminated buf
+int CTLSClient::Read(char *buf, int size, const std::chrono::steady_clock::time_point &deadline)
 {
-	return SSL_write(m_ssl, line, strlen(line));
+	int ret;
+	while ((ret = SSL_read(m_ssl, buf, size - 1)) <= 0) {
+		if (WaitForSSL(ret, deadline))
+			return -1;
+	}
+	buf[ret] = '\0';
+	return ret;
 }
 
-void CTLSServer::CloseClient()
+// Returns the number of bytes read, 0 if nothing arrived within waitms,
+// or -1 if the client has gone away.
+int CTLSClient::Read(char *buf, int size, unsigned int waitms)
 {
-	if (m_ssl)
-		SSL_free(m_ssl);
-	m_ssl = NULL;
-	if (m_client >= 0)
-		close(m_client);
-	m_client = 0;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitms);
+	int ret;
+	while ((ret = SSL_read(m_ssl, buf, size - 1)) <= 0) {
+		int err = SSL_get_error(m_ssl, ret);
+		if (SSL_ERROR_WANT_READ != err && SSL_ERROR_WANT_WRITE != err)
+			return -1;
+		if (WaitForSSL(ret, deadline))
+			return 0;
+	}
+	buf[ret] = '\0';
+	return ret;
+}
+
+int CTLSClient::Write(const char *line)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CLIENT_TIMEOUT_MS);
+	int ret;
+	while ((ret = SSL_write(m_ssl, line, strlen(line))) <= 0) {
+		if (WaitForSSL(ret, deadline))
+			return -1;
+	}
+	return ret;
 }
@@ -19,18 +19,37 @@
  */
 
 #include <string>
+#include <chrono>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+// One remote client. All i/o is non-blocking and bounded by a time limit,
+// so a slow or silent client can only ever hold up its own session.
+class CTLSClient
+{
+public:
+	CTLSClient(SSL *ssl, int sock) : m_ssl(ssl), m_sock(sock) {}
+	~CTLSClient();
+	bool Login(const std::string &password);
+	int Read(char *buf, int size, unsigned int waitms);
+	int Write(const char *line);
+
+private:
+	bool WaitForSSL(int ret, const std::chrono::steady_clock::time_point &deadline);
+	int Read(char *buf, int size, const std::chrono::steady_clock::time_point &deadline);
+
+	SSL *m_ssl;
+	int m_sock;
+};
+
 class CTLSServer
 {
 public:
-	CTLSServer() : m_sock(-1) , m_ctx(NULL) , m_ssl(NULL) , m_client(-1) {}
+	CTLSServer() : m_sock(-1) , m_ctx(NULL) {}
 	~CTLSServer();
 	virtual bool OpenSocket(const std::string &password, const std::string &address, unsigned short port);
-	bool GetCommand(std::string &command);
-	int Write(const char *line);
-	void CloseClient();
+	CTLSClient *Accept(unsigned int waitms);
+	const std::string &GetPassword() const { return m_password; }
 
 private:
 	bool CreateContext(const SSL_METHOD *method);
@@ -38,8 +57,6 @@ private:
 
 	int m_sock;
 	SSL_CTX *m_ctx;
-	SSL *m_ssl;
-	int m_client;
 	std::string m_address, m_password;
 	unsigned short m_port;
 };
@@ -20,20 +20,38 @@
 #include <cerrno>
 #include <cstring>
 #include <string.h>
+#include <poll.h>
+#include <linux/filter.h>
 #include "UDPReaderWriter.h"
+#include "Capture.h"
+#include "Log.h"
 
 CUDPReaderWriter::CUDPReaderWriter(int family, unsigned short port) :
-m_fd(-1)
+m_fd(-1),
+m_index(-1)
 {
 	m_addr.Initialize(family, port);
 }
 
 CUDPReaderWriter::~CUDPReaderWriter()
 {
+	CMetrics::remove(this);
+}
+
+void CUDPReaderWriter::SetReusePort(unsigned int index)
+{
+	m_index = int(index);
 }
 
 bool CUDPReaderWriter::Open()
 {
+	const unsigned short asked = m_addr.GetPort();
+	if (CReplay::isActive()) {	// nothing is bound in a replay
+		if (0U == asked)
+			m_addr.SetPort(CReplay::assignPort(m_addr.GetFamily()));
+		return Opened(asked);
+	}
+
 	m_fd = socket(m_addr.GetFamily(), SOCK_DGRAM, 0);
 	if (m_fd < 0) {
 		fprintf(stderr, "Cannot create the UDP socket, err: %s\n", strerror(errno));
@@ -48,6 +66,15 @@ bool CUDPReaderWriter::Open()
 		//  	return false;
 		// }
 
+		if (m_index >= 0) {
+			int reuse = 1;
+			if (setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse))) {
+				fprintf(stderr, "CUDPReaderWriter cannot set SO_REUSEPORT on port %u, err: %s\n", m_addr.GetPort(), strerror(errno));
+				Close();
+				return false;
+			}
+		}
+
 		if (bind(m_fd, m_addr.GetCPointer(), m_addr.GetSize())) {
 			fprintf(stderr, "CUPDReaderWriter bind error [%s]:%u %s\n", m_addr.GetAddress(), m_addr.GetPort(), strerror(errno));
 			Close();
@@ -70,12 +97,79 @@ bool CUDPReaderWriter::Open()
 	} else
 		return false;
 
+	return Opened(asked);
+}
+
+bool CUDPReaderWriter::Adopt(int fd)
+{
+	const unsigned short asked = m_addr.GetPort();
+	CSockAddress a;
+	socklen_t len = sizeof(struct sockaddr_storage);
+	if (getsockname(fd, a.GetPointer(), &len) || a.GetFamily() != m_addr.GetFamily()) {
+		fprintf(stderr, "CUDPReaderWriter can't use the socket it was given for port %u\n", asked);
+		close(fd);
+		return false;
+	}
+	m_fd = fd;
+	m_addr.SetPort(a.GetPort());
+	return Opened(asked);
+}
+
+bool CUDPReaderWriter::Opened(unsigned short asked)
+{
+	if (CCapture::isOpen() && m_index <= 0)	// the rest of a group share the first socket's port
+		CCapture::socket(m_addr.GetFamily(), asked, m_addr.GetPort());
+
+	std::string port(CMetrics::label("port", std::to_string(m_addr.GetPort())));
+	if (m_index >= 0)
+		port.append("," + CMetrics::label("socket", std::to_string(m_index)));
+	CMetrics::add(this, "sgs_udp_rx_packets_total", port, &m_rxPackets);
+	CMetrics::add(this, "sgs_udp_rx_bytes_total",   port, &m_rxBytes);
+	CMetrics::add(this, "sgs_udp_tx_packets_total", port, &m_txPackets);
+	CMetrics::add(this, "sgs_udp_tx_bytes_total",   port, &m_txBytes);
 
 	return true;
 }
 
+bool CUDPReaderWriter::Steer(unsigned int count)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+	// the program runs with the data at the UDP payload, so the source
+	// address is found from the network header, and the result is the socket
+	const int source = (AF_INET6 == m_addr.GetFamily()) ? 20 : 12;	// the last 32 bits of it
+	struct sock_filter code[] = {
+		{ BPF_LD  | BPF_W   | BPF_ABS, 0, 0, uint32_t(SKF_NET_OFF + source) },
+		{ BPF_ALU | BPF_MOD | BPF_K,   0, 0, count },
+		{ BPF_RET | BPF_A,             0, 0, 0 }
+	};
+	struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+	if (setsockopt(m_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+		fprintf(stderr, "CUDPReaderWriter cannot attach the steering program on port %u, err: %s\n", m_addr.GetPort(), strerror(errno));
+		return false;
+	}
+	return true;
+#else
+	fprintf(stderr, "CUDPReaderWriter steering needs SO_ATTACH_REUSEPORT_CBPF, which this system doesn't have\n");
+	return false;
+#endif
+}
+
+bool CUDPReaderWriter::Poll(int ms)
+{
+	struct pollfd pfd;
+	pfd.fd = m_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, ms) > 0 && (pfd.revents & POLLIN);
+}
+
 int CUDPReaderWriter::Read(unsigned char *buffer, unsigned int length, CSockAddress &addr)
 {
+	if (CReplay::isActive()) {
+		int len = CReplay::read(m_addr.GetFamily(), m_addr.GetPort(), buffer, length, addr);
+		return (len > 0) ? Received(buffer, len, addr) : 0;
+	}
+
 	// Check that the readfrom() won't block
 	fd_set readFds;
 	FD_ZERO(&readFds);
@@ -88,7 +182,7 @@ int CUDPReaderWriter::Read(unsigned char *buffer, unsigned int length, CSockAddr
 
 	int ret = select(m_fd + 1, &readFds, NULL, NULL, &tv);
 	if (ret < 0) {
-		fprintf(stderr, "CUPDReaderWriter select error [%s]:%u: %s\n", m_addr.GetAddress(), m_addr.GetPort(), strerror(errno));
+		LOG(LL_ERROR, "UDP select failed", "address=%s port=%u error=\"%s\"", m_addr.GetAddress(), m_addr.GetPort(), strerror(errno));
 		return -1;
 	}
 
@@ -99,31 +193,50 @@ int CUDPReaderWriter::Read(unsigned char *buffer, unsigned int length, CSockAddr
 
 	ssize_t len = recvfrom(m_fd, buffer, length, 0, addr.GetPointer(), &size);
 	if (len <= 0) {
-		fprintf(stderr, "CUPDReaderWriter recvfrom error [%s]:%u %s\n", m_addr.GetAddress(), m_addr.GetPort(), strerror(errno));
+		LOG(LL_ERROR, "UDP recvfrom failed", "address=%s port=%u error=\"%s\"", m_addr.GetAddress(), m_addr.GetPort(), strerror(errno));
 		return -1;
 	}
 
+	return Received(buffer, len, addr);
+}
+
+int CUDPReaderWriter::Received(const unsigned char *buffer, int len, const CSockAddress &addr)
+{
+	m_rxTime = std::chrono::steady_clock::now();
+	if (CCapture::isOpen())
+		CCapture::packet(CT_UDP_RX, m_addr.GetPort(), addr, buffer, len);
+
+	m_rxPackets.add();
+	m_rxBytes.add(len);
+
 	return len;
 }
 
 bool CUDPReaderWriter::Write(const unsigned char* buffer, unsigned int length, CSockAddress &addr)
 {
-	unsigned int count = 0;
+	if (CCapture::isOpen())
+		CCapture::packet(CT_UDP_TX, m_addr.GetPort(), addr, buffer, length);
+
+	unsigned int count = CReplay::isActive() ? length : 0;	// a replay doesn't send anything
 	while (count < length) {
 	 	ssize_t ret = sendto(m_fd, buffer+count, length-count, 0, addr.GetCPointer(), addr.GetSize());
 		if (ret < 0) {
-			fprintf(stderr, "CUPDReaderWriter sendto error [%s]:%u: %s\n", m_addr.GetAddress(), m_addr.GetPort(), strerror(errno));
+			LOG(LL_ERROR, "UDP sendto failed", "address=%s port=%u to=%s:%u error=\"%s\"", m_addr.GetAddress(), m_addr.GetPort(), addr.GetAddress(), addr.GetPort(), strerror(errno));
 			return false;
 		}
 
 		count += ret;
 	}
 
+	m_txPackets.add();
+	m_txBytes.add(length);
+
 	return true;
 }
 
 void CUDPReaderWriter::Close()
 {
+	CMetrics::remove(this);
 	if (m_fd != -1) {
 		close(m_fd);
 		m_fd = -1;
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <chrono>
 #include <netdb.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -30,6 +31,7 @@
 #include <errno.h>
 
 #include "SockAddress.h"
+#include "Metrics.h"
 
 
 class CUDPReaderWriter {
@@ -37,7 +39,17 @@ public:
 	CUDPReaderWriter(int family, unsigned short port);
 	~CUDPReaderWriter();
 
+	// before Open(), makes this socket number index of a group bound to the
+	// same port, and the kernel spreads the datagrams over the group
+	void SetReusePort(unsigned int index);
 	bool Open();
+	// instead of Open(), takes over a socket another server bound, for an upgrade
+	bool Adopt(int fd);
+	// after the whole group is open, sends each peer address to the same
+	// socket of the count in the group, rather than each address and port
+	bool Steer(unsigned int count);
+	// true if a datagram is waiting, after up to ms milliseconds
+	bool Poll(int ms);
 
 	int Read(unsigned char *buffer, unsigned int length, CSockAddress &addr);
 	bool Write(const unsigned char *buffer, unsigned int length, CSockAddress &addr);
@@ -45,8 +57,18 @@ public:
 	void Close();
 
 	unsigned int getPort() const;
+	int getFd() const { return m_fd; }
+
+	// when the last packet was read
+	std::chrono::steady_clock::time_point getRxTime() const { return m_rxTime; }
 
 private:
 	int m_fd;
+	int m_index;	// in a SO_REUSEPORT group, or -1
 	CSockAddress m_addr;
+	std::chrono::steady_clock::time_point m_rxTime;
+
+	bool Opened(unsigned short asked);
+	int Received(const unsigned char *buffer, int len, const CSockAddress &addr);
+	CMetric m_rxPackets, m_rxBytes, m_txPackets, m_txBytes;
 };
@@ -0,0 +1,237 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "Upgrade.h"
+
+#define UPGRADE_REQUEST "SGS UPGRADE\n"
+#define UPGRADE_MAX_SOCKETS 64U
+
+int CUpgrade::m_listen = -1;
+int CUpgrade::m_client = -1;
+std::string CUpgrade::m_path;
+
+static bool setAddress(const std::string &path, struct sockaddr_un &addr)
+{
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "The upgrade socket path %s is too long\n", path.c_str());
+		return true;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	return false;
+}
+
+static void setTimeout(int fd, int secs)
+{
+	struct timeval tv = { secs, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool CUpgrade::listen(const std::string &path)
+{
+	struct sockaddr_un addr;
+	if (setAddress(path, addr))
+		return true;
+
+	m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_listen < 0) {
+		fprintf(stderr, "Cannot create the upgrade socket: %s\n", strerror(errno));
+		return true;
+	}
+	unlink(path.c_str());
+	if (bind(m_listen, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) || chmod(path.c_str(), 0600) || ::listen(m_listen, 1)) {
+		fprintf(stderr, "Cannot listen on the upgrade socket %s: %s\n", path.c_str(), strerror(errno));
+		::close(m_listen);
+		m_listen = -1;
+		return true;
+	}
+	m_path.assign(path);
+	printf("Listening for an upgrade on %s\n", path.c_str());
+	return false;
+}
+
+bool CUpgrade::requested()
+{
+	if (m_listen < 0)
+		return false;
+
+	int fd = accept4(m_listen, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	// anything else that connects is ignored
+	setTimeout(fd, 1);
+	char request[sizeof(UPGRADE_REQUEST)];
+	memset(request, 0, sizeof(request));
+	if (read(fd, request, sizeof(request) - 1U) <= 0 || strcmp(request, UPGRADE_REQUEST)) {
+		::close(fd);
+		return false;
+	}
+
+	// the new server listens on the path once it has taken over
+	::close(m_listen);
+	m_listen = -1;
+	unlink(m_path.c_str());
+	m_client = fd;
+	return true;
+}
+
+bool CUpgrade::send(const std::vector<int> &sockets, const std::string &state)
+{
+	if (m_client < 0 || sockets.size() > UPGRADE_MAX_SOCKETS)
+		return true;
+	setTimeout(m_client, 5);
+
+	// the sockets go with the first byte, the length of the state
+	char header[32];
+	snprintf(header, sizeof(header), "%u\n", (unsigned int)state.size());
+	struct iovec iov = { header, strlen(header) };
+	char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_SOCKETS)];
+	memset(control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (sockets.size()) {
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * sockets.size());
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * sockets.size());
+		memcpy(CMSG_DATA(cmsg), sockets.data(), sizeof(int) * sockets.size());
+	}
+
+	if (sendmsg(m_client, &msg, MSG_NOSIGNAL) != ssize_t(iov.iov_len)) {
+		fprintf(stderr, "Cannot send the sockets to the new server: %s\n", strerror(errno));
+		::close(m_client);
+		m_client = -1;
+		return true;
+	}
+
+	// once it has the sockets, it's the one that reads them, whatever happens to the state
+	for (size_t sent = 0; sent < state.size(); ) {
+		ssize_t n = ::send(m_client, state.data() + sent, state.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) {
+			fprintf(stderr, "Cannot send the state to the new server: %s\n", strerror(errno));
+			break;
+		}
+		sent += n;
+	}
+
+	::close(m_client);
+	m_client = -1;
+	return false;
+}
+
+void CUpgrade::close()
+{
+	if (m_listen >= 0) {
+		::close(m_listen);
+		m_listen = -1;
+		unlink(m_path.c_str());
+	}
+	if (m_client >= 0) {
+		::close(m_client);
+		m_client = -1;
+	}
+}
+
+bool CUpgrade::receive(const std::string &path, std::vector<int> &sockets, std::string &state)
+{
+	struct sockaddr_un addr;
+	if (setAddress(path, addr))
+		return true;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un))) {
+		fprintf(stderr, "Cannot connect to the running server on %s: %s\n", path.c_str(), strerror(errno));
+		if (fd >= 0)
+			::close(fd);
+		return true;
+	}
+	setTimeout(fd, 5);	// it answers within a pass of its routing loop
+	if (write(fd, UPGRADE_REQUEST, strlen(UPGRADE_REQUEST)) != ssize_t(strlen(UPGRADE_REQUEST))) {
+		fprintf(stderr, "Cannot ask the running server for its sockets: %s\n", strerror(errno));
+		::close(fd);
+		return true;
+	}
+
+	char buffer[4096];
+	struct iovec iov = { buffer, sizeof(buffer) };
+	char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_SOCKETS)];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	if (n <= 0) {
+		fprintf(stderr, "The running server didn't send its sockets: %s\n", n ? strerror(errno) : "closed");
+		::close(fd);
+		return true;
+	}
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+			const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			const int *fds = (const int *)CMSG_DATA(cmsg);
+			sockets.assign(fds, fds + count);
+		}
+	}
+
+	// the length of the state, and maybe the start of it
+	state.assign(buffer, n);
+	while (state.npos == state.find('\n')) {
+		n = read(fd, buffer, sizeof(buffer));
+		if (n <= 0)
+			break;
+		state.append(buffer, n);
+	}
+	const auto eol = state.find('\n');
+	const size_t length = (state.npos == eol) ? 0U : strtoul(state.c_str(), NULL, 10);
+	state.erase(0, (state.npos == eol) ? state.size() : eol + 1U);
+	while (state.size() < length) {
+		n = read(fd, buffer, sizeof(buffer));
+		if (n <= 0)
+			break;
+		state.append(buffer, n);
+	}
+	::close(fd);
+
+	if (state.npos == eol || state.size() != length) {
+		// it has stopped routing, so its sockets are still worth having
+		fprintf(stderr, "The state from the running server is incomplete, only its sockets are used\n");
+		state.clear();
+		return sockets.empty();
+	}
+	printf("Received %u sockets and %u bytes of state from the running server\n", (unsigned int)sockets.size(), (unsigned int)length);
+	return false;
+}
@@ -0,0 +1,48 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Hands a running server over to a new one, so the binary can be upgraded
+// without logging anyone off. The running server listens on a Unix socket.
+// A new server started with "sgs -u" gets everything ready and then connects
+// to it. The old server stops routing, sends the new one its G2 sockets with
+// SCM_RIGHTS, followed by a snapshot of its state, and exits without logging
+// anyone off or unlinking. The new server carries on with the same sockets,
+// and so with the datagrams that are waiting in them.
+class CUpgrade {
+public:
+	// the running server: returns true if it can't listen on path
+	static bool listen(const std::string &path);
+	// true when a new server is waiting for the sockets, the path is free for it from then on
+	static bool requested();
+	// sends the sockets and the state to the new server, returns true if it didn't get the sockets
+	static bool send(const std::vector<int> &sockets, const std::string &state);
+	static void close();
+
+	// the new server: gets the sockets and the state from the server listening on path, returns true if there are no sockets
+	static bool receive(const std::string &path, std::vector<int> &sockets, std::string &state);
+
+private:
+	static int m_listen;
+	static int m_client;
+	static std::string m_path;
+};
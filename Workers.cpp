@@ -0,0 +1,330 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdio>
+
+#include "Workers.h"
+#include "GroupHandler.h"
+#include "G2Handler.h"
+#include "DExtraHandler.h"
+#include "DCSHandler.h"
+#include "Capture.h"
+#include "Defs.h"
+
+std::vector<CWorkers::CWorker *> CWorkers::m_workers;
+std::atomic<bool> CWorkers::m_running(false);
+std::atomic<bool> CWorkers::m_paused(false);
+unsigned int CWorkers::m_next = 0U;
+thread_local unsigned int CWorkers::m_current = 0U;
+
+void CWorkers::open(unsigned int count)
+{
+	if (CReplay::isActive() && count) {
+		printf("Routing on one thread, a replay has to be in order\n");
+		count = 0U;
+	}
+
+	m_running = true;
+	m_paused = false;
+	for (unsigned int i=0U; i<count; i++) {
+		CWorker *worker = new CWorker;
+		worker->index = i;
+		const std::string label(CMetrics::label("worker", std::to_string(i)));
+		CMetrics::add(worker, "sgs_worker_packets_total", label, &worker->packets);
+		CMetrics::add(worker, "sgs_worker_dropped_total", label, &worker->dropped);
+		CMetrics::add(worker, "sgs_worker_queue_depth", label, [worker]() { return double(worker->head.load() - worker->tail.load()); });
+		m_workers.push_back(worker);
+	}
+	// each one only looks at its own worker, but they are all in the list before any of them starts
+	for (auto it=m_workers.begin(); it!=m_workers.end(); it++)
+		(*it)->future = std::async(std::launch::async, &CWorkers::run, *it);
+	if (count)
+		printf("Routing the Smart Groups on %u worker threads\n", count);
+}
+
+void CWorkers::close()
+{
+	m_running = false;
+	for (auto it=m_workers.begin(); it!=m_workers.end(); it++) {
+		{
+			std::lock_guard<std::mutex> lock((*it)->mutex);
+			(*it)->wake.notify_one();
+		}
+		(*it)->future.get();
+		CMetrics::remove(*it);
+		for (auto c=(*it)->calls.begin(); c!=(*it)->calls.end(); c++)
+			delete *c;
+		delete *it;
+	}
+	m_workers.clear();
+	m_next = 0U;
+}
+
+unsigned int CWorkers::assign()
+{
+	return m_workers.empty() ? 0U : m_next++ % m_workers.size();
+}
+
+void CWorkers::dispatch(unsigned int worker, CHeaderData &header, AUDIO_SOURCE source, const std::string &group)
+{
+	if (m_workers.empty()) {
+		handle(header, source, group);
+		return;
+	}
+
+	CJob *job = claim(worker);
+	if (NULL == job)
+		return;
+	job->source = source;
+	job->isHeader = true;
+	job->group.assign(group);
+	job->header = header;
+	publish(worker);
+}
+
+void CWorkers::dispatch(unsigned int worker, CAMBEData &data, AUDIO_SOURCE source, const std::string &group)
+{
+	if (m_workers.empty()) {
+		handle(data, source, group);
+		return;
+	}
+
+	CJob *job = claim(worker);
+	if (NULL == job)
+		return;
+	job->source = source;
+	job->isHeader = false;
+	job->group.assign(group);
+	job->data = data;
+	publish(worker);
+}
+
+// the next free cell of the worker's ring, or NULL if it's full
+CWorkers::CJob *CWorkers::claim(unsigned int index)
+{
+	CWorker *worker = m_workers[index % m_workers.size()];
+	const uint64_t head = worker->head.load(std::memory_order_relaxed);
+
+	// a full ring drops the packet, as a full socket would, so one busy worker can't hold up the routing thread
+	if (head - worker->tail.load(std::memory_order_acquire) >= RING_SIZE) {
+		worker->dropped.add();
+		return NULL;
+	}
+	return &worker->ring[head & (RING_SIZE - 1U)];
+}
+
+void CWorkers::publish(unsigned int index)
+{
+	CWorker *worker = m_workers[index % m_workers.size()];
+	worker->head.store(worker->head.load(std::memory_order_relaxed) + 1U, std::memory_order_seq_cst);
+
+	if (worker->sleeping.load(std::memory_order_seq_cst)) {
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		worker->wake.notify_one();
+	}
+}
+
+void CWorkers::call(unsigned int worker, const std::function<void()> &fn)
+{
+	if (m_workers.empty() || m_current == worker + 1U) {
+		fn();
+		return;
+	}
+
+	CCall *c = new CCall;
+	c->fn = fn;
+	c->wait = true;
+	auto done = c->done.get_future();
+	queue(worker, c);
+	done.get();		// and anything fn threw is thrown here
+}
+
+void CWorkers::callAll(const std::function<void()> &fn)
+{
+	if (m_workers.empty()) {
+		fn();
+		return;
+	}
+
+	for (unsigned int i=0U; i<m_workers.size(); i++)
+		call(i, fn);
+}
+
+void CWorkers::post(unsigned int worker, const std::function<void()> &fn)
+{
+	if (m_workers.empty()) {
+		fn();
+		return;
+	}
+
+	CCall *c = new CCall;
+	c->fn = fn;
+	c->wait = false;
+	queue(worker, c);
+}
+
+void CWorkers::queue(unsigned int index, CCall *c)
+{
+	CWorker *worker = m_workers[index % m_workers.size()];
+	std::lock_guard<std::mutex> lock(worker->mutex);
+	worker->calls.push_back(c);
+	worker->wake.notify_one();
+}
+
+// each worker handles what has already been dispatched to it, and then no packet or timer until resume()
+void CWorkers::pause()
+{
+	m_paused = true;
+	for (auto it=m_workers.begin(); it!=m_workers.end(); it++) {
+		CWorker *worker = *it;
+		call(worker->index, [worker]() { runJobs(worker); });
+	}
+}
+
+void CWorkers::resume()
+{
+	m_paused = false;
+	for (auto it=m_workers.begin(); it!=m_workers.end(); it++) {
+		std::lock_guard<std::mutex> lock((*it)->mutex);
+		(*it)->wake.notify_one();
+	}
+}
+
+void CWorkers::handle(CHeaderData &header, AUDIO_SOURCE source, const std::string &group)
+{
+	if (AS_PEER != source) {
+		CG2Handler::route(header);
+		return;
+	}
+
+	CGroupHandler *handler = CGroupHandler::findGroup(group);
+	if (handler)
+		handler->process(header, DIR_INCOMING, AS_PEER);
+}
+
+void CWorkers::handle(CAMBEData &data, AUDIO_SOURCE source, const std::string &group)
+{
+	if (AS_PEER != source) {
+		CG2Handler::route(data);
+		return;
+	}
+
+	CGroupHandler *handler = CGroupHandler::findGroup(group);
+	if (handler)
+		handler->process(data, DIR_INCOMING, AS_PEER);
+}
+
+void CWorkers::runCalls(CWorker *worker)
+{
+	while (true) {
+		CCall *c = NULL;
+		{
+			std::lock_guard<std::mutex> lock(worker->mutex);
+			if (worker->calls.empty())
+				return;
+			c = worker->calls.front();
+			worker->calls.pop_front();
+		}
+
+		try {
+			c->fn();
+			if (c->wait)
+				c->done.set_value();
+		}
+		catch (...) {
+			if (c->wait)
+				c->done.set_exception(std::current_exception());
+			else
+				fprintf(stderr, "Exception raised by a call on worker %u\n", worker->index);
+		}
+		delete c;
+	}
+}
+
+void CWorkers::runJobs(CWorker *worker)
+{
+	while (true) {
+		const uint64_t tail = worker->tail.load(std::memory_order_relaxed);
+		if (tail == worker->head.load(std::memory_order_acquire))
+			return;
+
+		CJob &job = worker->ring[tail & (RING_SIZE - 1U)];
+		if (job.isHeader)
+			handle(job.header, job.source, job.group);
+		else
+			handle(job.data, job.source, job.group);
+		worker->packets.add();
+		worker->tail.store(tail + 1U, std::memory_order_release);
+	}
+}
+
+// until the next tick, or until there is a packet or a call
+void CWorkers::sleep(CWorker *worker, std::chrono::steady_clock::time_point until)
+{
+	std::unique_lock<std::mutex> lock(worker->mutex);
+	worker->sleeping.store(true, std::memory_order_seq_cst);
+	const bool jobs = ! m_paused && worker->tail.load(std::memory_order_relaxed) != worker->head.load(std::memory_order_seq_cst);
+	if (m_running && worker->calls.empty() && ! jobs)
+		worker->wake.wait_until(lock, until);
+	worker->sleeping.store(false, std::memory_order_relaxed);
+}
+
+void CWorkers::run(CWorker *worker)
+{
+	m_current = worker->index + 1U;
+
+	// the links this worker's groups make are read and kept here
+	CDExtraProtocolHandlerPool dextraPool;
+	CDCSProtocolHandlerPool dcsPool;
+	CDExtraHandler::setDExtraProtocolHandlerPool(&dextraPool);
+	CDCSHandler::setDCSProtocolHandlerPool(&dcsPool);
+
+	auto then = std::chrono::steady_clock::now();
+	while (true) {
+		runCalls(worker);
+		if (! m_running)
+			break;	// close() waits for the calls before it, but not for the packets
+
+		auto now = std::chrono::steady_clock::now();
+		if (m_paused) {
+			sleep(worker, now + std::chrono::milliseconds(TIME_PER_TIC_MS));
+			continue;
+		}
+
+		runJobs(worker);
+		CDExtraHandler::receive();
+		CDCSHandler::receive();
+
+		now = std::chrono::steady_clock::now();
+		const unsigned int ms = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(now - then).count();
+		if (ms >= TIME_PER_TIC_MS) {
+			then += std::chrono::milliseconds(ms);
+			CGroupHandler::clock(ms);
+			CDExtraHandler::clock(ms);
+			CDCSHandler::clock(ms);
+		}
+
+		sleep(worker, then + std::chrono::milliseconds(TIME_PER_TIC_MS));
+	}
+
+	CDExtraHandler::finalise();
+	CDCSHandler::finalise();
+	CGroupHandler::finalise();
+	dextraPool.close();
+	dcsPool.close();
+}
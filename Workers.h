@@ -0,0 +1,129 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+#include "DStarDefines.h"
+#include "HeaderData.h"
+#include "AMBEData.h"
+#include "Metrics.h"
+
+// Splits the Smart Groups over worker threads, so a server with many busy
+// groups can route on more than one core. Each worker owns its groups, with
+// their users, streams and repeaters, and their reflector links, with a
+// DExtra and a DCS port pool and list of links of its own, and it runs their
+// timers and sends their packets. The routing thread keeps the G2 and
+// federation ports and ircDDB, and is the dispatcher: each packet for a group
+// is put on the ring of the worker that owns it, a single producer, single
+// consumer ring, so a group's packets are handled in the order they came in.
+// Anything else that touches a group, a remote command, a reload or the state
+// for a standby, is run on its worker with call(). With no workers, or in a
+// replay, which has to be in order, the routing thread does it all.
+class CWorkers {
+public:
+	// starts count workers, zero leaves everything on the routing thread
+	static void open(unsigned int count);
+	// stops the workers, after what was queued for them, and deletes their groups and links
+	static void close();
+
+	static unsigned int count() { return (unsigned int)m_workers.size(); }
+	// the worker this is called on, from 1, or 0 on the routing thread
+	static unsigned int current() { return m_current; }
+	// the worker for the next group
+	static unsigned int assign();
+
+	// on the routing thread, gives a packet for a group to its worker, a G2
+	// packet is for the group it's addressed to, a peer's for the named group
+	static void dispatch(unsigned int worker, CHeaderData &header, AUDIO_SOURCE source = AS_G2, const std::string &group = std::string());
+	static void dispatch(unsigned int worker, CAMBEData &data, AUDIO_SOURCE source = AS_G2, const std::string &group = std::string());
+
+	// runs fn on the worker and waits for it, or runs it here when there are no workers
+	static void call(unsigned int worker, const std::function<void()> &fn);
+	// runs fn on each worker in turn, or once here when there are none
+	static void callAll(const std::function<void()> &fn);
+	// runs fn on the worker without waiting
+	static void post(unsigned int worker, const std::function<void()> &fn);
+
+	// a paused worker only runs calls, so the routing thread can close what the groups use,
+	// or change what they read, what was dispatched before the pause is handled first
+	static void pause();
+	static void resume();
+
+private:
+	static const unsigned int RING_SIZE = 2048U;		// a power of two
+
+	class CJob {
+	public:
+		AUDIO_SOURCE source;	// AS_G2 from a hotspot, or AS_PEER
+		bool isHeader;
+		std::string group;		// for a peer's packet
+		CHeaderData header;
+		CAMBEData data;
+	};
+
+	class CCall {
+	public:
+		std::function<void()> fn;
+		std::promise<void> done;
+		bool wait;
+	};
+
+	class CWorker {
+	public:
+		CWorker() : head(0U), tail(0U), sleeping(false) {}
+
+		unsigned int index;
+		CJob ring[RING_SIZE];
+		std::atomic<uint64_t> head;		// written by the routing thread
+		std::atomic<uint64_t> tail;		// written by the worker
+		std::atomic<bool> sleeping;
+		std::mutex mutex;				// for calls, and to sleep
+		std::condition_variable wake;
+		std::deque<CCall *> calls;
+		std::future<void> future;
+		CMetric packets;
+		CMetric dropped;
+	};
+
+	static CJob *claim(unsigned int worker);
+	static void publish(unsigned int worker);
+	static void queue(unsigned int worker, CCall *call);
+	static void handle(CHeaderData &header, AUDIO_SOURCE source, const std::string &group);
+	static void handle(CAMBEData &data, AUDIO_SOURCE source, const std::string &group);
+	static void runCalls(CWorker *worker);
+	static void runJobs(CWorker *worker);
+	static void sleep(CWorker *worker, std::chrono::steady_clock::time_point until);
+	static void run(CWorker *worker);
+
+	static std::vector<CWorker *> m_workers;
+	static std::atomic<bool> m_running;
+	static std::atomic<bool> m_paused;
+	static unsigned int m_next;
+	static thread_local unsigned int m_current;
+};
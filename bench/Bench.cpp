@@ -0,0 +1,487 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Microbenchmarks for the code on the routing path. Each one is timed over
+// several trials long enough to swamp the clock's resolution and the median
+// is reported, as JSON, so two builds can be compared with a simple diff.
+// The optimised kernels are checked against the plain versions first, and
+// nothing is timed if one of them is wrong.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#include "../HeaderData.h"
+#include "../AMBEData.h"
+#include "../CCITTChecksum.h"
+#include "../SlowDataEncoder.h"
+#include "../CacheManager.h"
+#include "../GroupHandler.h"
+#include "../IRCDDBApp.h"
+#include "../IRCMessage.h"
+#include "../Utils.h"
+
+#define TRIALS 5
+
+typedef std::chrono::steady_clock Clock;
+
+// results are added to this so the compiler can't throw the work away
+static volatile unsigned long sink = 0UL;
+
+class CResult {
+public:
+	std::string name;
+	unsigned long iterations;	// in each trial
+	unsigned int threads;
+	double median;				// nanoseconds per operation
+	double min;
+	double max;
+};
+
+class CBench {
+public:
+	CBench() : m_trialMs(100U), m_filter() {}
+
+	int run(int argc, char *argv[]);
+
+private:
+	unsigned int m_trialMs;
+	std::string m_filter;
+	std::vector<CResult> m_results;
+
+	bool selected(const std::string &name) const;
+	// times op, which does n operations, and adds the result
+	void measure(const std::string &name, const std::function<void(unsigned long n)> &op, unsigned int threads = 1U);
+	void print(FILE *fp) const;
+
+	// returns true if a kernel doesn't agree with the plain version
+	bool verify() const;
+	bool verifyChecksum() const;
+
+	void header();
+	void ambe();
+	void checksum();
+	void slowData();
+	void cache();
+	void groups();
+	void ircUpdate();
+};
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-t ms] [-f filter] [-o file]\n", name);
+	printf("  -t ms      how long each trial should take (default 100)\n");
+	printf("  -f filter  only run the benchmarks with this in their name\n");
+	printf("  -o file    write the JSON to a file instead of stdout\n");
+}
+
+int CBench::run(int argc, char *argv[])
+{
+	std::string output;
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "t:f:o:h"))) {
+		switch (opt) {
+			case 't': m_trialMs = atoi(optarg); break;
+			case 'f': m_filter.assign(optarg); break;
+			case 'o': output.assign(optarg); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (0U == m_trialMs) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (verify())
+		return 1;
+
+	header();
+	ambe();
+	checksum();
+	slowData();
+	cache();
+	groups();
+	ircUpdate();
+
+	if (output.empty()) {
+		print(stdout);
+	} else {
+		FILE *fp = fopen(output.c_str(), "w");
+		if (NULL == fp) {
+			fprintf(stderr, "Can't open %s: %s\n", output.c_str(), strerror(errno));
+			return 1;
+		}
+		print(fp);
+		fclose(fp);
+		fprintf(stderr, "Results written to %s\n", output.c_str());
+	}
+	return 0;
+}
+
+bool CBench::selected(const std::string &name) const
+{
+	return m_filter.empty() || name.npos != name.find(m_filter);
+}
+
+void CBench::measure(const std::string &name, const std::function<void(unsigned long n)> &op, unsigned int threads)
+{
+	auto timed = [&](unsigned long n) {
+		auto start = Clock::now();
+		if (1U == threads) {
+			op(n);
+		} else {
+			std::vector<std::thread> pool;
+			for (unsigned int i=0; i<threads; i++)
+				pool.emplace_back(op, n / threads);
+			for (auto it=pool.begin(); it!=pool.end(); it++)
+				it->join();
+		}
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	};
+
+	// find an iteration count that fills a trial
+	unsigned long n = threads;
+	double ns;
+	while ((ns = timed(n)) < 1.0e6 * m_trialMs / 10.0 && n < (1UL << 40))
+		n *= 10UL;
+	n = std::max((unsigned long)threads, (unsigned long)(n * 1.0e6 * m_trialMs / ns));
+
+	std::vector<double> trials;
+	for (int i=0; i<TRIALS; i++)
+		trials.push_back(timed(n) / n);
+	std::sort(trials.begin(), trials.end());
+
+	CResult r;
+	r.name = name;
+	r.iterations = n;
+	r.threads = threads;
+	r.median = trials[TRIALS / 2];
+	r.min = trials.front();
+	r.max = trials.back();
+	m_results.push_back(r);
+	fprintf(stderr, "%-40s %12.1f ns/op\n", name.c_str(), r.median);
+}
+
+void CBench::print(FILE *fp) const
+{
+	fprintf(fp, "{\"trial_ms\":%u,\"trials\":%d,\"hardware_threads\":%u,\"results\":[", m_trialMs, TRIALS, std::thread::hardware_concurrency());
+	for (auto it=m_results.begin(); it!=m_results.end(); it++) {
+		fprintf(fp, "%s\n{\"name\":\"%s\",\"threads\":%u,\"iterations\":%lu,\"ns_per_op\":%.2f,\"min\":%.2f,\"max\":%.2f,\"ops_per_sec\":%.0f}",
+			(it == m_results.begin()) ? "" : ",", it->name.c_str(), it->threads, it->iterations, it->median, it->min, it->max, 1.0e9 / it->median);
+	}
+	fprintf(fp, "\n]}\n");
+}
+
+static CHeaderData makeHeader()
+{
+	CHeaderData header;
+	header.setId(0x1234U);
+	header.setMyCall1("N7TAE  B");
+	header.setMyCall2("ID51");
+	header.setYourCall("SMARTA  ");
+	header.setRptCall1("N7TAE  B");
+	header.setRptCall2("N7TAE  G");
+	return header;
+}
+
+void CBench::header()
+{
+	CHeaderData header(makeHeader());
+	unsigned char packet[60];
+	header.getG2Data(packet, 60U, true);
+
+	if (selected("header_set_g2")) {
+		measure("header_set_g2", [&packet](unsigned long n) {
+			CHeaderData h;
+			for (unsigned long i=0; i<n; i++)
+				sink += h.setG2Data(packet, 56U, true, "10.0.0.1", 40000U);
+		});
+	}
+	if (selected("header_get_g2")) {
+		measure("header_get_g2", [&header](unsigned long n) {
+			unsigned char buf[60];
+			for (unsigned long i=0; i<n; i++)
+				sink += header.getG2Data(buf, 60U, true);
+		});
+	}
+}
+
+void CBench::ambe()
+{
+	CAMBEData data;
+	unsigned char frame[DV_FRAME_LENGTH_BYTES];
+	memset(frame, 0x5AU, DV_FRAME_LENGTH_BYTES);
+	data.setId(0x1234U);
+	data.setSeq(5U);
+	data.setData(frame, DV_FRAME_LENGTH_BYTES);
+
+	if (selected("ambe_get_g2")) {
+		measure("ambe_get_g2", [&data](unsigned long n) {
+			unsigned char buf[40];
+			for (unsigned long i=0; i<n; i++)
+				sink += data.getG2Data(buf, 40U);
+		});
+	}
+	if (selected("ambe_get_dcs")) {
+		measure("ambe_get_dcs", [&data](unsigned long n) {
+			unsigned char buf[100];
+			for (unsigned long i=0; i<n; i++)
+				sink += data.getDCSData(buf, 100U);
+		});
+	}
+}
+
+bool CBench::verify() const
+{
+	return verifyChecksum();
+}
+
+// the slicing-by-8 loop against the byte table, which is all an update of one byte uses
+bool CBench::verifyChecksum() const
+{
+	unsigned char crc[2];
+	CCCITTChecksum check;
+	check.update((const unsigned char *)"123456789", 9U);
+	check.result(crc);
+	if (0x906EU != (crc[0] | (crc[1] << 8))) {
+		fprintf(stderr, "ccitt_checksum: \"123456789\" gives 0x%02X%02X, not 0x906E\n", crc[1], crc[0]);
+		return true;
+	}
+
+	unsigned char data[300];
+	srand(1U);
+	for (unsigned int trial=0U; trial<10000U; trial++) {
+		const unsigned int length = rand() % sizeof(data);
+		for (unsigned int i=0U; i<length; i++)
+			data[i] = rand() & 0xFF;
+
+		CCCITTChecksum bytes;
+		for (unsigned int i=0U; i<length; i++)
+			bytes.update(data + i, 1U);
+		unsigned char expected[2];
+		bytes.result(expected);
+
+		// in one update, and split into a few at random
+		const unsigned int split1 = length ? rand() % (length + 1U) : 0U;
+		const unsigned int split2 = split1 + ((length > split1) ? rand() % (length - split1 + 1U) : 0U);
+		CCCITTChecksum whole, split;
+		whole.update(data, length);
+		whole.result(crc);
+		unsigned char parts[2];
+		split.update(data, split1);
+		split.update(data + split1, split2 - split1);
+		split.update(data + split2, length - split2);
+		split.result(parts);
+
+		if (memcmp(crc, expected, 2U) || memcmp(parts, expected, 2U)) {
+			fprintf(stderr, "ccitt_checksum: %u bytes split at %u and %u don't match the byte table\n", length, split1, split2);
+			return true;
+		}
+	}
+	fprintf(stderr, "ccitt_checksum: slicing-by-8 matches the byte table\n");
+	return false;
+}
+
+void CBench::checksum()
+{
+	if (selected("ccitt_checksum")) {
+		// the part of a radio header that is checksummed
+		CHeaderData header(makeHeader());
+		unsigned char packet[60];
+		header.getG2Data(packet, 60U, false);
+		measure("ccitt_checksum", [&packet](unsigned long n) {
+			unsigned char crc[2];
+			for (unsigned long i=0; i<n; i++) {
+				CCCITTChecksum cksum;
+				cksum.update(packet + 15U, RADIO_HEADER_LENGTH_BYTES - 2U);
+				cksum.result(crc);
+				sink += crc[0];
+			}
+		});
+	}
+}
+
+void CBench::slowData()
+{
+	if (selected("slowdata_set_text")) {
+		measure("slowdata_set_text", [](unsigned long n) {
+			CSlowDataEncoder encoder;
+			const std::string text("Smart Group SMARTA  ");
+			unsigned char buf[DATA_FRAME_LENGTH_BYTES];
+			for (unsigned long i=0; i<n; i++) {
+				encoder.setTextData(text);
+				encoder.getTextData(buf);
+				sink += buf[0];
+			}
+		});
+	}
+}
+
+static std::string callsign(unsigned int i, char module)
+{
+	char cs[9];
+	snprintf(cs, 9, "K%05u%c", i % 100000U, module);
+	std::string s(cs);
+	s.insert(6U, 1U, ' ');
+	return s;
+}
+
+// a cache the size of a busy network, read by the routing thread and written by the ircDDB threads
+void CBench::cache()
+{
+	const unsigned int USERS = 20000U;
+	CCacheManager cache;
+	std::vector<std::string> users, rptrs;
+	for (unsigned int i=0; i<USERS; i++) {
+		users.push_back(callsign(i, ' '));
+		rptrs.push_back(callsign(i, 'B'));
+		std::string gate(callsign(i, 'G'));
+		cache.updateUser(users.back(), rptrs.back(), gate, "", "2021-01-01 00:00:00");
+		cache.updateGate(gate, "10.0." + std::to_string(i / 256U) + "." + std::to_string(i % 256U));
+	}
+
+	if (selected("cache_find_user")) {
+		measure("cache_find_user", [&](unsigned long n) {
+			std::string rptr, gate, addr;
+			for (unsigned long i=0; i<n; i++) {
+				cache.findUserData(users[i % USERS], rptr, gate, addr);
+				sink += addr.size();
+			}
+		});
+	}
+	if (selected("cache_find_rptr")) {
+		measure("cache_find_rptr", [&](unsigned long n) {
+			std::string gate, addr;
+			for (unsigned long i=0; i<n; i++) {
+				cache.findRptrData(rptrs[i % USERS], gate, addr);
+				sink += addr.size();
+			}
+		});
+	}
+	if (selected("cache_update_user")) {
+		measure("cache_update_user", [&](unsigned long n) {
+			for (unsigned long i=0; i<n; i++)
+				cache.updateUser(users[i % USERS], rptrs[i % USERS], "", "", "2021-01-01 00:00:01");
+		});
+	}
+
+	// one in twenty operations is an update, the rest are lookups
+	const unsigned int maxThreads = std::max(4U, std::thread::hardware_concurrency());
+	for (unsigned int threads=2U; threads<=maxThreads; threads*=2U) {
+		const std::string name("cache_mixed_contended/threads:" + std::to_string(threads));
+		if (! selected(name))
+			continue;
+		std::atomic<unsigned int> next(0U);
+		measure(name, [&](unsigned long n) {
+			const unsigned int seed = next++ * 7919U;
+			std::string rptr, gate, addr;
+			for (unsigned long i=0; i<n; i++) {
+				const unsigned int u = (seed + i) % USERS;
+				if (0U == i % 20U)
+					cache.updateUser(users[u], rptrs[u], "", "", "2021-01-01 00:00:02");
+				else
+					cache.findUserData(users[u], rptr, gate, addr);
+				sink += addr.size();
+			}
+		}, threads);
+	}
+}
+
+// findGroup is a linear search, so it's timed for the last of a lot of groups
+void CBench::groups()
+{
+	const unsigned int GROUPS = 50U;
+	for (unsigned int i=0; i<GROUPS; i++) {
+		char cs[9], off[9];
+		snprintf(cs, 9, "SMRT%03u ", i);
+		snprintf(off, 9, "SMRT%03uX", i);
+		CGroupHandler::add(cs, off, "SGS    A", "", 300U, false, false, "");
+	}
+
+	CHeaderData header(makeHeader());
+	header.setYourCall("SMRT049X");
+	CAMBEData data;
+	data.setId(0x4321U);	// not in use, so every group is checked
+
+	if (selected("group_find_callsign")) {
+		measure("group_find_callsign", [](unsigned long n) {
+			const std::string cs("SMRT049 ");
+			for (unsigned long i=0; i<n; i++)
+				sink += (unsigned long)CGroupHandler::findGroup(cs);
+		});
+	}
+	if (selected("group_find_header")) {
+		measure("group_find_header", [&header](unsigned long n) {
+			for (unsigned long i=0; i<n; i++)
+				sink += (unsigned long)CGroupHandler::findGroup(header);
+		});
+	}
+	if (selected("group_find_ambe")) {
+		measure("group_find_ambe", [&data](unsigned long n) {
+			for (unsigned long i=0; i<n; i++)
+				sink += (unsigned long)CGroupHandler::findGroup(data);
+		});
+	}
+
+	CGroupHandler::finalise();
+}
+
+// the channel traffic an ircDDB server sends for every user that keys up,
+// parsed but not cached because the app hasn't been through a login
+void CBench::ircUpdate()
+{
+	if (! selected("irc_do_update"))
+		return;
+
+	CCacheManager cache;
+	IRCDDBApp app("#dstar", &cache);
+	std::vector<IRCMessage *> msgs;
+	for (unsigned int i=0; i<1000U; i++) {
+		std::string user(callsign(i, ' ')), rptr(callsign(i, 'B'));
+		ReplaceChar(user, ' ', '_');
+		ReplaceChar(rptr, ' ', '_');
+		IRCMessage *m = new IRCMessage("PRIVMSG");
+		m->prefix.assign("s-grp1s1!s-grp1s1@127.0.0.1");
+		m->addParam("#dstar");
+		m->addParam("0 2021-01-01 00:00:00 " + user + " " + rptr);
+		msgs.push_back(m);
+	}
+
+	measure("irc_do_update", [&](unsigned long n) {
+		for (unsigned long i=0; i<n; i++)
+			app.msgChannel(msgs[i % msgs.size()]);
+	});
+
+	for (auto it=msgs.begin(); it!=msgs.end(); it++)
+		delete *it;
+}
+
+int main(int argc, char *argv[])
+{
+	CBench bench;
+	return bench.run(argc, argv);
+}
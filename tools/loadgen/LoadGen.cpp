@@ -0,0 +1,620 @@
+/*
+ *   Copyright (c) 2021 by Thomas A. Early N7TAE
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// A load generator for the Smart Group Server. It simulates any number of
+// G2 hotspots on the loopback network, each on its own 127.1.x.y address,
+// logs them on to Smart Groups, keys them up with 20 ms voice streams and
+// measures what every other hotspot in the group receives. It can also play
+// a minimal ircDDB server, so the Smart Group Server learns where every
+// simulated hotspot is the same way it does in production.
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "../../HeaderData.h"
+#include "../../AMBEData.h"
+#include "../../DStarDefines.h"
+
+#define IRC_PORT      9007
+#define SERVER_NICK   "s-grp1s1"
+#define FRAME_MS      20
+#define SUBSCRIBE_PER_MS 1		// login streams started per millisecond
+#define SEED_WAIT     3			// seconds between the end of the ircDDB login and sending the cache updates
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned char MAGIC[2] = { 'L', 'G' };	// marks our voice frames, so they can't be confused with the group's text frames
+
+static double elapsed(Clock::time_point since)
+{
+	return std::chrono::duration<double>(Clock::now() - since).count();
+}
+
+// One simulated hotspot: a user, its repeater and gateway, and a socket on its own address
+class CHotspot {
+public:
+	std::string m_callsign;		// 6 characters
+	std::string m_address;
+	unsigned int m_group;
+	int m_fd;
+	unsigned long m_frames;		// voice frames received
+	unsigned long m_headers;	// headers received, counting the repeats
+
+	std::string user() const { return m_callsign + "  "; }
+	std::string repeater() const { return m_callsign + " B"; }
+	std::string gateway() const { return m_callsign + " G"; }
+};
+
+// Just enough of an ircDDB server for the Smart Group Server's IRC client
+// to log in, list the simulated gateways and be sent their users.
+class CFakeIRC {
+public:
+	CFakeIRC(const std::vector<CHotspot> &hotspots) : m_hotspots(hotspots), m_listen(-1), m_client(-1), m_seeded(false) {}
+	~CFakeIRC() { if (m_client >= 0) close(m_client); if (m_listen >= 0) close(m_listen); }
+
+	bool open();	// true on error
+	void process();
+	bool isSeeded() const { return m_seeded; }
+	int getListenFd() const { return m_listen; }
+	int getClientFd() const { return m_client; }
+
+private:
+	const std::vector<CHotspot> &m_hotspots;
+	int m_listen, m_client;
+	std::string m_in, m_nick;
+	bool m_seeded;
+	bool m_listEnd;
+	Clock::time_point m_listEndTime;
+
+	void line(const std::string &line);
+	void send(const std::string &line);
+	std::string update(const CHotspot &hotspot) const;
+};
+
+bool CFakeIRC::open()
+{
+	m_listen = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(IRC_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(m_listen, (struct sockaddr *)&addr, sizeof(addr)) || listen(m_listen, 1)) {
+		fprintf(stderr, "Can't open the fake ircDDB on 127.0.0.1:%d: %s\n", IRC_PORT, strerror(errno));
+		return true;
+	}
+	fcntl(m_listen, F_SETFL, O_NONBLOCK);
+	m_listEnd = false;
+	return false;
+}
+
+void CFakeIRC::process()
+{
+	int fd = accept(m_listen, NULL, NULL);
+	if (fd >= 0) {
+		if (m_client >= 0)
+			close(m_client);
+		m_client = fd;
+		fcntl(m_client, F_SETFL, O_NONBLOCK);
+		m_in.clear();
+		m_listEnd = false;
+		printf("The Smart Group Server has connected to the fake ircDDB\n");
+	}
+
+	if (m_client >= 0) {
+		char buf[4096];
+		ssize_t len;
+		while ((len = recv(m_client, buf, sizeof(buf), 0)) > 0)
+			m_in.append(buf, len);
+		if (0 == len) {
+			close(m_client);
+			m_client = -1;
+			printf("The Smart Group Server has disconnected from the fake ircDDB\n");
+		}
+		size_t pos;
+		while (m_in.npos != (pos = m_in.find('\n'))) {
+			std::string l(m_in.substr(0, pos));
+			m_in.erase(0, pos + 1);
+			if (l.size() && '\r' == l.back())
+				l.pop_back();
+			line(l);
+		}
+	}
+
+	if (m_listEnd && ! m_seeded && elapsed(m_listEndTime) > SEED_WAIT) {
+		for (auto it=m_hotspots.begin(); it!=m_hotspots.end(); it++)
+			send(std::string(":" SERVER_NICK "!" SERVER_NICK "@127.0.0.1 PRIVMSG #dstar :") + update(*it));
+		m_seeded = true;
+		printf("The fake ircDDB has sent the location of %u users\n", (unsigned int)m_hotspots.size());
+	}
+}
+
+std::string CFakeIRC::update(const CHotspot &hotspot) const
+{
+	std::string user(hotspot.user()), rptr(hotspot.repeater());
+	std::replace(user.begin(), user.end(), ' ', '_');
+	std::replace(rptr.begin(), rptr.end(), ' ', '_');
+	return "0 2021-01-01 00:00:00 " + user + " " + rptr;
+}
+
+void CFakeIRC::line(const std::string &line)
+{
+	std::vector<std::string> words;
+	size_t start = 0;
+	while (start < line.size()) {
+		if (':' == line[start] && words.size()) {
+			words.push_back(line.substr(start + 1));
+			break;
+		}
+		size_t end = line.find(' ', start);
+		if (line.npos == end)
+			end = line.size();
+		words.push_back(line.substr(start, end - start));
+		start = end + 1;
+	}
+	if (words.empty())
+		return;
+
+	const std::string &cmd = words[0];
+	if (0 == cmd.compare("NICK") && words.size() > 1) {
+		m_nick = words[1];
+	} else if (0 == cmd.compare("USER")) {
+		send(":fake.ircddb 001 " + m_nick + " :Welcome");
+		send(":fake.ircddb 004 " + m_nick + " grp1s1.ircDDB fake");
+	} else if (0 == cmd.compare("JOIN") && words.size() > 1) {
+		send(":" + m_nick + "!" + m_nick + "@127.0.0.1 JOIN " + words[1]);
+	} else if (0 == cmd.compare("WHO") && words.size() > 1) {
+		send(":fake.ircddb 352 " + m_nick + " " + words[1] + " " SERVER_NICK " 127.0.0.1 fake.ircddb " SERVER_NICK " H :0 fake");
+		for (auto it=m_hotspots.begin(); it!=m_hotspots.end(); it++) {
+			std::string name(it->m_callsign);
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			send(":fake.ircddb 352 " + m_nick + " " + words[1] + " " + name + " " + it->m_address + " fake.ircddb " + name + "-1 H :0 hotspot");
+		}
+		send(":fake.ircddb 315 " + m_nick + " " + words[1] + " :End of WHO list");
+	} else if (0 == cmd.compare("PING")) {
+		send(":fake.ircddb PONG fake.ircddb :" + (words.size() > 1 ? words[1] : m_nick));
+	} else if (0 == cmd.compare("PRIVMSG") && words.size() > 2 && 0 == words[1].compare(SERVER_NICK)) {
+		const std::string &msg = words[2];
+		const std::string reply(":" SERVER_NICK "!" SERVER_NICK "@127.0.0.1 PRIVMSG " + m_nick + " :");
+		if (0 == msg.compare(0, 8, "SENDLIST")) {
+			send(reply + "LIST_END");
+			m_listEnd = true;
+			m_listEndTime = Clock::now();
+		} else if (0 == msg.compare(0, 5, "FIND ")) {
+			std::string user(msg.substr(5));
+			std::replace(user.begin(), user.end(), '_', ' ');
+			for (auto it=m_hotspots.begin(); it!=m_hotspots.end(); it++) {
+				if (0 == it->user().compare(user)) {
+					send(reply + "UPDATE " + update(*it));
+					break;
+				}
+			}
+		}
+	}
+}
+
+void CFakeIRC::send(const std::string &line)
+{
+	if (m_client < 0)
+		return;
+	std::string out(line + "\r\n");
+	size_t sent = 0;
+	while (sent < out.size()) {
+		ssize_t len = ::send(m_client, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+		if (len < 0) {
+			if (EAGAIN == errno || EWOULDBLOCK == errno) {
+				usleep(1000);
+				continue;
+			}
+			return;
+		}
+		sent += len;
+	}
+}
+
+// A talker keying up one of the hotspots in a group
+class CTalker {
+public:
+	unsigned int m_hotspot;
+	unsigned short m_id;
+	unsigned int m_seq;
+	unsigned int m_frames;		// left to send
+	Clock::time_point m_next;	// when the next frame is due
+};
+
+class CLoadGen {
+public:
+	CLoadGen() : m_server("127.0.0.1"), m_serverPort(G2_DV_PORT), m_count(100U), m_overSeconds(5U), m_seconds(30U), m_fakeIRC(true), m_epoll(-1), m_irc(NULL) {}
+	~CLoadGen();
+
+	int run(int argc, char *argv[]);
+
+private:
+	std::string m_server;
+	unsigned short m_serverPort;
+	unsigned int m_count;
+	unsigned int m_overSeconds;
+	unsigned int m_seconds;
+	bool m_fakeIRC;
+	std::vector<std::string> m_groups;
+	std::vector<CHotspot> m_hotspots;
+	std::vector<CTalker> m_talkers;		// one for each group
+	struct sockaddr_in m_serverAddr;
+	int m_epoll;
+	CFakeIRC *m_irc;
+	Clock::time_point m_start;
+
+	// for every voice frame sent: when, and how many hotspots should get it
+	std::vector<Clock::time_point> m_sentTime;
+	std::vector<unsigned int> m_expected;
+	std::vector<unsigned int> m_latencyUs;
+	unsigned long m_delivered, m_duplicates;
+	std::vector<unsigned int> m_deliveries;
+
+	bool open();
+	void poll(int ms);
+	void receive(CHotspot &hotspot);
+	void sendHeader(const CHotspot &hotspot, const std::string &your, unsigned short id);
+	void sendFrame(const CHotspot &hotspot, unsigned short id, unsigned int seq, bool end, unsigned int serial);
+	void subscribe();
+	void talk();
+	void report();
+	unsigned int members(unsigned int group) const;
+};
+
+CLoadGen::~CLoadGen()
+{
+	for (auto it=m_hotspots.begin(); it!=m_hotspots.end(); it++) {
+		if (it->m_fd >= 0)
+			close(it->m_fd);
+	}
+	if (m_epoll >= 0)
+		close(m_epoll);
+	delete m_irc;
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [options] group [group ...]\n", name);
+	printf("  -n count    number of hotspots to simulate (default 100)\n");
+	printf("  -s address  the Smart Group Server's G2 address (default 127.0.0.1)\n");
+	printf("  -p port     the Smart Group Server's G2 port (default %u)\n", G2_DV_PORT);
+	printf("  -l seconds  how long each transmission lasts (default 5)\n");
+	printf("  -d seconds  how long to keep transmitting (default 30)\n");
+	printf("  -x          don't run the fake ircDDB on 127.0.0.1:%d\n", IRC_PORT);
+	printf("Each group is the callsign of a Smart Group, with '_' for a space, like SMARTA__.\n");
+	printf("The hotspots are spread evenly over the groups and each group has one talker at a time.\n");
+}
+
+int CLoadGen::run(int argc, char *argv[])
+{
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "n:s:p:l:d:xh"))) {
+		switch (opt) {
+			case 'n': m_count = atoi(optarg); break;
+			case 's': m_server.assign(optarg); break;
+			case 'p': m_serverPort = atoi(optarg); break;
+			case 'l': m_overSeconds = atoi(optarg); break;
+			case 'd': m_seconds = atoi(optarg); break;
+			case 'x': m_fakeIRC = false; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	for (int i=optind; i<argc; i++) {
+		std::string group(argv[i]);
+		std::replace(group.begin(), group.end(), '_', ' ');
+		std::transform(group.begin(), group.end(), group.begin(), ::toupper);
+		group.resize(LONG_CALLSIGN_LENGTH, ' ');
+		m_groups.push_back(group);
+	}
+	if (m_groups.empty() || m_count < 2U || m_count > 65000U || 0U == m_overSeconds) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (open())
+		return 1;
+
+	m_start = Clock::now();
+	if (m_irc) {
+		printf("Waiting for the Smart Group Server to log in to the fake ircDDB...\n");
+		while (! m_irc->isSeeded())
+			poll(100);
+	}
+
+	subscribe();
+	talk();
+	report();
+	return 0;
+}
+
+bool CLoadGen::open()
+{
+	memset(&m_serverAddr, 0, sizeof(m_serverAddr));
+	m_serverAddr.sin_family = AF_INET;
+	m_serverAddr.sin_port = htons(m_serverPort);
+	if (1 != inet_pton(AF_INET, m_server.c_str(), &m_serverAddr.sin_addr)) {
+		fprintf(stderr, "%s is not an IPv4 address\n", m_server.c_str());
+		return true;
+	}
+
+	m_epoll = epoll_create1(0);
+
+	const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	m_hotspots.resize(m_count);
+	for (unsigned int i=0; i<m_count; i++) {
+		CHotspot &h = m_hotspots[i];
+		h.m_callsign.assign("L");
+		for (unsigned int n=i, d=0; d<5; d++, n/=36)
+			h.m_callsign.insert(1, 1, digits[n % 36]);
+		char addr[32];
+		snprintf(addr, sizeof(addr), "127.1.%u.%u", (i + 1U) / 256U, (i + 1U) % 256U);
+		h.m_address.assign(addr);
+		h.m_group = i % m_groups.size();
+		h.m_frames = h.m_headers = 0UL;
+
+		// an ephemeral port, the server's G2 socket already has G2_DV_PORT on every address
+		h.m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in sin;
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		inet_pton(AF_INET, addr, &sin.sin_addr);
+		if (h.m_fd < 0 || bind(h.m_fd, (struct sockaddr *)&sin, sizeof(sin))) {
+			fprintf(stderr, "Can't open a socket for hotspot %u on %s: %s (is the open file limit high enough?)\n", i, addr, strerror(errno));
+			return true;
+		}
+		fcntl(h.m_fd, F_SETFL, O_NONBLOCK);
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, h.m_fd, &ev);
+	}
+
+	if (m_fakeIRC) {
+		m_irc = new CFakeIRC(m_hotspots);
+		if (m_irc->open())
+			return true;
+	}
+
+	printf("%u hotspots on 127.1.0.1 and up, in %u groups\n", m_count, (unsigned int)m_groups.size());
+	return false;
+}
+
+// wait up to ms for traffic and handle all of it
+void CLoadGen::poll(int ms)
+{
+	struct epoll_event events[256];
+	int n = epoll_wait(m_epoll, events, 256, ms);
+	for (int i=0; i<n; i++)
+		receive(m_hotspots[events[i].data.u32]);
+	if (m_irc)
+		m_irc->process();
+}
+
+void CLoadGen::receive(CHotspot &hotspot)
+{
+	unsigned char buf[128];
+	struct sockaddr_in from;
+	socklen_t size = sizeof(from);
+	ssize_t len;
+	while ((len = recvfrom(hotspot.m_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &size)) > 0) {
+		if (4 == len && 0 == memcmp(buf, "PING", 4)) {
+			sendto(hotspot.m_fd, buf, 4, 0, (struct sockaddr *)&from, size);	// answer like a gateway
+		} else if (56 == len && 0 == memcmp(buf, "DSVT", 4)) {
+			hotspot.m_headers++;
+		} else if (27 == len && 0 == memcmp(buf, "DSVT", 4)) {
+			if (memcmp(buf + 15, MAGIC, 2))
+				continue;	// the group's own text, or something else
+			unsigned int serial;
+			memcpy(&serial, buf + 17, 4);
+			if (serial >= m_sentTime.size())
+				continue;
+			hotspot.m_frames++;
+			if (++m_deliveries[serial] > m_expected[serial]) {
+				m_duplicates++;
+				continue;
+			}
+			m_delivered++;
+			m_latencyUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_sentTime[serial]).count());
+		}
+		size = sizeof(from);
+	}
+}
+
+void CLoadGen::sendHeader(const CHotspot &hotspot, const std::string &your, unsigned short id)
+{
+	CHeaderData header;
+	header.setId(id);
+	header.setMyCall1(hotspot.user());
+	header.setMyCall2("LOAD");
+	header.setYourCall(your);
+	header.setRptCall1(hotspot.repeater());
+	header.setRptCall2(hotspot.gateway());
+	unsigned char buf[60];
+	unsigned int len = header.getG2Data(buf, 60U, true);
+	sendto(hotspot.m_fd, buf, len, 0, (struct sockaddr *)&m_serverAddr, sizeof(m_serverAddr));
+}
+
+void CLoadGen::sendFrame(const CHotspot &hotspot, unsigned short id, unsigned int seq, bool end, unsigned int serial)
+{
+	unsigned char frame[DV_FRAME_LENGTH_BYTES];
+	memcpy(frame, MAGIC, 2);
+	memcpy(frame + 2, &serial, 4);
+	memset(frame + 6, 0, VOICE_FRAME_LENGTH_BYTES - 6U);
+	if (0U == seq)
+		memcpy(frame + VOICE_FRAME_LENGTH_BYTES, DATA_SYNC_BYTES, DATA_FRAME_LENGTH_BYTES);
+	else
+		memset(frame + VOICE_FRAME_LENGTH_BYTES, 0x16, DATA_FRAME_LENGTH_BYTES);
+
+	CAMBEData data;
+	data.setId(id);
+	data.setSeq(seq);
+	data.setEnd(end);
+	data.setData(frame, DV_FRAME_LENGTH_BYTES);
+	unsigned char buf[40];
+	unsigned int len = data.getG2Data(buf, 40U);
+	sendto(hotspot.m_fd, buf, len, 0, (struct sockaddr *)&m_serverAddr, sizeof(m_serverAddr));
+}
+
+// a short transmission to the group callsign logs each hotspot on
+void CLoadGen::subscribe()
+{
+	printf("Logging %u hotspots on...\n", m_count);
+	for (unsigned int i=0; i<m_count; i++) {
+		const CHotspot &h = m_hotspots[i];
+		const unsigned short id = 1U + (i % 65000U);
+		sendHeader(h, m_groups[h.m_group], id);
+		for (unsigned int seq=0; seq<3U; seq++)
+			sendFrame(h, id, seq, 2U == seq, 0xFFFFFFFFU);
+		poll((i % SUBSCRIBE_PER_MS) ? 0 : 1);
+	}
+
+	// let the logins and the group's replies finish
+	auto until = Clock::now() + std::chrono::seconds(3);
+	while (Clock::now() < until)
+		poll(10);
+}
+
+unsigned int CLoadGen::members(unsigned int group) const
+{
+	unsigned int count = 0U;
+	for (auto it=m_hotspots.begin(); it!=m_hotspots.end(); it++) {
+		if (it->m_group == group)
+			count++;
+	}
+	return count;
+}
+
+// each group has one talker at a time, taking turns, with a second between transmissions
+void CLoadGen::talk()
+{
+	printf("Transmitting on every group for %u seconds, %u seconds at a time...\n", m_seconds, m_overSeconds);
+	m_delivered = m_duplicates = 0UL;
+
+	std::vector<unsigned int> fanout(m_groups.size());
+	std::vector<unsigned int> turn(m_groups.size(), 0U);
+	for (unsigned int g=0; g<m_groups.size(); g++)
+		fanout[g] = members(g) - 1U;	// the talker's own repeater is left out
+
+	const auto start = Clock::now();
+	const auto stop = start + std::chrono::seconds(m_seconds);
+	unsigned short nextId = 0x8000U;
+	m_talkers.resize(m_groups.size());
+	for (unsigned int g=0; g<m_groups.size(); g++) {
+		m_talkers[g].m_frames = 0U;
+		m_talkers[g].m_next = start + std::chrono::milliseconds(g * 7U % FRAME_MS);
+	}
+
+	while (true) {
+		auto now = Clock::now();
+		bool active = false;
+		for (unsigned int g=0; g<m_groups.size(); g++) {
+			CTalker &t = m_talkers[g];
+			while (t.m_next <= now) {
+				if (0U == t.m_frames) {
+					if (now >= stop)
+						break;
+					// the next hotspot in this group keys up
+					unsigned int h = turn[g]++ * m_groups.size() + g;
+					if (h >= m_count) {
+						turn[g] = 1U;
+						h = g;
+					}
+					t.m_hotspot = h;
+					t.m_id = nextId++;
+					if (nextId < 0x8000U)
+						nextId = 0x8000U;
+					t.m_seq = 0U;
+					t.m_frames = m_overSeconds * 1000U / FRAME_MS;
+					sendHeader(m_hotspots[h], "CQCQCQ  ", t.m_id);
+				}
+				const unsigned int serial = m_sentTime.size();
+				m_sentTime.push_back(Clock::now());
+				m_expected.push_back(fanout[g]);
+				m_deliveries.push_back(0U);
+				t.m_frames--;
+				sendFrame(m_hotspots[t.m_hotspot], t.m_id, t.m_seq, 0U == t.m_frames, serial);
+				t.m_seq = (t.m_seq + 1U) % 21U;
+				t.m_next += std::chrono::milliseconds(FRAME_MS);
+				if (0U == t.m_frames)
+					t.m_next += std::chrono::seconds(1);	// the gap between transmissions
+			}
+			if (t.m_frames || now < stop)
+				active = true;
+		}
+		if (! active)
+			break;
+		poll(1);
+	}
+
+	// collect the stragglers
+	auto until = Clock::now() + std::chrono::seconds(2);
+	while (Clock::now() < until)
+		poll(10);
+}
+
+void CLoadGen::report()
+{
+	unsigned long expected = 0UL;
+	for (auto it=m_expected.begin(); it!=m_expected.end(); it++)
+		expected += *it;
+	std::sort(m_latencyUs.begin(), m_latencyUs.end());
+	auto pct = [this](double q) -> unsigned int {
+		if (m_latencyUs.empty())
+			return 0U;
+		size_t i = (size_t)(q * m_latencyUs.size());
+		return m_latencyUs[std::min(i, m_latencyUs.size() - 1)];
+	};
+
+	unsigned long starved = 0UL;	// hotspots that never heard anything
+	for (auto it=m_hotspots.begin(); it!=m_hotspots.end(); it++) {
+		if (0UL == it->m_frames)
+			starved++;
+	}
+
+	const double loss = expected ? 100.0 * (expected - m_delivered) / expected : 0.0;
+	printf("{\"hotspots\":%u,\"groups\":%u,\"seconds\":%u,\"frames_sent\":%lu,\"deliveries_expected\":%lu,\"delivered\":%lu,\"duplicates\":%lu,\"loss_percent\":%.3f,"
+		"\"silent_hotspots\":%lu,\"latency_us\":{\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}}\n",
+		m_count, (unsigned int)m_groups.size(), m_seconds, (unsigned long)m_sentTime.size(), expected, m_delivered, m_duplicates, loss,
+		starved, pct(0.5), pct(0.99), pct(0.999), m_latencyUs.empty() ? 0U : m_latencyUs.back());
+}
+
+int main(int argc, char *argv[])
+{
+	setbuf(stdout, NULL);
+	CLoadGen loadgen;
+	return loadgen.run(argc, argv);
+}